@@ -0,0 +1,270 @@
+#!/usr/bin/python3
+
+##
+## Description:
+##      Template compiler script for https://github.com/bstarynk/helpcovid
+##
+## File generate-templates.py of github.com/bstarynk/helpcovid
+##
+## Author(s):
+##      © Copyright 2020
+##      Basile Starynkevitch <basile@starynkevitch.net>
+##      Abhishek Chakravarti <abhishek@taranjali.org>
+##
+##
+## License:
+##    This HELPCOVID program is free software: you can redistribute it and/or modify
+##    it under the terms of the GNU General Public License as published by
+##    the Free Software Foundation, either version 3 of the License, or
+##    (at your option) any later version.
+##
+##    This program is distributed in the hope that it will be useful,
+##    but WITHOUT ANY WARRANTY; without even the implied warranty of
+##    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+##    GNU General Public License for more details.
+##
+##    You should have received a copy of the GNU General Public License
+##    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+##****************************************************************************
+
+## This script translates every webroot/html/*.html file (and every
+## webroot/html/fragments/*.html fragment for <?hcv include ...?>) containing
+## the !HelpCoVidDynamic! magic string in its first 8 lines into a
+## table of literal parts and <?hcv ...?> processing instructions, in
+## a generated C++ file (by default __compiled_templates.cc) linked
+## into helpcovid. The splitting below mimics exactly the line by line
+## scanning done in hcv_expand_template_file of hcv_template.cc, so
+## keep both in sync. At startup, helpcovid checks the size and FNV-1a
+## hash of each source file, and uses its compiled form only when the
+## source is unchanged.
+
+import argparse
+import glob
+import os
+import sys
+
+
+DYNAMIC_MAGIC = b"!HelpCoVidDynamic!"
+PI_START = b"<?hcv "
+PI_END = b"?>"
+MAX_TEMPLATE_SIZE = 128*1024    # hcv_max_template_size in hcv_template.cc
+
+FNV64_OFFSET = 0xcbf29ce484222325
+FNV64_PRIME = 0x100000001b3
+
+
+def fnv1a_64(data):
+    hsh = FNV64_OFFSET
+    for byte in data:
+        hsh ^= byte
+        hsh = (hsh * FNV64_PRIME) & 0xffffffffffffffff
+    return hsh
+
+
+def cxx_literal(data):
+    """return C++ string literal(s) for some bytes, one per source line"""
+    chunks = []
+    cur = []
+    for byte in data:
+        if byte == 0x5c:
+            cur.append("\\\\")
+        elif byte == 0x22:
+            cur.append("\\\"")
+        elif byte == 0x0a:
+            cur.append("\\n")
+            chunks.append("\"" + "".join(cur) + "\"")
+            cur = []
+        elif byte == 0x09:
+            cur.append("\\t")
+        elif 0x20 <= byte < 0x7f:
+            cur.append(chr(byte))
+        else:
+            cur.append("\\%03o" % byte)
+    if cur or not chunks:
+        chunks.append("\"" + "".join(cur) + "\"")
+    return chunks
+
+
+
+class TemplateError(Exception):
+    pass
+
+
+
+class Generator:
+    def __init__(self, webroot, output):
+        if not webroot.endswith("/"):
+            webroot += "/"
+        self.webroot = webroot
+        self.output = output
+        self.html_files = sorted(glob.glob(self.webroot + "html/*.html")
+                                 + glob.glob(self.webroot + "html/fragments/*.html"))
+        if not self.html_files:
+            print("no HTML templates under " + self.webroot + "html/")
+            sys.exit(1)
+
+
+    @staticmethod
+    def is_dynamic(data):
+        return DYNAMIC_MAGIC in b"\n".join(data.split(b"\n")[:8])
+
+
+    @staticmethod
+    def split_parts(data, path):
+        """split some template into a list of (is_pi, bytes, lineno, offset)"""
+        lines = data.split(b"\n")
+        if lines and lines[-1] == b"":
+            lines.pop()
+        parts = []
+
+        def add(is_pi, text, lineno, offset):
+            if not text:
+                return
+            if not is_pi and parts and not parts[-1][0]:
+                prev = parts.pop()
+                parts.append((False, prev[1] + text, prev[2], prev[3]))
+            else:
+                parts.append((is_pi, text, lineno, offset))
+
+        offset = 0
+        for lineno, line in enumerate(lines, 1):
+            if b"\0" in line:
+                raise TemplateError("%s:%d: NUL byte" % (path, lineno))
+            if lineno < 8 and len(line) > 4 and line.startswith(b"<!"):
+                add(False, line + b"\n", lineno, offset)
+            elif line:
+                cur = 0
+                while cur is not None:
+                    start = line.find(PI_START, cur)
+                    if start < 0:
+                        break
+                    end = line.find(PI_END, cur + len(PI_START))
+                    if end < 0:
+                        print("%s:%d: unclosed template markup" % (path, lineno))
+                        add(False, line[cur:], lineno, offset)
+                        cur = None
+                        break
+                    if end < start + len(PI_START):
+                        raise TemplateError("%s:%d: misplaced ?> before <?hcv"
+                                            % (path, lineno))
+                    add(False, line[cur:start], lineno, offset)
+                    add(True, line[start:end+2], lineno, offset)
+                    cur = end + 2
+                if cur is not None:
+                    add(False, line[cur:], lineno, offset)
+                add(False, b"\n", lineno, offset)
+            else:
+                add(False, b"\n", lineno, offset)
+            offset += len(line) + 1
+        return parts
+
+
+    @staticmethod
+    def check_blocks(parts, path):
+        """check the nesting of foreach, if, else, end and cell blocks,
+        like hcv_structure_template_plan in hcv_template.cc"""
+        stack = []
+        for (is_pi, text, lineno, offset) in parts:
+            if not is_pi:
+                continue
+            words = text[len(PI_START):-len(PI_END)].split()
+            name = words[0] if words else b""
+            if name in (b"foreach", b"if"):
+                stack.append([name, False, lineno])
+            elif name == b"else":
+                if not stack or stack[-1][0] != b"if" or stack[-1][1]:
+                    raise TemplateError("%s:%d: misplaced else" % (path, lineno))
+                stack[-1][1] = True
+            elif name == b"end":
+                if not stack:
+                    raise TemplateError("%s:%d: unmatched end" % (path, lineno))
+                stack.pop()
+            elif name == b"cell":
+                if not any(blk[0] == b"foreach" for blk in stack):
+                    raise TemplateError("%s:%d: cell outside of foreach"
+                                        % (path, lineno))
+        if stack:
+            raise TemplateError("%s:%d: unclosed %s block"
+                                % (path, stack[-1][2], stack[-1][0].decode()))
+
+
+    def run(self):
+        compiled = []
+        for html_file in self.html_files:
+            with open(html_file, "rb") as src_file:
+                data = src_file.read()
+            if len(data) > MAX_TEMPLATE_SIZE or not self.is_dynamic(data):
+                continue
+            relpath = os.path.relpath(html_file, self.webroot)
+            try:
+                parts = self.split_parts(data, html_file)
+                self.check_blocks(parts, html_file)
+            except TemplateError as err:
+                print("not compiling " + str(err))
+                continue
+            compiled.append((relpath, len(data), fnv1a_64(data), parts))
+
+        tmp = self.output + "-tmp"
+        with open(tmp, "w") as dest_file:
+            dest_file.write("/* generated file %s -- DO NOT EDIT\n"
+                            " * by generate-templates.py of"
+                            " https://github.com/bstarynk/helpcovid\n"
+                            " * from %d templates of %s */\n\n"
+                            % (os.path.basename(self.output), len(compiled),
+                               self.webroot))
+            dest_file.write("#include \"hcv_header.hh\"\n\n")
+            for rank, (relpath, size, hsh, parts) in enumerate(compiled):
+                dest_file.write("//// %d parts from %s\n" % (len(parts), relpath))
+                dest_file.write("static constexpr Hcv_template_part"
+                                " hcvctempl_parts_%d[] =\n{\n" % rank)
+                for (is_pi, text, lineno, offset) in parts:
+                    lits = cxx_literal(text)
+                    dest_file.write("  {\n    " + "\n    ".join(lits) + ",\n")
+                    dest_file.write("    %d, %s, %d, %dL\n  },\n"
+                                    % (len(text), "true" if is_pi else "false",
+                                       lineno, offset))
+                dest_file.write("}; // end hcvctempl_parts_%d\n\n" % rank)
+            dest_file.write("static void hcvctempl_register(void)"
+                            " __attribute__((constructor));\n\n")
+            dest_file.write("static void\nhcvctempl_register(void)\n{\n")
+            for rank, (relpath, size, hsh, parts) in enumerate(compiled):
+                dest_file.write("  hcv_register_compiled_template(\"%s\", %dL,"
+                                " 0x%016xULL,\n" % (relpath, size, hsh))
+                dest_file.write("                                 hcvctempl_parts_%d,"
+                                " sizeof(hcvctempl_parts_%d)/sizeof(Hcv_template_part));\n"
+                                % (rank, rank))
+            dest_file.write("} // end hcvctempl_register\n\n")
+            dest_file.write("/**** end of generated file %s ****/\n"
+                            % os.path.basename(self.output))
+        os.replace(tmp, self.output)
+
+        print("Generated " + self.output + " from "
+              + str(len(compiled)) + " templates")
+
+
+
+class Cmdline:
+    def __init__(self):
+        prog = "generate-templates.py"
+        desc = ("Compiles dynamic HTML templates of HelpCovid into C++;"
+                " see https://github.com/bstarynk/helpcovid/")
+        usage = "%(prog)s [--webroot DIR] [--output FILE]"
+
+        parser = argparse.ArgumentParser(prog = prog, description = desc,
+            usage = usage)
+        parser.add_argument("--webroot", type = str, default = "webroot/",
+            help = "web root directory containing html/")
+        parser.add_argument("--output", type = str,
+            default = "__compiled_templates.cc",
+            help = "generated C++ file")
+
+        self.args = parser.parse_args()
+
+
+    def parse(self):
+        Generator(self.args.webroot, self.args.output).run()
+
+
+
+if __name__ == "__main__":
+    Cmdline().parse()
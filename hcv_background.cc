@@ -45,7 +45,7 @@ struct hcv_todo_st
   void* hcvtodo_data;		// data pointer
   std::function<void(void*)> hcvtodo_func;
 };
-std::map<double, hcv_todo_st> hcv_todo_map;
+std::multimap<double, hcv_todo_st> hcv_todo_map;
 std::recursive_mutex hcv_todo_mtx;
 #define HCV_MAX_TODO 1024
 
@@ -53,6 +53,11 @@ void hcv_process_SIGTERM_signal(void);
 void hcv_process_SIGXCPU_signal(void);
 void hcv_process_SIGHUP_signal(void);
 void hcv_bg_do_event(int64_t); // handle one event on hcv_bg_event_fd
+void hcv_bg_expire_web_sessions(void*);
+void hcv_bg_rotate_cookie_key(void*);
+void hcv_bg_purge_web_cookies(void*);
+void hcv_bg_refresh_email_filter(void*);
+#define HCV_WEB_SESSION_EXPIRY_PERIOD 60.0 /*seconds*/
 
 #define HCV_BACKGROUND_TICK_TIMEOUT 16384 /*milliseconds*/
 void hcv_background_thread_body(void)
@@ -72,8 +77,8 @@ void hcv_background_thread_body(void)
       polltab[0].events = POLL_IN;
       polltab[1].fd = hcv_bg_signal_fd;
       polltab[1].events = POLL_IN;
-      polltab[1].fd = hcv_bg_timer_fd;
-      polltab[1].events = POLL_IN;
+      polltab[2].fd = hcv_bg_timer_fd;
+      polltab[2].events = POLL_IN;
       int nbfd = poll(polltab, 3, HCV_BACKGROUND_TICK_TIMEOUT);
       if (nbfd==0)   /* timedout */
         {
@@ -157,6 +162,9 @@ void hcv_background_thread_body(void)
             };
           if ((polltab[2].revents & POLL_IN) && polltab[2].fd == hcv_bg_timer_fd)
             {
+              uint64_t nbexpir=0;
+              if (read(hcv_bg_timer_fd, &nbexpir, sizeof(nbexpir)) == sizeof(nbexpir))
+                hcv_bg_do_event(0);
             }
         }
       else
@@ -199,9 +207,63 @@ hcv_start_background_thread(void)
   });
   HCV_DEBUGOUT("hcv_start_background_thread did start hcv_bgthread of id "
                << hcv_bgthread.get_id());
+  hcv_do_postpone_background(HCV_WEB_SESSION_EXPIRY_PERIOD, "web session expiry",
+                             nullptr, hcv_bg_expire_web_sessions);
+  hcv_do_postpone_background(HCV_POSTPONE_MINIMAL_DELAY, "cookie key rotation",
+                             nullptr, hcv_bg_rotate_cookie_key);
+  hcv_do_postpone_background(HCV_WEB_SESSION_EXPIRY_PERIOD, "web cookie purge",
+                             nullptr, hcv_bg_purge_web_cookies);
+  hcv_do_postpone_background(HCV_POSTPONE_MINIMAL_DELAY, "known email refresh",
+                             nullptr, hcv_bg_refresh_email_filter);
 } // end of hcv_start_background_thread
 
 
+/// remove the expired web sessions from memory, then do it again later
+void
+hcv_bg_expire_web_sessions(void*)
+{
+  hcv_web_expire_sessions();
+  hcv_do_postpone_background(HCV_WEB_SESSION_EXPIRY_PERIOD, "web session expiry",
+                             nullptr, hcv_bg_expire_web_sessions);
+} // end hcv_bg_expire_web_sessions
+
+
+/// rotate the key of signed web cookies when due, then come back
+/// later. The rotation period can exceed the maximal postponing delay.
+void
+hcv_bg_rotate_cookie_key(void*)
+{
+  static double nextrotation;
+  double nowt = hcv_monotonic_real_time();
+  if (nowt >= nextrotation)
+    nextrotation = nowt + hcv_web_rotate_cookie_key();
+  hcv_do_postpone_background(std::min(nextrotation - nowt, HCV_POSTPONE_MAXIMAL_DELAY),
+                             "cookie key rotation", nullptr, hcv_bg_rotate_cookie_key);
+} // end hcv_bg_rotate_cookie_key
+
+
+/// delete a batch of expired web cookies in the database, then come
+/// back after a delay depending upon that batch
+void
+hcv_bg_purge_web_cookies(void*)
+{
+  double delay = hcv_database_purge_expired_cookies();
+  hcv_do_postpone_background(delay, "web cookie purge",
+                             nullptr, hcv_bg_purge_web_cookies);
+} // end hcv_bg_purge_web_cookies
+
+
+/// add the users created by other processes to the filter of known
+/// emails, then come back later
+void
+hcv_bg_refresh_email_filter(void*)
+{
+  double delay = hcv_database_refresh_email_filter();
+  hcv_do_postpone_background(delay, "known email refresh",
+                             nullptr, hcv_bg_refresh_email_filter);
+} // end hcv_bg_refresh_email_filter
+
+
 void
 hcv_stop_background_thread(void)
 {
@@ -236,32 +298,50 @@ hcv_process_SIGXCPU_signal(void)
 } // end hcv_process_SIGXCPU_signal
 
 
+/// reload the configuration file, which bumps the configuration
+/// generation of cache keys, and forget all the cached pages, e.g.
+/// after editing templates. A configuration file which does not load
+/// anymore is ignored, keeping the previous one. Most settings are
+/// still read only at startup.
 void
 hcv_process_SIGHUP_signal(void)
 {
-  HCV_FATALOUT("hcv_process_SIGHUP_signal unimplemented");
-#warning hcv_process_SIGHUP_signal unimplemented
-  /* we want to flush the database */
+  std::string configpath = hcv_get_config_file_path();
+  try
+    {
+      Glib::KeyFile newkf;
+      if (!configpath.empty() && newkf.load_from_file(configpath))
+        hcv_load_config_file(configpath.c_str());
+    }
+  catch (Glib::Exception& gex)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_process_SIGHUP_signal keeps the previous configuration, "
+                    << configpath << " failed to load: " << gex.what());
+    }
+  hcv_invalidate_page_cache();
+  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_process_SIGHUP_signal reloaded " << configpath
+                << " generation#" << hcv_get_config_generation());
 } // end hcv_process_SIGHUP_signal
 
 
-// process eventfd, and also SIGPIPE
+// process eventfd, the timer, and also SIGPIPE: run the todos which
+// are due, then arm the timer for the next one
 void
 hcv_bg_do_event(int64_t ev)
 {
   HCV_DEBUGOUT("hcv_bg_do_event ev=" << ev);
   std::lock_guard<std::recursive_mutex> gu(hcv_todo_mtx);
   auto beg = hcv_todo_map.begin();
+  while (beg != hcv_todo_map.end()
+         && beg->first <= hcv_monotonic_real_time())
+    {
+      auto todo = beg->second;
+      hcv_todo_map.erase(beg);
+      todo.hcvtodo_func(todo.hcvtodo_data);
+      beg = hcv_todo_map.begin();
+    }
   if (beg == hcv_todo_map.end())
     return;
-  {
-    auto todo = beg->second;
-    hcv_todo_map.erase(beg);
-    todo.hcvtodo_func(todo.hcvtodo_data);
-    beg = hcv_todo_map.begin();
-    if (beg == hcv_todo_map.end())
-      return;
-  }
   auto todonext =  beg->second;
   double nextim = todonext.hcvtodo_time;
   double fractim=0.0, itim=0.0;
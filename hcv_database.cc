@@ -32,359 +32,2803 @@
 extern "C" const char hcv_database_gitid[] = HELPCOVID_GITID;
 extern "C" const char hcv_database_date[] = __DATE__;
 
-/// the database connection
-std::unique_ptr<pqxx::connection> hcv_dbconn;
-
 /// the short PostGreSQL server version
 std::string hcv_our_postgresql_server_version;
 
-/// the recursive mutex to serialize access to that database
-std::recursive_mutex hcv_dbmtx;
-
 extern "C" void hcv_prepare_statements_in_database(void);
 
 
-Hcv_PreparedStatement::Hcv_PreparedStatement(const std::string& name)
-  : m_name(name)
+////////////////////////////////////////////////////////////////
+//// the pool of PostGreSQL connections. A slot is either leased by
+//// some Hcv_database_connection, or idle in hcv_dbpool_idle. Slots
+//// are connected lazily, up to [postgresql] pool_size of them.
+struct hcv_dbpool_slot_st
 {
-  std::lock_guard<std::recursive_mutex> guard(hcv_dbmtx);
-  m_txn = new pqxx::work(*hcv_dbconn);
-  m_inv = new pqxx::prepare::invocation(m_txn->prepared(m_name));
-#warning TODO: pqxx::transaction_base::prepared is deprecated and should not be used.
-} // end Hcv_PreparedStatement::Hcv_PreparedStatement
+  std::unique_ptr<pqxx::connection> hcvdbslot_conn; // null until connected
+  std::set<std::string> hcvdbslot_prepared; // statements prepared on it
+  double hcvdbslot_lastcheck;	// monotonic time of last use or check
+  bool hcvdbslot_broken;	// should reconnect at next lease
+  int hcvdbslot_replica;	// index in hcv_dbreplicas, or -1 on the primary
+  bool hcvdbslot_timeout;	// has some session statement_timeout
+};
+
+/// the connection leased by the current thread with a session
+/// statement_timeout for its request deadline, see
+/// hcv_dbpool_set_slot_timeout
+static thread_local const pqxx::connection_base* hcv_dbtimeout_conn;
+
+#define HCV_DBPOOL_DEFAULT_SIZE 4
+#define HCV_DBPOOL_MAXIMAL_SIZE 64
+#define HCV_DBPOOL_DEFAULT_CHECKOUT_TIMEOUT 5.0
+#define HCV_DBPOOL_DEFAULT_HEALTH_INTERVAL 30.0
 
+static std::mutex hcv_dbpool_mtx;
+static std::condition_variable hcv_dbpool_changed;
+static std::vector<std::unique_ptr<hcv_dbpool_slot_st>> hcv_dbpool_slots;
+static std::vector<hcv_dbpool_slot_st*> hcv_dbpool_idle;
+static std::string hcv_dbpool_connstr; // empty without database
+static unsigned hcv_dbpool_size = HCV_DBPOOL_DEFAULT_SIZE;
+static double hcv_dbpool_checkout_timeout = HCV_DBPOOL_DEFAULT_CHECKOUT_TIMEOUT;
+static double hcv_dbpool_health_interval = HCV_DBPOOL_DEFAULT_HEALTH_INTERVAL;
+static std::atomic<long> hcv_dbpool_waits;
+static std::atomic<long> hcv_dbpool_timeouts;
+static std::atomic<long> hcv_dbpool_reconnects;
 
-Hcv_PreparedStatement::~Hcv_PreparedStatement()
+//// the read replicas of [postgresql] replicas, each with its own slots,
+//// up to pool_size of them. A read goes to some replica whose replay
+//// lag, measured at most every second, is below replica_max_lag and
+//// below the time elapsed since the last write of its web session;
+//// otherwise it goes to the primary, without waiting.
+struct hcv_dbreplica_st
 {
-  delete m_inv;
-  delete m_txn;
-}
+  std::string hcvdbrep_connstr;
+  std::vector<std::unique_ptr<hcv_dbpool_slot_st>> hcvdbrep_slots;
+  std::vector<hcv_dbpool_slot_st*> hcvdbrep_idle;
+  double hcvdbrep_lag;		// last measured replay lag, in seconds
+  double hcvdbrep_lagtime;	// monotonic time of that measure
+  double hcvdbrep_downuntil;	// unused until then, after some failure
+};
 
+#define HCV_DBREPLICA_DEFAULT_MAX_LAG 1.0 /*seconds*/
+#define HCV_DBREPLICA_MAXIMAL_COUNT 16
+#define HCV_DBREPLICA_LAG_CHECK_INTERVAL 1.0 /*seconds*/
+#define HCV_DBREPLICA_RETRY_DELAY 10.0 /*seconds*/
 
-void
-Hcv_PreparedStatement::bind(const std::string& arg)
+/// filled by hcv_initialize_database, then guarded by hcv_dbpool_mtx
+static std::vector<std::unique_ptr<hcv_dbreplica_st>> hcv_dbreplicas;
+static double hcv_dbreplica_maxlag = HCV_DBREPLICA_DEFAULT_MAX_LAG;
+static std::atomic<unsigned> hcv_dbreplica_next; // for round robin
+static std::atomic<long> hcv_dbreplica_reads;
+static std::atomic<long> hcv_dbreplica_primaryreads;
+
+/// for read-your-writes, the monotonic time of the last write of
+/// recent web sessions, keyed by hcv_database_set_session_key. When
+/// there are too many of them, all reads go to the primary for a while
+#define HCV_DBSESSION_MAXIMAL_WRITERS 16384
+static thread_local size_t hcv_dbsession_key;
+static std::mutex hcv_dbsession_mtx;
+static std::unordered_map<size_t,double> hcv_dbsession_lastwrite;
+static double hcv_dbsession_allprimary_until;
+
+/// the statements registered by hcv_database_register_prepared_statement,
+/// SQL by name
+static std::shared_mutex hcv_dbstatements_mtx;
+static std::map<std::string,std::string> hcv_dbstatements_dict;
+
+/// with [postgresql] pooler_mode, for a transaction pooler like
+/// PgBouncer between us and PostGreSQL, nothing is left in the server
+/// session: registered statements run unnamed, by the extended
+/// protocol, instead of being prepared on each connection
+static std::atomic<bool> hcv_dbpooler_mode;
+
+//// lock-free histograms with logarithmic buckets, as in HdrHistogram:
+//// values below 8 have their own bucket, larger ones are bucketed by
+//// their highest bit and the 3 following bits, so within 12.5%
+#define HCV_DBHISTO_SUBBUCKETS 8
+#define HCV_DBHISTO_MAXBITS 42	/* 2**42 microseconds is 50 days */
+#define HCV_DBHISTO_NBBUCKETS ((HCV_DBHISTO_MAXBITS-1)*HCV_DBHISTO_SUBBUCKETS)
+struct hcv_dbhistogram_st
+{
+  std::atomic<long> hcvdbh_buckets[HCV_DBHISTO_NBBUCKETS];
+  std::atomic<long> hcvdbh_count;
+  std::atomic<long> hcvdbh_max;
+};
+
+/// the statistics of a registered statement, never freed, also
+/// guarded by hcv_dbstatements_mtx; times are in microseconds
+struct hcv_dbstmt_stats_st
 {
-  if (m_inv)
-    (*m_inv)(arg);
-}
+  std::string hcvdbst_name;
+  hcv_dbhistogram_st hcvdbst_wait; // for a pooled connection or the executor
+  hcv_dbhistogram_st hcvdbst_exec;
+  hcv_dbhistogram_st hcvdbst_rows;
+  std::atomic<long> hcvdbst_nbslow;
+};
+static std::map<std::string,std::unique_ptr<hcv_dbstmt_stats_st>> hcv_dbstmt_stats_dict;
 
+#define HCV_DBSTMT_DEFAULT_SLOW_THRESHOLD 500.0 /*milliseconds*/
+static std::atomic<double> hcv_dbstmt_slow_threshold = HCV_DBSTMT_DEFAULT_SLOW_THRESHOLD;
 
-void
-Hcv_PreparedStatement::bind(std::int64_t arg)
+//// the statements running for requests with a deadline, watched by
+//// the watchdog thread, which cancels them when their deadline passes
+//// by pg_cancel_backend on its own connection to the same server,
+//// since the connection running the statement belongs to its thread
+struct hcv_dbwatch_st
 {
-  if (m_inv)
-    (*m_inv)(arg);
-}
+  const pqxx::connection_base* hcvdbw_conn; // only compared, never used
+  int hcvdbw_backendpid;
+  const char* hcvdbw_stmtname;
+  double hcvdbw_deadline;	// monotonic time
+};
+static std::mutex hcv_dbwatch_mtx;
+static std::condition_variable hcv_dbwatch_changed;
+static std::multimap<double,hcv_dbwatch_st*> hcv_dbwatch_dict; // by deadline
+/// the watch being cancelled, outside of our lock; its guard waits
+static hcv_dbwatch_st* hcv_dbwatch_cancelling;
+static std::condition_variable hcv_dbwatch_cancelled_cond;
+static std::atomic<long> hcv_dbwatch_cancelled;
+
+//// the web cookie insertions of concurrent requests are coalesced:
+//// the first waiting request is the leader, which waits for at most
+//// [postgresql] cookie_batch_delay milliseconds, or until
+//// cookie_batch_size insertions are waiting, then inserts all of them
+//// with one statement, while the others wait for their id.
+struct hcv_cookie_insert_st
+{
+  std::string hcvcookins_random;
+  long hcvcookins_exptime;
+  int hcvcookins_webagenthash;
+  long hcvcookins_id;		// -1 if not found, -2 on failure
+  bool hcvcookins_taken;	// in the batch of some leader
+  bool hcvcookins_done;
+};
+
+#define HCV_COOKIE_BATCH_DEFAULT_SIZE 32
+#define HCV_COOKIE_BATCH_MAXIMAL_SIZE 1024
+#define HCV_COOKIE_BATCH_DEFAULT_DELAY 2.0 /*milliseconds*/
+#define HCV_COOKIE_BATCH_MAXIMAL_DELAY 100.0 /*milliseconds*/
+/// beyond that, a batch sent to the asynchronous executor is inserted
+/// again synchronously; its late rows, if any, just expire
+#define HCV_COOKIE_BATCH_ASYNC_TIMEOUT 3.0 /*seconds*/
+
+static std::mutex hcv_cookie_batch_mtx;
+static std::condition_variable hcv_cookie_batch_changed;
+static std::deque<hcv_cookie_insert_st*> hcv_cookie_batch_pending;
+static std::atomic<long> hcv_cookie_batch_size = HCV_COOKIE_BATCH_DEFAULT_SIZE;
+static std::atomic<double> hcv_cookie_batch_delay = HCV_COOKIE_BATCH_DEFAULT_DELAY;
+static std::atomic<long> hcv_cookie_batch_flushes;
+static std::atomic<long> hcv_cookie_batch_inserted;
 
+//// the expired web cookies are purged by the background thread, in
+//// batches whose size adapts to the time taken by their DELETE, and
+//// which slow down when replicas lag; see [postgresql] purge_batch_size,
+//// purge_period, purge_target_time and purge_max_replication_lag
+#define HCV_COOKIE_PURGE_DEFAULT_BATCH 1000
+#define HCV_COOKIE_PURGE_MINIMAL_BATCH 10
+#define HCV_COOKIE_PURGE_MAXIMAL_BATCH 100000
+#define HCV_COOKIE_PURGE_DEFAULT_PERIOD 60.0 /*seconds*/
+#define HCV_COOKIE_PURGE_DEFAULT_TARGET 0.05 /*seconds*/
+#define HCV_COOKIE_PURGE_DEFAULT_MAX_LAG 5.0 /*seconds*/
+#define HCV_COOKIE_PURGE_LOCK_TIMEOUT "200ms"
 
-pqxx::result
-Hcv_PreparedStatement::query()
+static long hcv_cookie_purge_maxbatch = HCV_COOKIE_PURGE_DEFAULT_BATCH;
+static long hcv_cookie_purge_batch = HCV_COOKIE_PURGE_DEFAULT_BATCH; // adapted
+static double hcv_cookie_purge_period = HCV_COOKIE_PURGE_DEFAULT_PERIOD;
+static double hcv_cookie_purge_target = HCV_COOKIE_PURGE_DEFAULT_TARGET;
+static double hcv_cookie_purge_maxlag = HCV_COOKIE_PURGE_DEFAULT_MAX_LAG;
+static std::mutex hcv_cookie_purge_mtx;
+static std::deque<std::pair<double,long>> hcv_cookie_purge_recent; // monotonic time, rows
+static std::atomic<long> hcv_cookie_purged;
+static std::atomic<long> hcv_cookie_partitions_dropped;
+/// with [postgresql] cookie_partitioning, tb_web_cookie is partitioned
+/// by range of wcookie_exptime: "hour" or "day" as for date_trunc, or
+/// empty for a plain table
+static std::string hcv_cookie_partition_step;
+#define HCV_COOKIE_PARTITIONS_AHEAD_HOURS 6
+#define HCV_COOKIE_PARTITIONS_AHEAD_DAYS 2
+static std::atomic<double> hcv_cookie_purge_lag;
+
+//// a Bloom filter of the known emails, normalized in lowercase,
+//// loaded at startup and completed by user creations and by a
+//// periodic scan of the newer users, so a negative answer of
+//// hcv_database_with_known_email needs no round trip. With 16 bits
+//// per email and 8 hash functions, about 0.05% of unknown emails are
+//// false positives, confirmed by the database. It is rebuilt twice
+//// bigger when full. Null (so unused) until loaded, or without
+//// [postgresql] email_filter
+struct hcv_emailfilter_st
 {
-  if (!m_inv)
-    HCV_FATALOUT("Invcation not initialised!");
+  std::unique_ptr<std::atomic<uint64_t>[]> hcvef_words;
+  size_t hcvef_nbbits;		// a power of two
+  long hcvef_capacity;		// in emails
+  std::atomic<long> hcvef_count;
+  long hcvef_lastid;		// greatest user_id scanned
+  long hcvef_rescanid;		// rescan from there, for late commits
+};
+#define HCV_EMAILFILTER_NBHASH 8
+#define HCV_EMAILFILTER_BITS_PER_EMAIL 16
+#define HCV_EMAILFILTER_MINIMAL_CAPACITY 65536
+#define HCV_EMAILFILTER_SCAN_CHUNK 10000
+#define HCV_EMAILFILTER_DEFAULT_REFRESH 2.0 /*seconds*/
+static std::shared_mutex hcv_emailfilter_mtx;
+static std::unique_ptr<hcv_emailfilter_st> hcv_emailfilter;
+/// while the filter is rebuilt, the keys noted meanwhile are also
+/// kept here, then added to the new filter when it replaces the old
+static bool hcv_emailfilter_rebuilding; // under hcv_emailfilter_mtx
+static std::mutex hcv_emailfilter_notedmtx;
+static std::vector<std::string> hcv_emailfilter_noted;
+static bool hcv_emailfilter_wanted = true;
+static double hcv_emailfilter_refresh = HCV_EMAILFILTER_DEFAULT_REFRESH;
+static std::atomic<long> hcv_emailfilter_negatives;
+static std::atomic<long> hcv_emailfilter_confirmed;
+static std::atomic<long> hcv_emailfilter_falsepositives;
+static void hcv_emailfilter_load(void);
 
-  pqxx::result res = m_inv->exec();
-  m_txn->commit();
 
-  return res;
-}
+static const std::string&
+hcv_dbpool_slot_connstr(const hcv_dbpool_slot_st*slot)
+{
+  if (slot->hcvdbslot_replica >= 0)
+    return hcv_dbreplicas[slot->hcvdbslot_replica]->hcvdbrep_connstr;
+  return hcv_dbpool_connstr;
+} // end hcv_dbpool_slot_connstr
 
 
-const std::string
-hcv_postgresql_version(void)
+/// called on a freshly leased slot, without the pool lock
+static void
+hcv_dbpool_check_slot(hcv_dbpool_slot_st*slot)
 {
-  return hcv_our_postgresql_server_version;
-} // end  hcv_postgresql_version
+  double nowt = hcv_monotonic_real_time();
+  if (slot->hcvdbslot_conn && !slot->hcvdbslot_broken
+      && nowt - slot->hcvdbslot_lastcheck > hcv_dbpool_health_interval)
+    {
+      try
+        {
+          pqxx::nontransaction checktransact(*slot->hcvdbslot_conn);
+          checktransact.exec("SELECT 1");
+        }
+      catch (std::exception& exc)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbpool_check_slot: unhealthy PostGreSQL connection: "
+                        << exc.what());
+          slot->hcvdbslot_broken = true;
+        }
+    }
+  if (!slot->hcvdbslot_conn || slot->hcvdbslot_broken)
+    {
+      if (slot->hcvdbslot_conn)
+        hcv_dbpool_reconnects++;
+      slot->hcvdbslot_conn.reset();
+      slot->hcvdbslot_prepared.clear();
+      slot->hcvdbslot_timeout = false;
+      slot->hcvdbslot_conn.reset(new pqxx::connection(hcv_dbpool_slot_connstr(slot)));
+      slot->hcvdbslot_broken = false;
+      HCV_DEBUGOUT("hcv_dbpool_check_slot connected " << hcv_dbpool_slot_connstr(slot));
+    }
+  slot->hcvdbslot_lastcheck = nowt;
+} // end hcv_dbpool_check_slot
 
 
+static void
+hcv_dbpool_release_slot(hcv_dbpool_slot_st*slot)
+{
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    if (slot->hcvdbslot_replica >= 0)
+      {
+        /// nobody waits for a replica slot
+        hcv_dbreplicas[slot->hcvdbslot_replica]->hcvdbrep_idle.push_back(slot);
+        return;
+      }
+    hcv_dbpool_idle.push_back(slot);
+  }
+  hcv_dbpool_changed.notify_one();
+} // end hcv_dbpool_release_slot
+
 
 void
-hcv_initialize_database(const std::string&uri, bool cleardata)
+hcv_database_set_session_key(size_t key)
 {
-  std::string connstr = uri;
-  if (connstr.empty())
+  hcv_dbsession_key = key;
+} // end hcv_database_set_session_key
+
+
+/// remember that the current web session just wrote on the primary
+static void
+hcv_dbsession_wrote(size_t key)
+{
+  double nowt = hcv_monotonic_real_time();
+  std::lock_guard<std::mutex> gu(hcv_dbsession_mtx);
+  if (hcv_dbsession_lastwrite.size() >= HCV_DBSESSION_MAXIMAL_WRITERS
+      && hcv_dbsession_lastwrite.find(key) == hcv_dbsession_lastwrite.end())
     {
-      if (hcv_config_has_group("postgresql"))
+      /// writes older than replica_max_lag are seen on every used replica
+      for (auto it = hcv_dbsession_lastwrite.begin(); it != hcv_dbsession_lastwrite.end(); )
         {
-          hcv_config_do([&connstr](const Glib::KeyFile*kf)
-          {
-            if (!kf->has_key("postgresql","connection"))
-              HCV_FATALOUT("missing 'connection' key in [postgresql] section of configuration");
-            connstr = kf->get_string("postgresql","connection");
-            HCV_SYSLOGOUT(LOG_INFO, "using '" << connstr
-                          << "' as PostGreSQL connection string.");
-          });
+          if (nowt - it->second > hcv_dbreplica_maxlag)
+            it = hcv_dbsession_lastwrite.erase(it);
+          else
+            it++;
         }
-      else
+      if (hcv_dbsession_lastwrite.size() >= HCV_DBSESSION_MAXIMAL_WRITERS)
         {
-          HCV_SYSLOGOUT(LOG_WARNING, "cannot initialize database. Configuration file should have a [postgresql] group.");
-          return;
+          hcv_dbsession_lastwrite.clear();
+          hcv_dbsession_allprimary_until = nowt + hcv_dbreplica_maxlag;
         }
-    };
-  if (connstr.empty() || connstr=="-")
+    }
+  hcv_dbsession_lastwrite[key] = nowt;
+} // end hcv_dbsession_wrote
+
+
+/// the replay lag of a replica, in seconds; 0 when it replayed all
+/// it received, since an idle primary gives no fresh transaction
+static const char hcv_dbreplica_lag_sql[] = R"replicalag(
+SELECT CASE WHEN NOT pg_is_in_recovery()
+              OR pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0
+            ELSE COALESCE(EXTRACT(EPOCH FROM
+                   now() - pg_last_xact_replay_timestamp()), 0) END::float8
+)replicalag";
+
+/// lease a connection to some usable replica, or give null
+static hcv_dbpool_slot_st*
+hcv_dbreplica_lease(void)
+{
+  double nowt = hcv_monotonic_real_time();
+  double maxlag = hcv_dbreplica_maxlag;
+  if (hcv_dbsession_key != 0)
     {
-      HCV_SYSLOGOUT(LOG_WARNING, "no PostGreSQL database initialization: " << connstr);
-      return;
+      std::lock_guard<std::mutex> gu(hcv_dbsession_mtx);
+      auto it = hcv_dbsession_lastwrite.find(hcv_dbsession_key);
+      if (nowt < hcv_dbsession_allprimary_until)
+        maxlag = 0.0;
+      else if (it != hcv_dbsession_lastwrite.end() && nowt - it->second < maxlag)
+        maxlag = nowt - it->second;
     }
-  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database connstr=" << connstr);
-  ///
-  hcv_dbconn.reset(new pqxx::connection(connstr));
+  if (maxlag <= 0.0)
+    return nullptr;
+  hcv_dbpool_slot_st*slot = nullptr;
+  hcv_dbreplica_st*rep = nullptr;
+  bool stalelag = false;
   {
-    HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database for connstr=" << connstr << " hcv_dbconn is " << hcv_dbconn.get());
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    unsigned nbrep = hcv_dbreplicas.size();
+    if (nbrep == 0)
+      return nullptr;
+    unsigned start = hcv_dbreplica_next++;
+    for (unsigned cnt = 0; cnt < nbrep && !slot; cnt++)
+      {
+        int ix = (int) ((start + cnt) % nbrep);
+        rep = hcv_dbreplicas[ix].get();
+        stalelag = nowt - rep->hcvdbrep_lagtime >= HCV_DBREPLICA_LAG_CHECK_INTERVAL;
+        if (rep->hcvdbrep_downuntil > nowt || (!stalelag && rep->hcvdbrep_lag >= maxlag))
+          continue;
+        if (!rep->hcvdbrep_idle.empty())
+          {
+            slot = rep->hcvdbrep_idle.back();
+            rep->hcvdbrep_idle.pop_back();
+          }
+        else if (rep->hcvdbrep_slots.size() < hcv_dbpool_size)
+          {
+            rep->hcvdbrep_slots.emplace_back(new hcv_dbpool_slot_st{nullptr, {}, 0.0, false, ix, false});
+            slot = rep->hcvdbrep_slots.back().get();
+          }
+      }
+  }
+  if (!slot)
+    return nullptr;
+  try
     {
-      pqxx::work firsttransact(*hcv_dbconn);
-      if (cleardata)
+      hcv_dbpool_check_slot(slot);
+      if (stalelag)
         {
-          // https://dba.stackexchange.com/a/154075/204015
-          firsttransact.exec0(R"cleardatabase(
-DO
-$$
-DECLARE
-  l_stmt text;
-BEGIN
-  SELECT 'truncate ' || string_agg(format('%I.%I', schemaname, tablename), ',')
-    INTO l_stmt
-  FROM pg_tables
-  WHERE schemaname IN ('public');
-  EXECUTE l_stmt;
-END;
-$$
-)cleardatabase");	  
-          HCV_SYSLOGOUT(LOG_NOTICE, "hcv_initialize_database cleared database");
+          pqxx::nontransaction lagtransact(*slot->hcvdbslot_conn);
+          double lag = lagtransact.exec(hcv_dbreplica_lag_sql)[0][0].as<double>();
+          std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+          rep->hcvdbrep_lag = lag;
+          rep->hcvdbrep_lagtime = hcv_monotonic_real_time();
+        }
+      std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+      if (rep->hcvdbrep_lag < maxlag)
+        return slot;
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbreplica_lease: unusable PostGreSQL replica "
+                    << rep->hcvdbrep_connstr << ": " << exc.what());
+      slot->hcvdbslot_broken = true;
+      std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+      rep->hcvdbrep_downuntil = nowt + HCV_DBREPLICA_RETRY_DELAY;
+    }
+  hcv_dbpool_release_slot(slot);
+  return nullptr;
+} // end hcv_dbreplica_lease
+
+
+/// on a freshly leased and checked slot, for a request with a
+/// deadline, set once a session statement_timeout to its remaining
+/// time, so Hcv_statement_deadline_guard does not need a SET LOCAL
+/// before every statement; otherwise reset what an earlier lease set.
+/// In pooler mode no session setting should outlive a transaction,
+/// so the guard keeps doing its SET LOCAL.
+static void
+hcv_dbpool_set_slot_timeout(hcv_dbpool_slot_st*slot)
+{
+  if (hcv_dbpooler_mode.load(std::memory_order_relaxed))
+    return;
+  if (hcv_request_deadline_time > 0.0)
+    {
+      hcv_check_request_deadline("Hcv_database_connection");
+      long timeoutms = 1 + (long) (1000.0 * hcv_request_remaining_time());
+      pqxx::nontransaction settransact(*slot->hcvdbslot_conn);
+      settransact.exec0("SET statement_timeout = " + std::to_string(timeoutms));
+      slot->hcvdbslot_timeout = true;
+      hcv_dbtimeout_conn = slot->hcvdbslot_conn.get();
+    }
+  else if (slot->hcvdbslot_timeout)
+    {
+      pqxx::nontransaction settransact(*slot->hcvdbslot_conn);
+      settransact.exec0("RESET statement_timeout");
+      slot->hcvdbslot_timeout = false;
+    }
+} // end hcv_dbpool_set_slot_timeout
+
+
+Hcv_database_connection::Hcv_database_connection(double timeout)
+  : Hcv_database_connection(HCV_SQL_WRITE, timeout)
+{
+} // end Hcv_database_connection::Hcv_database_connection
+
+
+Hcv_database_connection::Hcv_database_connection(hcv_sql_access_en access, double timeout)
+  : _hcvdbc_slot(nullptr), _hcvdbc_access(access), _hcvdbc_leasewait(0.0)
+{
+  double starttime = hcv_monotonic_real_time();
+  if (access == HCV_SQL_READ)
+    {
+      _hcvdbc_slot = hcv_dbreplica_lease();
+      if (_hcvdbc_slot)
+        {
+          try
+            {
+              hcv_dbpool_set_slot_timeout(_hcvdbc_slot);
+            }
+          catch (...)
+            {
+              _hcvdbc_slot->hcvdbslot_broken = true;
+              hcv_dbpool_release_slot(_hcvdbc_slot);
+              _hcvdbc_slot = nullptr;
+              throw;
+            }
+          hcv_dbreplica_reads++;
+          _hcvdbc_leasewait = hcv_monotonic_real_time() - starttime;
+          return;
         }
-      ///================ add something into PostGreSQL log
+      hcv_dbreplica_primaryreads++;
+    }
+  if (timeout < 0.0)
+    timeout = hcv_dbpool_checkout_timeout;
+  if (timeout > hcv_request_remaining_time())
+    {
+      hcv_check_request_deadline("Hcv_database_connection");
+      timeout = hcv_request_remaining_time();
+    }
+  auto deadline = std::chrono::steady_clock::now()
+                  + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+                  (std::chrono::duration<double>(timeout));
+  hcv_dbpool_slot_st*slot = nullptr;
+  {
+    std::unique_lock<std::mutex> gu(hcv_dbpool_mtx);
+    if (hcv_dbpool_connstr.empty())
+      throw std::runtime_error("no PostGreSQL database");
+    bool waited = false;
+    while (hcv_dbpool_idle.empty() && hcv_dbpool_slots.size() >= hcv_dbpool_size)
       {
-        /// see https://stackoverflow.com/a/60954480/841108
-        char logreqbuf[256];
-        memset (logreqbuf, 0, sizeof(logreqbuf));
-        char gitbuf[24];
-        memset (gitbuf, 0, sizeof(gitbuf));
-        strncpy(gitbuf, hcv_gitid, sizeof(gitbuf)-5);
-        if (strchr(hcv_gitid, '+'))
-          strcat(gitbuf, "+");
-        snprintf (logreqbuf, sizeof(logreqbuf),
-                  "starting HelpCovid git %.22s (built %.80s, md5 %.20s...) %s on %.64s pid %d",
-                  gitbuf, hcv_timestamp, hcv_md5sum,
-		  (cleardata?"cleared":"initialized"),
-		  hcv_get_hostname(), (int)getpid());
-        if (strchr(logreqbuf, '\'') || strchr(logreqbuf, ';') || strchr(logreqbuf, '\\'))
-          HCV_FATALOUT("hcv_initialize_database invalid logreqbuf:" << logreqbuf);
-        static char fullreqbuf[300];
-        snprintf(fullreqbuf, sizeof (fullreqbuf),
-                 "DO $$BEGIN RAISE LOG '%s'; END;$$;", logreqbuf);
-        HCV_DEBUGOUT("hcv_initialize_database: fullreqbuf=" << fullreqbuf);
-        firsttransact.exec0(fullreqbuf);
+        if (!waited)
+          hcv_dbpool_waits++;
+        waited = true;
+        if (hcv_dbpool_changed.wait_until(gu, deadline) == std::cv_status::timeout
+            && hcv_dbpool_idle.empty())
+          {
+            hcv_dbpool_timeouts++;
+            throw std::runtime_error("timeout waiting for a PostGreSQL connection");
+          }
+      }
+    if (!hcv_dbpool_idle.empty())
+      {
+        slot = hcv_dbpool_idle.back();
+        hcv_dbpool_idle.pop_back();
+      }
+    else
+      {
+        hcv_dbpool_slots.emplace_back(new hcv_dbpool_slot_st{nullptr, {}, 0.0, false, -1, false});
+        slot = hcv_dbpool_slots.back().get();
+        HCV_DEBUGOUT("Hcv_database_connection: new pool slot #" << hcv_dbpool_slots.size());
       }
-      ////================ query the PostGreSQL version
-      pqxx::row rversion = firsttransact.exec1("SELECT VERSION();");
-      std::string pqversion = rversion[0].as<std::string>();
-      pqxx::row r2version = firsttransact.exec1("SHOW SERVER_VERSION;");
-      hcv_our_postgresql_server_version = r2version[0].as<std::string>();
-      HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database got PostGreSQL version " << pqversion
-                    << "(server version " << hcv_our_postgresql_server_version << ")");
-      firsttransact.commit();
-    }
-    ////================ create tables if they are missing
-    pqxx::work transact(*hcv_dbconn);
-    ////================ user table and indexes, with mandatory data
-    transact.exec0(R"crusertab(
----- TABLE tb_user
-CREATE TABLE IF NOT EXISTS tb_user (
-  user_id SERIAL PRIMARY KEY NOT NULL,  -- unique user_id
-  user_firstname VARCHAR(31) NOT NULL,  -- first name, in capitals, UTF8
-  user_familyname VARCHAR(62) NOT NULL, -- family name, in capitals, UTF8
-  user_email VARCHAR(71) NOT NULL,      -- email, in lowercase, UTF8
-  user_telephone VARCHAR(23) NOT NULL,  -- telephone number (digits, +, - or space)
-  user_gender CHAR(1) NOT NULL,         -- 'F' | 'M' | '?'
-  user_crtime TIMESTAMP DEFAULT current_timestamp -- user entry creation time
-); --- end TABLE tb_user
-)crusertab");
-    transact.exec0(R"cruserfamix(
----- INDEX ix_user_familyname
-  CREATE INDEX IF NOT EXISTS ix_user_familyname 
-    ON tb_user(user_familyname);
---- end INDEX ix_user_familyname
-)cruserfamix");
-    transact.exec0(R"cruseremailix(
----- INDEX ix_user_email
-  CREATE INDEX IF NOT EXISTS ix_user_email 
-    ON tb_user(user_email);
---- end INDEX ix_user_email
-)cruseremailix");
-    transact.exec0(R"crusertimeix(
----- INDEX ix_user_crtime 
-  CREATE INDEX IF NOT EXISTS ix_user_crtime 
-    ON tb_user(user_crtime);
---- end INDEX ix_user_crtime
-)crusertimeix");
-    ////================ password table
-    transact.exec0(R"crpasswdtab(
----- TABLE tb_password
-CREATE TABLE IF NOT EXISTS tb_password (
-  passw_id SERIAL PRIMARY KEY NOT NULL, -- unique key in this table
-  passw_userid INT NOT NULL,            -- the user id whose password we store
-  passw_encr VARCHAR(62) NOT NULL,      -- the encrypted password
-  passw_mtime  TIMESTAMP DEFAULT current_timestamp  -- the last time that password was modified
-); --- end TABLE tb_password
-)crpasswdtab");
-    ////================ web cookie table, related to web cookies
-    // see https://www.postgresql.org/docs/current/datatype-net-types.html
-    // read https://en.wikipedia.org/wiki/List_of_HTTP_header_fields
-    // see http://man7.org/linux/man-pages/man2/getsockname.2.html
-    // see http://man7.org/linux/man-pages/man7/ip.7.html
-    // and http://man7.org/linux/man-pages/man7/ipv6.7.html
-    /// we are aware that the browser IP is unreliable information
-    /// see https://stackoverflow.com/q/527638/841108
-    transact.exec0(R"crwebcookietab(
----- TABLE tb_web_cookie
-CREATE TABLE IF NOT EXISTS tb_web_cookie (
-  wcookie_id SERIAL PRIMARY  KEY NOT NULL, -- unique key in this table
-  wcookie_random CHAR(24) NOT NULL,        -- a random key, hopefully usually unique
-  wcookie_exptime TIMESTAMP NOT NULL,      -- the cookie expiration time
-  wcookie_webagenthash INT NOT NULL        -- a quick hashcode of the browser's User-Agent:
-); --- end TABLE tb_web_cookie
-)crwebcookietab");
-    transact.exec0(R"crcookierandomix(
----- INDEX ix_cookie_random
-  CREATE INDEX IF NOT EXISTS ix_cookie_random
-    ON tb_web_cookie(wcookie_random);
---- end INDEX ix_cookie_random
-)crcookierandomix");
-    transact.exec0(R"crcookietimeix(
----- INDEX ix_cookie_exptime
-  CREATE INDEX IF NOT EXISTS ix_cookie_exptime
-    ON tb_web_cookie(wcookie_exptime);
---- end INDEX ix_cookie_exptime
-)crcookietimeix");
-    transact.commit();
   }
-  HCV_DEBUGOUT("hcv_initialize_database before preparing statements in " << connstr);
-  hcv_prepare_statements_in_database();
-  hcv_initialize_plugins_for_database(hcv_dbconn.get());
-  HCV_SYSLOGOUT(LOG_NOTICE, "PostGreSQL database " << connstr << " successfully initialized");
-} // end hcv_initialize_database
+  try
+    {
+      hcv_dbpool_check_slot(slot);
+      hcv_dbpool_set_slot_timeout(slot);
+    }
+  catch (...)
+    {
+      slot->hcvdbslot_broken = true;
+      hcv_dbpool_release_slot(slot);
+      throw;
+    }
+  _hcvdbc_slot = slot;
+  _hcvdbc_leasewait = hcv_monotonic_real_time() - starttime;
+} // end Hcv_database_connection::Hcv_database_connection
 
 
-static void
-prepare_user_model_statements(void)
+Hcv_database_connection::~Hcv_database_connection()
 {
-  // user_crtime is updated by default
-  hcv_database_register_prepared_statement
-    ("user_create_pstm",
-     "INSERT INTO tb_user (user_firstname, user_familyname, user_email, user_gender "
-     " VALUES ($1, $2, $3, $4);");
+  if (!_hcvdbc_slot)
+    return;
+  if (!_hcvdbc_slot->hcvdbslot_conn->is_open())
+    _hcvdbc_slot->hcvdbslot_broken = true;
+  _hcvdbc_slot->hcvdbslot_lastcheck = hcv_monotonic_real_time();
+  if (_hcvdbc_access == HCV_SQL_WRITE && hcv_dbsession_key != 0)
+    hcv_dbsession_wrote(hcv_dbsession_key);
+  if (hcv_dbtimeout_conn == _hcvdbc_slot->hcvdbslot_conn.get())
+    hcv_dbtimeout_conn = nullptr;
+  hcv_dbpool_release_slot(_hcvdbc_slot);
+  _hcvdbc_slot = nullptr;
+} // end Hcv_database_connection::~Hcv_database_connection
 
-  hcv_database_register_prepared_statement("user_get_password_by_email_pstm",
-      "SELECT passwd_encr FROM tb_password WHERE passw_userid = "
-      "(SELECT user_id WHERE user_email = $1) ORDER BY passw_mtime DESC"
-      " LIMIT 1;");
-} // end prepare_user_model_statements
+
+pqxx::connection&
+Hcv_database_connection::conn() const
+{
+  HCV_ASSERT(_hcvdbc_slot != nullptr && _hcvdbc_slot->hcvdbslot_conn);
+  return *_hcvdbc_slot->hcvdbslot_conn;
+} // end Hcv_database_connection::conn
 
 
-/// https://libpqxx.readthedocs.io/en/stable/a01331.html
-/// https://www.tutorialspoint.com/postgresql/postgresql_c_cpp.htm
 void
-hcv_prepare_statements_in_database(void)
+Hcv_database_connection::prepare(const std::string& name)
 {
-  std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
-  ////// find a user by his/her email
-  HCV_DEBUGOUT("preparing find_user_by_email_pstm");
-  hcv_dbconn->prepare
-    ("find_user_by_email_pstm",
-     R"finduseremail(
-SELECT user_id FROM tb_user WHERE user_email=$1
-)finduseremail");
-  ///// insert a fresh web cookie; see also for LASTVAL
-  ///// https://www.postgresql.org/docs/current/functions-sequence.html
-  hcv_dbconn->prepare
-    ("add_web_cookie_pstm",
-     R"addwebcookie(
-INSERT INTO tb_web_cookie
-     (wcookie_random, wcookie_exptime, wcookie_webagenthash)
-VALUES ($1, to_timestamp($2), $3)
-)addwebcookie");
-  hcv_dbconn->prepare
-    ("lastval_pstm", "SELECT LASTVAL()");
-  prepare_user_model_statements();
-} // end hcv_prepare_statements_in_database
+  HCV_ASSERT(_hcvdbc_slot != nullptr && _hcvdbc_slot->hcvdbslot_conn);
+  if (hcv_dbpooler_mode.load(std::memory_order_relaxed))
+    return;
+  if (_hcvdbc_slot->hcvdbslot_prepared.find(name) != _hcvdbc_slot->hcvdbslot_prepared.end())
+    return;
+  std::string sql;
+  {
+    std::shared_lock<std::shared_mutex> gu(hcv_dbstatements_mtx);
+    auto stit = hcv_dbstatements_dict.find(name);
+    if (stit == hcv_dbstatements_dict.end())
+      throw std::runtime_error("unregistered prepared statement " + name);
+    sql = stit->second;
+  }
+  _hcvdbc_slot->hcvdbslot_conn->prepare(name, sql);
+  _hcvdbc_slot->hcvdbslot_prepared.insert(name);
+} // end Hcv_database_connection::prepare
+
 
+void
+Hcv_database_connection::mark_broken()
+{
+  if (_hcvdbc_slot)
+    _hcvdbc_slot->hcvdbslot_broken = true;
+} // end Hcv_database_connection::mark_broken
 
 
+bool
+Hcv_database_connection::on_replica() const
+{
+  return _hcvdbc_slot && _hcvdbc_slot->hcvdbslot_replica >= 0;
+} // end Hcv_database_connection::on_replica
+
 
 void
-hcv_database_register_prepared_statement(const std::string& name, 
-                                         const std::string& sql)
+hcv_database_pool_statistics(long*pnbconnections, long*pnbidle,
+                             long*pnbwaits, long*pnbtimeouts, long*pnbreconnects)
 {
-    HCV_DEBUGOUT("Registering prepared SQL statement " << name);
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    if (pnbconnections)
+      *pnbconnections = (long) hcv_dbpool_slots.size();
+    if (pnbidle)
+      *pnbidle = (long) hcv_dbpool_idle.size();
+  }
+  if (pnbwaits)
+    *pnbwaits = hcv_dbpool_waits.load();
+  if (pnbtimeouts)
+    *pnbtimeouts = hcv_dbpool_timeouts.load();
+  if (pnbreconnects)
+    *pnbreconnects = hcv_dbpool_reconnects.load();
+} // end hcv_database_pool_statistics
 
-    std::lock_guard<std::recursive_mutex> guard(hcv_dbmtx);
-    hcv_dbconn->prepare(name, sql);
-} // end hcv_database_register_prepared_statement
 
+void
+hcv_database_replica_statistics(long*pnbreplicas, long*pnbreplicareads,
+                                long*pnbprimaryreads, double*pmaxlag)
+{
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    if (pnbreplicas)
+      *pnbreplicas = (long) hcv_dbreplicas.size();
+    if (pmaxlag)
+      {
+        *pmaxlag = 0.0;
+        for (auto& rep: hcv_dbreplicas)
+          if (rep->hcvdbrep_lag > *pmaxlag)
+            *pmaxlag = rep->hcvdbrep_lag;
+      }
+  }
+  if (pnbreplicareads)
+    *pnbreplicareads = hcv_dbreplica_reads.load();
+  if (pnbprimaryreads)
+    *pnbprimaryreads = hcv_dbreplica_primaryreads.load();
+} // end hcv_database_replica_statistics
 
 
 
+////////////////////////////////////////////////////////////////
+static void
+hcv_dbhistogram_add(hcv_dbhistogram_st& histo, long val)
+{
+  if (val < 0)
+    val = 0;
+  int ix = (int) val;
+  if (val >= HCV_DBHISTO_SUBBUCKETS)
+    {
+      int topbit = 63 - __builtin_clzl((unsigned long) val);
+      if (topbit >= HCV_DBHISTO_MAXBITS)
+        ix = HCV_DBHISTO_NBBUCKETS-1;
+      else
+        ix = (topbit-2)*HCV_DBHISTO_SUBBUCKETS
+             + (int) ((val >> (topbit-3)) - HCV_DBHISTO_SUBBUCKETS);
+    }
+  histo.hcvdbh_buckets[ix].fetch_add(1, std::memory_order_relaxed);
+  histo.hcvdbh_count.fetch_add(1, std::memory_order_relaxed);
+  long oldmax = histo.hcvdbh_max.load(std::memory_order_relaxed);
+  while (val > oldmax
+         && !histo.hcvdbh_max.compare_exchange_weak(oldmax, val, std::memory_order_relaxed))
+    continue;
+} // end hcv_dbhistogram_add
 
 
-// https://www.postgresqltutorial.com/postgresql-where/
-// https://www.postgresql.org/docs/current/sql-prepare.html
-bool
-hcv_database_with_known_email (const std::string& emailstr)
+/// the middle of the bucket of the given quantile, e.g. 0.99
+static long
+hcv_dbhistogram_quantile(const hcv_dbhistogram_st& histo, double quantile)
 {
-  HCV_DEBUGOUT("hcv_database_with_known_email: emailstr='" << emailstr << "'");
-  if (emailstr.empty() || emailstr.find('@') == std::string::npos)
+  long count = histo.hcvdbh_count.load(std::memory_order_relaxed);
+  if (count == 0)
+    return 0;
+  long rank = (long) ceil(quantile * count);
+  long seen = 0;
+  for (int ix = 0; ix < HCV_DBHISTO_NBBUCKETS; ix++)
     {
-      HCV_DEBUGOUT("hcv_database_with_known_email bad email" << emailstr);
-      return false;
+      seen += histo.hcvdbh_buckets[ix].load(std::memory_order_relaxed);
+      if (seen < rank)
+        continue;
+      if (ix == HCV_DBHISTO_NBBUCKETS-1)
+        break;
+      if (ix < HCV_DBHISTO_SUBBUCKETS)
+        return ix;
+      int shift = ix/HCV_DBHISTO_SUBBUCKETS - 1;
+      long low = (long) (HCV_DBHISTO_SUBBUCKETS + ix%HCV_DBHISTO_SUBBUCKETS) << shift;
+      return low + ((1L << shift) >> 1);
     }
-  std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
-  pqxx::work transact(*hcv_dbconn);
-  pqxx::result res = transact.exec_prepared("find_user_by_email_pstm", emailstr);
-  long id = -1;
-  for (auto rowit : res) {
-    id = rowit[0].as<long>();
-  }
-  transact.commit();
-  return id>0;
-} // end hcv_database_with_known_email
+  return histo.hcvdbh_max.load(std::memory_order_relaxed);
+} // end hcv_dbhistogram_quantile
 
-long
-hcv_database_get_id_of_added_web_cookie(const std::string& randomstr, time_t exptime, int webagenthash)
+
+static Json::Value
+hcv_dbhistogram_json(const hcv_dbhistogram_st& histo)
 {
-  long id = -1;
-  HCV_ASSERT(!randomstr.empty());
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie start randomstr='"
-	       << randomstr << " exptime=" << exptime
-	       << " webagenthash=" << webagenthash);
-  std::lock_guard<std::recursive_mutex> gu(hcv_dbmtx);
-  try {
-  pqxx::work transact(*hcv_dbconn);
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie before add_web_cookie_pstm randomstr="
-	       << randomstr);
-  pqxx::result res;
-  res = transact.exec_prepared("add_web_cookie_pstm",
-			       randomstr, (double)exptime, webagenthash);
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie add_web_cookie_pstm res size:"
-	       << res.size() << " affected rows:" << res.affected_rows());
-  res = transact.exec_prepared("lastval_pstm");
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie lastval_pstm res size:"
-	       << res.size());
-  for (auto rowit : res) {
-    id = rowit[0].as<long>();
-  }
-  transact.commit();
-  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie randomstr='"
-	       << randomstr << "', exptime=" << exptime
-	       << ", webagenthash=" << webagenthash
-	       << " => id=" << id);
-  } catch (std::exception& exc) {
-    HCV_SYSLOGOUT(LOG_WARNING,
-		  "hcv_database_get_id_of_added_web_cookie got exception:"
-		  << exc.what());
-    id = -2;
+  Json::Value jsob(Json::objectValue);
+  jsob["p50"] = (Json::Value::Int64) hcv_dbhistogram_quantile(histo, 0.50);
+  jsob["p90"] = (Json::Value::Int64) hcv_dbhistogram_quantile(histo, 0.90);
+  jsob["p99"] = (Json::Value::Int64) hcv_dbhistogram_quantile(histo, 0.99);
+  jsob["max"] = (Json::Value::Int64) histo.hcvdbh_max.load(std::memory_order_relaxed);
+  return jsob;
+} // end hcv_dbhistogram_json
+
+
+hcv_dbstmt_stats_st*
+hcv_database_statement_stats(const std::string& name)
+{
+  {
+    std::shared_lock<std::shared_mutex> gu(hcv_dbstatements_mtx);
+    auto stit = hcv_dbstmt_stats_dict.find(name);
+    if (stit != hcv_dbstmt_stats_dict.end())
+      return stit->second.get();
   }
-  return id;
-} // end hcv_database_get_id_of_added_web_cookie
+  std::unique_lock<std::shared_mutex> gu(hcv_dbstatements_mtx);
+  auto& stats = hcv_dbstmt_stats_dict[name];
+  if (!stats)
+    {
+      stats.reset(new hcv_dbstmt_stats_st());
+      stats->hcvdbst_name = name;
+    }
+  return stats.get();
+} // end hcv_database_statement_stats
+
+
+void
+hcv_database_record_statement_wait(hcv_dbstmt_stats_st* stats, double waittime)
+{
+  hcv_dbhistogram_add(stats->hcvdbst_wait, (long) (waittime*1.0e6));
+} // end hcv_database_record_statement_wait
+
+
+bool
+hcv_database_record_statement(hcv_dbstmt_stats_st* stats, double exectime, long nbrows)
+{
+  hcv_dbhistogram_add(stats->hcvdbst_exec, (long) (exectime*1.0e6));
+  hcv_dbhistogram_add(stats->hcvdbst_rows, nbrows);
+  double threshold = hcv_dbstmt_slow_threshold.load();
+  if (threshold <= 0.0 || exectime*1000.0 < threshold)
+    return false;
+  stats->hcvdbst_nbslow++;
+  return true;
+} // end hcv_database_record_statement
+
+
+/// parameters may be emails or passwords, so only their size is logged
+void
+hcv_database_log_slow_statement(hcv_dbstmt_stats_st* stats, double exectime, long nbrows,
+                                const std::vector<std::string>& params)
+{
+  std::ostringstream outs;
+  for (int pix = 0; pix < (int)params.size(); pix++)
+    outs << (pix?", $":"$") << (pix+1) << ":" << params[pix].size() << " bytes";
+  HCV_SYSLOGOUT(LOG_WARNING, "slow statement " << stats->hcvdbst_name
+                << " took " << (long) (exectime*1000.0) << " ms for " << nbrows << " rows"
+                << (params.empty()?"":", parameters ") << outs.str());
+} // end hcv_database_log_slow_statement
+
+
+void
+hcv_database_statement_statistics(Json::Value& jsob)
+{
+  std::shared_lock<std::shared_mutex> gu(hcv_dbstatements_mtx);
+  for (auto& stit: hcv_dbstmt_stats_dict)
+    {
+      const hcv_dbstmt_stats_st& stats = *stit.second;
+      Json::Value jstat(Json::objectValue);
+      jstat["calls"] = (Json::Value::Int64) stats.hcvdbst_exec.hcvdbh_count.load();
+      jstat["slow"] = (Json::Value::Int64) stats.hcvdbst_nbslow.load();
+      jstat["wait_us"] = hcv_dbhistogram_json(stats.hcvdbst_wait);
+      jstat["exec_us"] = hcv_dbhistogram_json(stats.hcvdbst_exec);
+      jstat["rows"] = hcv_dbhistogram_json(stats.hcvdbst_rows);
+      jsob[stit.first] = jstat;
+    }
+} // end hcv_database_statement_statistics
+
+
+
+////////////////////////////////////////////////////////////////
+/// the connection string of the server of some pooled connection, or
+/// of the primary for other connections
+static std::string
+hcv_dbwatch_server_connstr(const pqxx::connection_base* conn)
+{
+  std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+  for (auto& rep: hcv_dbreplicas)
+    for (auto& slot: rep->hcvdbrep_slots)
+      if (slot->hcvdbslot_conn.get() == conn)
+        return rep->hcvdbrep_connstr;
+  return hcv_dbpool_connstr;
+} // end hcv_dbwatch_server_connstr
+
+
+static void
+hcv_dbwatch_thread_body(void)
+{
+  char thnambuf[16];
+  memset (&thnambuf, 0, sizeof(thnambuf));
+  snprintf(thnambuf, sizeof(thnambuf), "hcovwdog%ld", (long)getpid());
+  pthread_setname_np(pthread_self(), thnambuf);
+  /// our own connections, by server connection string
+  std::map<std::string,std::unique_ptr<pqxx::connection>> cancelconns;
+  std::unique_lock<std::mutex> gu(hcv_dbwatch_mtx);
+  for (;;)
+    {
+      if (hcv_dbwatch_dict.empty())
+        {
+          hcv_dbwatch_changed.wait(gu);
+          continue;
+        }
+      double nowt = hcv_monotonic_real_time();
+      auto it = hcv_dbwatch_dict.begin();
+      if (it->first > nowt)
+        {
+          hcv_dbwatch_changed.wait_for(gu, std::chrono::duration<double>(it->first - nowt));
+          continue;
+        }
+      /// the statement guard waits for the cancellation before its
+      /// connection gets reused, but other statements should not
+      /// wait for it, so it is done without our lock
+      hcv_dbwatch_st* watch = it->second;
+      hcv_dbwatch_dict.erase(it);
+      hcv_dbwatch_cancelling = watch;
+      gu.unlock();
+      std::string connstr = hcv_dbwatch_server_connstr(watch->hcvdbw_conn);
+      try
+        {
+          auto& cancelconn = cancelconns[connstr];
+          if (!cancelconn || !cancelconn->is_open())
+            cancelconn.reset(new pqxx::connection(connstr));
+          pqxx::nontransaction canceltransact(*cancelconn);
+          canceltransact.exec_params("SELECT pg_cancel_backend($1)", watch->hcvdbw_backendpid);
+          hcv_dbwatch_cancelled++;
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbwatch_thread_body cancelled statement "
+                        << watch->hcvdbw_stmtname << " of backend " << watch->hcvdbw_backendpid
+                        << " past its request deadline");
+        }
+      catch (std::exception& exc)
+        {
+          cancelconns.erase(connstr);
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbwatch_thread_body failed to cancel "
+                        << watch->hcvdbw_stmtname << ": " << exc.what());
+        }
+      gu.lock();
+      hcv_dbwatch_cancelling = nullptr;
+      hcv_dbwatch_cancelled_cond.notify_all();
+    }
+} // end hcv_dbwatch_thread_body
+
+
+Hcv_statement_deadline_guard::Hcv_statement_deadline_guard(pqxx::transaction_base& transact,
+    const char*stmtname)
+  : _hcvsdg_watch(nullptr)
+{
+  if (hcv_request_deadline_time <= 0.0)
+    return;
+  hcv_check_request_deadline(stmtname);
+  /// the statement_timeout is a bound on the server side, in case we
+  /// would fail to cancel in time; usually set once when leasing
+  if (&transact.conn() != hcv_dbtimeout_conn)
+    {
+      long timeoutms = 1 + (long) (1000.0 * hcv_request_remaining_time());
+      transact.exec0("SET LOCAL statement_timeout = " + std::to_string(timeoutms));
+    }
+  /// thru a pooler, the backend pid is not that of the server process
+  /// running our statement, so only the statement_timeout applies
+  if (hcv_dbpooler_mode.load(std::memory_order_relaxed))
+    return;
+  static std::once_flag startonce;
+  std::call_once(startonce, []()
+  {
+    std::thread(hcv_dbwatch_thread_body).detach();
+  });
+  _hcvsdg_watch = new hcv_dbwatch_st {&transact.conn(), transact.conn().backendpid(),
+                                      stmtname, hcv_request_deadline_time};
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbwatch_mtx);
+    hcv_dbwatch_dict.insert({hcv_request_deadline_time, _hcvsdg_watch});
+  }
+  hcv_dbwatch_changed.notify_one();
+} // end Hcv_statement_deadline_guard::Hcv_statement_deadline_guard
+
+
+Hcv_statement_deadline_guard::~Hcv_statement_deadline_guard()
+{
+  if (!_hcvsdg_watch)
+    return;
+  {
+    std::unique_lock<std::mutex> gu(hcv_dbwatch_mtx);
+    hcv_dbwatch_cancelled_cond.wait(gu, [this]()
+    {
+      return hcv_dbwatch_cancelling != _hcvsdg_watch;
+    });
+    auto range = hcv_dbwatch_dict.equal_range(_hcvsdg_watch->hcvdbw_deadline);
+    for (auto it = range.first; it != range.second; it++)
+      if (it->second == _hcvsdg_watch)
+        {
+          hcv_dbwatch_dict.erase(it);
+          break;
+        }
+  }
+  delete _hcvsdg_watch;
+  _hcvsdg_watch = nullptr;
+} // end Hcv_statement_deadline_guard::~Hcv_statement_deadline_guard
+
+
+void
+hcv_database_deadline_statistics(long*pnbcancelled)
+{
+  if (pnbcancelled)
+    *pnbcancelled = hcv_dbwatch_cancelled.load();
+} // end hcv_database_deadline_statistics
+
+
+
+////////////////////////////////////////////////////////////////
+const std::string
+hcv_postgresql_version(void)
+{
+  return hcv_our_postgresql_server_version;
+} // end  hcv_postgresql_version
+
+
+
+////////////////////////////////////////////////////////////////
+//// schema migrations. Every owner ("helpcovid" or a plugin name) has
+//// its numbered steps, applied once in increasing order, each
+//// recorded in tb_schema_version. At startup, that table is read in
+//// the same round trip as the PostGreSQL version, so a current schema
+//// costs nothing more. Otherwise the steps are applied under an
+//// advisory lock, so concurrent helpcovid processes apply them once.
+//// In pooler mode a session lock would not stay on one server
+//// connection, so that lock is taken by a transaction kept open on a
+//// dedicated connection during the whole migration.
+struct hcv_dbmigration_st
+{
+  std::string hcvdbmig_name;
+  std::string hcvdbmig_sql;
+  std::string hcvdbmig_index;	// for CREATE INDEX CONCURRENTLY
+};
+
+#define HCV_DBMIGRATION_OWNER "helpcovid"
+#define HCV_DBMIGRATION_LOCK_KEY 0x4843564dL /* "HCVM" */
+static std::mutex hcv_dbmigration_mtx;
+/// by owner and step
+static std::map<std::pair<std::string,int>,hcv_dbmigration_st> hcv_dbmigration_dict;
+/// the last applied step of every owner
+static std::map<std::string,int> hcv_dbschema_versions;
+
+
+void
+hcv_database_register_migration(const std::string& owner, int step,
+                                const std::string& name, const std::string& sql,
+                                const std::string& concurrentindex)
+{
+  if (owner.empty() || owner.size() > 64 || step <= 0)
+    HCV_FATALOUT("hcv_database_register_migration: bad owner " << owner << " or step " << step);
+  std::lock_guard<std::mutex> gu(hcv_dbmigration_mtx);
+  auto& mig = hcv_dbmigration_dict[{owner, step}];
+  if (!mig.hcvdbmig_sql.empty())
+    HCV_FATALOUT("hcv_database_register_migration: duplicate step " << step << " of " << owner);
+  mig = hcv_dbmigration_st{name, sql, concurrentindex};
+} // end hcv_database_register_migration
+
+
+/// build the index of some step by CREATE INDEX CONCURRENTLY, under
+/// the migration lock. That is outside of any transaction, not to lock
+/// the table for writes. A failed build, maybe by an earlier crash or
+/// by duplicates for a unique index, leaves an invalid index, which is
+/// dropped, before building and after a failure; throws if the built
+/// index is not valid, so that step is not recorded.
+static void
+hcv_database_migrate_concurrent_index(Hcv_database_connection& dbconn,
+                                      const hcv_dbmigration_st& mig)
+{
+  pqxx::nontransaction concurtransact(dbconn.conn());
+  auto indexvalid = [&](bool& exists)
+  {
+    pqxx::result res = concurtransact.exec_params
+                       ("SELECT indisvalid FROM pg_index WHERE indexrelid = to_regclass($1)",
+                        mig.hcvdbmig_index);
+    exists = !res.empty();
+    return exists && res[0][0].as<bool>();
+  };
+  std::string dropsql = "DROP INDEX CONCURRENTLY IF EXISTS "
+                        + concurtransact.quote_name(mig.hcvdbmig_index);
+  bool exists = false;
+  if (!indexvalid(exists) && exists)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_migrate dropping invalid index " << mig.hcvdbmig_index);
+      concurtransact.exec0(dropsql);
+    }
+  try
+    {
+      concurtransact.exec0(mig.hcvdbmig_sql);
+      if (!indexvalid(exists))
+        throw std::runtime_error("index " + mig.hcvdbmig_index + " is not valid after its build");
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_migrate failed to build index " << mig.hcvdbmig_index
+                    << ": " << exc.what());
+      /// a nontransaction stays usable after an error
+      concurtransact.exec0(dropsql);
+      throw;
+    }
+  concurtransact.commit();
+} // end hcv_database_migrate_concurrent_index
+
+
+/// apply the steps registered but not yet applied
+static void
+hcv_database_migrate(Hcv_database_connection& dbconn)
+{
+  std::lock_guard<std::mutex> gu(hcv_dbmigration_mtx);
+  auto pending = [&](const std::pair<std::string,int>& key)
+  {
+    auto vit = hcv_dbschema_versions.find(key.first);
+    return vit == hcv_dbschema_versions.end() || key.second > vit->second;
+  };
+  if (std::none_of(hcv_dbmigration_dict.begin(), hcv_dbmigration_dict.end(),
+                   [&](const auto& migit)
+  {
+    return pending(migit.first);
+  }))
+  return;
+  int nbapplied = 0;
+  bool pooler = hcv_dbpooler_mode.load();
+  std::string lockkeystr = std::to_string(HCV_DBMIGRATION_LOCK_KEY);
+  std::unique_ptr<pqxx::connection> poolerlockconn;
+  std::unique_ptr<pqxx::work> poolerlocktransact;
+  try
+    {
+      if (pooler)
+        {
+          /// that idle transaction has no snapshot, so does not delay
+          /// CREATE INDEX CONCURRENTLY
+          poolerlockconn.reset(new pqxx::connection(hcv_dbpool_connstr));
+          poolerlocktransact.reset(new pqxx::work(*poolerlockconn));
+          poolerlocktransact->exec("SELECT pg_advisory_xact_lock(" + lockkeystr + ")");
+        }
+      {
+        pqxx::nontransaction locktransact(dbconn.conn());
+        if (!pooler)
+          locktransact.exec("SELECT pg_advisory_lock(" + lockkeystr + ")");
+        /// another process might have migrated meanwhile
+        pqxx::result verres = locktransact.exec(R"schemaversions(
+SELECT schemav_owner, MAX(schemav_step) FROM tb_schema_version GROUP BY schemav_owner
+)schemaversions");
+        for (auto row: verres)
+          hcv_dbschema_versions[row[0].as<std::string>()] = row[1].as<int>();
+      }
+      for (auto& migit: hcv_dbmigration_dict)
+        {
+          if (!pending(migit.first))
+            continue;
+          const std::string& owner = migit.first.first;
+          int step = migit.first.second;
+          const hcv_dbmigration_st& mig = migit.second;
+          double starttime = hcv_monotonic_real_time();
+          if (!mig.hcvdbmig_index.empty())
+            hcv_database_migrate_concurrent_index(dbconn, mig);
+          pqxx::work migtransact(dbconn.conn());
+          if (mig.hcvdbmig_index.empty())
+            migtransact.exec0(mig.hcvdbmig_sql);
+          migtransact.exec_params(R"insschemav(
+INSERT INTO tb_schema_version (schemav_owner, schemav_step, schemav_name, schemav_gitid)
+VALUES ($1, $2, $3, $4)
+)insschemav", owner, step, mig.hcvdbmig_name, std::string(hcv_gitid));
+          migtransact.commit();
+          hcv_dbschema_versions[owner] = step;
+          nbapplied++;
+          HCV_SYSLOGOUT(LOG_NOTICE, "hcv_database_migrate applied step " << step << " of " << owner
+                        << ": " << mig.hcvdbmig_name << " in "
+                        << (long) (1000.0*(hcv_monotonic_real_time()-starttime)) << " ms");
+        }
+      if (pooler)
+        poolerlocktransact->commit();
+      else
+        {
+          pqxx::nontransaction unlocktransact(dbconn.conn());
+          unlocktransact.exec("SELECT pg_advisory_unlock(" + lockkeystr + ")");
+        }
+    }
+  catch (std::exception& exc)
+    {
+      HCV_FATALOUT("hcv_database_migrate failed after " << nbapplied << " steps: " << exc.what());
+    }
+} // end hcv_database_migrate
+
+
+/// the steps of our own schema. Steps 1 to 10 are idempotent, since
+/// older databases have no tb_schema_version but might have tables.
+/// New steps should be appended, never changed once released.
+static void
+hcv_register_core_migrations(bool partitionedcookies)
+{
+  ////================ user table and indexes, with mandatory data
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 1, "TABLE tb_user",
+                                  R"crusertab(
+---- TABLE tb_user
+CREATE TABLE IF NOT EXISTS tb_user (
+  user_id SERIAL PRIMARY KEY NOT NULL,  -- unique user_id
+  user_firstname VARCHAR(31) NOT NULL,  -- first name, in capitals, UTF8
+  user_familyname VARCHAR(62) NOT NULL, -- family name, in capitals, UTF8
+  user_email VARCHAR(71) NOT NULL,      -- email, in lowercase, UTF8
+  user_telephone VARCHAR(23) NOT NULL,  -- telephone number (digits, +, - or space)
+  user_gender CHAR(1) NOT NULL,         -- 'F' | 'M' | '?'
+  user_crtime TIMESTAMP DEFAULT current_timestamp -- user entry creation time
+); --- end TABLE tb_user
+)crusertab");
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 2, "INDEX ix_user_familyname",
+                                  R"cruserfamix(
+---- INDEX ix_user_familyname
+  CREATE INDEX CONCURRENTLY IF NOT EXISTS ix_user_familyname 
+    ON tb_user(user_familyname);
+--- end INDEX ix_user_familyname
+)cruserfamix",
+                                  "ix_user_familyname");
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 3, "INDEX ix_user_email",
+                                  R"cruseremailix(
+---- INDEX ix_user_email
+  CREATE INDEX CONCURRENTLY IF NOT EXISTS ix_user_email 
+    ON tb_user(user_email);
+--- end INDEX ix_user_email
+)cruseremailix",
+                                  "ix_user_email");
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 4, "INDEX ix_user_crtime",
+                                  R"crusertimeix(
+---- INDEX ix_user_crtime 
+  CREATE INDEX CONCURRENTLY IF NOT EXISTS ix_user_crtime 
+    ON tb_user(user_crtime);
+--- end INDEX ix_user_crtime
+)crusertimeix",
+                                  "ix_user_crtime");
+  ////================ password table
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 5, "TABLE tb_password",
+                                  R"crpasswdtab(
+---- TABLE tb_password
+CREATE TABLE IF NOT EXISTS tb_password (
+  passw_id SERIAL PRIMARY KEY NOT NULL, -- unique key in this table
+  passw_userid INT NOT NULL,            -- the user id whose password we store
+  passw_encr VARCHAR(62) NOT NULL,      -- the encrypted password, widened by step 12
+  passw_mtime  TIMESTAMP DEFAULT current_timestamp  -- the last time that password was modified
+); --- end TABLE tb_password
+)crpasswdtab");
+  ////================ web cookie table, related to web cookies
+  // see https://www.postgresql.org/docs/current/datatype-net-types.html
+  // read https://en.wikipedia.org/wiki/List_of_HTTP_header_fields
+  // see http://man7.org/linux/man-pages/man2/getsockname.2.html
+  // see http://man7.org/linux/man-pages/man7/ip.7.html
+  // and http://man7.org/linux/man-pages/man7/ipv6.7.html
+  /// we are aware that the browser IP is unreliable information
+  /// see https://stackoverflow.com/q/527638/841108
+  if (!partitionedcookies)
+    hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 6, "TABLE tb_web_cookie",
+                                    R"crwebcookietab(
+---- TABLE tb_web_cookie
+CREATE TABLE IF NOT EXISTS tb_web_cookie (
+  wcookie_id SERIAL PRIMARY  KEY NOT NULL, -- unique key in this table
+  wcookie_random CHAR(24) NOT NULL,        -- a random key, hopefully usually unique
+  wcookie_exptime TIMESTAMP NOT NULL,      -- the cookie expiration time
+  wcookie_webagenthash INT NOT NULL,       -- a quick hashcode of the browser's User-Agent:
+  wcookie_userid INT                       -- the authenticated user, if any
+); --- end TABLE tb_web_cookie
+)crwebcookietab");
+  else
+    /// partitioned by expiration time, so expired cookies are dropped
+    /// a partition at a time; a partitioned primary key should contain
+    /// the partition key. The default partition should stay empty.
+    hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 6, "partitioned TABLE tb_web_cookie",
+                                    R"crwcparttab(
+---- partitioned TABLE tb_web_cookie
+CREATE TABLE IF NOT EXISTS tb_web_cookie (
+  wcookie_id SERIAL NOT NULL,              -- unique key in this table
+  wcookie_random CHAR(24) NOT NULL,        -- a random key, hopefully usually unique
+  wcookie_exptime TIMESTAMP NOT NULL,      -- the cookie expiration time
+  wcookie_webagenthash INT NOT NULL,       -- a quick hashcode of the browser's User-Agent:
+  wcookie_userid INT,                      -- the authenticated user, if any
+  PRIMARY KEY (wcookie_id, wcookie_exptime)
+) PARTITION BY RANGE (wcookie_exptime); --- end TABLE tb_web_cookie
+
+---- the default partition of tb_web_cookie, which should stay empty
+CREATE TABLE IF NOT EXISTS tb_web_cookie_default
+  PARTITION OF tb_web_cookie DEFAULT;
+)crwcparttab");
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 7, "COLUMN wcookie_userid",
+                                  R"alwebcookieuser(
+---- COLUMN wcookie_userid, for older databases
+ALTER TABLE tb_web_cookie ADD COLUMN IF NOT EXISTS wcookie_userid INT;
+)alwebcookieuser");
+  /// create the upcoming partitions, named like
+  /// tb_web_cookie_p2020041317 for an hour or tb_web_cookie_p20200413
+  /// for a day, and drop those wholly expired; give the number of
+  /// dropped partitions. Only used with cookie_partitioning.
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 8, "FUNCTION hcv_maintain_web_cookie_partitions",
+                                  R"crwcpartfun(
+CREATE OR REPLACE FUNCTION hcv_maintain_web_cookie_partitions(step TEXT, ahead INT)
+RETURNS INT LANGUAGE plpgsql AS $$
+DECLARE
+  fromt TIMESTAMP;
+  stepiv INTERVAL := ('1 ' || step)::interval;
+  partname TEXT;
+  partend TIMESTAMP;
+  part RECORD;
+  nbdropped INT := 0;
+BEGIN
+  FOR ix IN 0..ahead LOOP
+    fromt := date_trunc(step, LOCALTIMESTAMP) + ix * stepiv;
+    partname := 'tb_web_cookie_p'
+      || to_char(fromt, CASE step WHEN 'hour' THEN 'YYYYMMDDHH24' ELSE 'YYYYMMDD' END);
+    EXECUTE format('CREATE TABLE IF NOT EXISTS %I PARTITION OF tb_web_cookie'
+                   ' FOR VALUES FROM (%L) TO (%L)', partname, fromt, fromt + stepiv);
+  END LOOP;
+  FOR part IN SELECT c.relname FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid
+      WHERE i.inhparent = 'tb_web_cookie'::regclass
+        AND c.relname ~ '^tb_web_cookie_p([0-9]{8}|[0-9]{10})$' LOOP
+    IF length(part.relname) = 25 THEN
+      partend := to_timestamp(substr(part.relname, 16), 'YYYYMMDDHH24')::timestamp + interval '1 hour';
+    ELSE
+      partend := to_timestamp(substr(part.relname, 16), 'YYYYMMDD')::timestamp + interval '1 day';
+    END IF;
+    IF partend <= LOCALTIMESTAMP THEN
+      EXECUTE format('DROP TABLE %I', part.relname);
+      nbdropped := nbdropped + 1;
+    END IF;
+  END LOOP;
+  DELETE FROM tb_web_cookie_default WHERE wcookie_exptime < LOCALTIMESTAMP;
+  RETURN nbdropped;
+END $$;
+)crwcpartfun");
+  /// an index of a partitioned table cannot be built concurrently
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 9, "INDEX ix_cookie_random",
+                                  partitionedcookies?R"crcookierandomix(
+---- INDEX ix_cookie_random
+  CREATE INDEX IF NOT EXISTS ix_cookie_random
+    ON tb_web_cookie(wcookie_random);
+--- end INDEX ix_cookie_random
+)crcookierandomix"
+                                  :R"cccookierandomix(
+---- INDEX ix_cookie_random
+  CREATE INDEX CONCURRENTLY IF NOT EXISTS ix_cookie_random
+    ON tb_web_cookie(wcookie_random);
+--- end INDEX ix_cookie_random
+)cccookierandomix",
+                                  partitionedcookies?"":"ix_cookie_random");
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 10, "INDEX ix_cookie_exptime",
+                                  partitionedcookies?R"crcookietimeix(
+---- INDEX ix_cookie_exptime
+  CREATE INDEX IF NOT EXISTS ix_cookie_exptime
+    ON tb_web_cookie(wcookie_exptime);
+--- end INDEX ix_cookie_exptime
+)crcookietimeix"
+                                  :R"cccookietimeix(
+---- INDEX ix_cookie_exptime
+  CREATE INDEX CONCURRENTLY IF NOT EXISTS ix_cookie_exptime
+    ON tb_web_cookie(wcookie_exptime);
+--- end INDEX ix_cookie_exptime
+)cccookietimeix",
+                                  partitionedcookies?"":"ix_cookie_exptime");
+  ////================ emails are compared in lowercase
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 11, "INDEX ix_user_email_lower",
+                                  R"cruseremaillowix(
+---- INDEX ix_user_email_lower
+  CREATE INDEX CONCURRENTLY IF NOT EXISTS ix_user_email_lower
+    ON tb_user(lower(user_email));
+--- end INDEX ix_user_email_lower
+)cruseremaillowix",
+                                  "ix_user_email_lower");
+  ////================ room for crypt(3) SHA-512 passwords
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 12, "ALTER passw_encr",
+                                  R"alterpasswenc(
+---- widen passw_encr
+ALTER TABLE tb_password ALTER COLUMN passw_encr TYPE VARCHAR(128);
+--- end widen passw_encr
+)alterpasswenc");
+  ////================ one user per email, whatever its case; fails
+  ////================ on duplicates, which should be merged by hand
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 13, "INDEX ix_user_email_unique",
+                                  R"cremailuniqix(
+---- UNIQUE INDEX ix_user_email_unique
+  CREATE UNIQUE INDEX CONCURRENTLY IF NOT EXISTS ix_user_email_unique
+    ON tb_user(lower(user_email));
+--- end UNIQUE INDEX ix_user_email_unique
+)cremailuniqix",
+                                  "ix_user_email_unique");
+  hcv_database_register_migration(HCV_DBMIGRATION_OWNER, 14, "DROP ix_user_email_lower",
+                                  R"dropemaillowix(
+---- redundant with ix_user_email_unique
+DROP INDEX IF EXISTS ix_user_email_lower;
+--- end redundant with ix_user_email_unique
+)dropemaillowix");
+} // end hcv_register_core_migrations
+
+
+void
+hcv_initialize_database(const std::string&uri, bool cleardata)
+{
+  std::string connstr = uri;
+  if (connstr.empty())
+    {
+      if (hcv_config_has_group("postgresql"))
+        {
+          hcv_config_do([&connstr](const Glib::KeyFile*kf)
+          {
+            if (!kf->has_key("postgresql","connection"))
+              HCV_FATALOUT("missing 'connection' key in [postgresql] section of configuration");
+            connstr = kf->get_string("postgresql","connection");
+            HCV_SYSLOGOUT(LOG_INFO, "using '" << connstr
+                          << "' as PostGreSQL connection string.");
+          });
+        }
+      else
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "cannot initialize database. Configuration file should have a [postgresql] group.");
+          return;
+        }
+    };
+  if (connstr.empty() || connstr=="-")
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "no PostGreSQL database initialization: " << connstr);
+      return;
+    }
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database connstr=" << connstr);
+  ///
+  long poolsize = HCV_DBPOOL_DEFAULT_SIZE;
+  double checkouttimeout = HCV_DBPOOL_DEFAULT_CHECKOUT_TIMEOUT;
+  double healthinterval = HCV_DBPOOL_DEFAULT_HEALTH_INTERVAL;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("postgresql"))
+      return;
+    if (kf->has_key("postgresql","pool_size"))
+      poolsize = (long) kf->get_int64("postgresql","pool_size");
+    if (kf->has_key("postgresql","checkout_timeout"))
+      checkouttimeout = kf->get_double("postgresql","checkout_timeout");
+    if (kf->has_key("postgresql","health_check_interval"))
+      healthinterval = kf->get_double("postgresql","health_check_interval");
+    if (kf->has_key("postgresql","pooler_mode"))
+      hcv_dbpooler_mode.store(kf->get_boolean("postgresql","pooler_mode"));
+  });
+  if (poolsize < 1)
+    poolsize = 1;
+  else if (poolsize > HCV_DBPOOL_MAXIMAL_SIZE)
+    poolsize = HCV_DBPOOL_MAXIMAL_SIZE;
+  if (checkouttimeout < 0.0 || std::isnan(checkouttimeout))
+    checkouttimeout = 0.0;
+  if (healthinterval < 0.0 || std::isnan(healthinterval))
+    healthinterval = 0.0;
+  std::vector<std::string> replicas;
+  double replicamaxlag = HCV_DBREPLICA_DEFAULT_MAX_LAG;
+  double slowthreshold = HCV_DBSTMT_DEFAULT_SLOW_THRESHOLD;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("postgresql"))
+      return;
+    if (kf->has_key("postgresql","replicas"))
+      for (const Glib::ustring& repstr: kf->get_string_list("postgresql","replicas"))
+        if (!repstr.empty())
+          replicas.push_back(repstr);
+    if (kf->has_key("postgresql","replica_max_lag"))
+      replicamaxlag = kf->get_double("postgresql","replica_max_lag");
+    if (kf->has_key("postgresql","slow_statement_threshold"))
+      slowthreshold = kf->get_double("postgresql","slow_statement_threshold");
+  });
+  if (slowthreshold < 0.0 || std::isnan(slowthreshold))
+    slowthreshold = 0.0;
+  hcv_dbstmt_slow_threshold.store(slowthreshold);
+  if (replicas.size() > HCV_DBREPLICA_MAXIMAL_COUNT)
+    HCV_FATALOUT("hcv_initialize_database: too many [postgresql] replicas " << replicas.size()
+                 << ", at most " << HCV_DBREPLICA_MAXIMAL_COUNT);
+  if (replicamaxlag < 0.0 || std::isnan(replicamaxlag))
+    replicamaxlag = 0.0;
+  long cookiebatchsize = HCV_COOKIE_BATCH_DEFAULT_SIZE;
+  double cookiebatchdelay = HCV_COOKIE_BATCH_DEFAULT_DELAY;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("postgresql"))
+      return;
+    if (kf->has_key("postgresql","cookie_batch_size"))
+      cookiebatchsize = (long) kf->get_int64("postgresql","cookie_batch_size");
+    if (kf->has_key("postgresql","cookie_batch_delay"))
+      cookiebatchdelay = kf->get_double("postgresql","cookie_batch_delay");
+  });
+  if (cookiebatchsize < 1)
+    cookiebatchsize = 1;
+  else if (cookiebatchsize > HCV_COOKIE_BATCH_MAXIMAL_SIZE)
+    cookiebatchsize = HCV_COOKIE_BATCH_MAXIMAL_SIZE;
+  if (cookiebatchdelay < 0.0 || std::isnan(cookiebatchdelay))
+    cookiebatchdelay = 0.0;
+  else if (cookiebatchdelay > HCV_COOKIE_BATCH_MAXIMAL_DELAY)
+    cookiebatchdelay = HCV_COOKIE_BATCH_MAXIMAL_DELAY;
+  hcv_cookie_batch_size.store(cookiebatchsize);
+  hcv_cookie_batch_delay.store(cookiebatchdelay);
+  std::string cookiepartitioning = "none";
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("postgresql"))
+      return;
+    if (kf->has_key("postgresql","cookie_partitioning"))
+      cookiepartitioning = kf->get_string("postgresql","cookie_partitioning");
+    if (kf->has_key("postgresql","purge_batch_size"))
+      hcv_cookie_purge_maxbatch = (long) kf->get_int64("postgresql","purge_batch_size");
+    if (kf->has_key("postgresql","purge_period"))
+      hcv_cookie_purge_period = kf->get_double("postgresql","purge_period");
+    if (kf->has_key("postgresql","purge_target_time"))
+      hcv_cookie_purge_target = kf->get_double("postgresql","purge_target_time");
+    if (kf->has_key("postgresql","purge_max_replication_lag"))
+      hcv_cookie_purge_maxlag = kf->get_double("postgresql","purge_max_replication_lag");
+    if (kf->has_key("postgresql","email_filter"))
+      hcv_emailfilter_wanted = kf->get_boolean("postgresql","email_filter");
+    if (kf->has_key("postgresql","email_filter_refresh"))
+      hcv_emailfilter_refresh = kf->get_double("postgresql","email_filter_refresh");
+  });
+  if (hcv_emailfilter_refresh < HCV_POSTPONE_MINIMAL_DELAY || std::isnan(hcv_emailfilter_refresh))
+    hcv_emailfilter_refresh = HCV_POSTPONE_MINIMAL_DELAY;
+  else if (hcv_emailfilter_refresh > HCV_POSTPONE_MAXIMAL_DELAY)
+    hcv_emailfilter_refresh = HCV_POSTPONE_MAXIMAL_DELAY;
+  if (hcv_cookie_purge_maxbatch < HCV_COOKIE_PURGE_MINIMAL_BATCH)
+    hcv_cookie_purge_maxbatch = HCV_COOKIE_PURGE_MINIMAL_BATCH;
+  else if (hcv_cookie_purge_maxbatch > HCV_COOKIE_PURGE_MAXIMAL_BATCH)
+    hcv_cookie_purge_maxbatch = HCV_COOKIE_PURGE_MAXIMAL_BATCH;
+  hcv_cookie_purge_batch = hcv_cookie_purge_maxbatch;
+  if (hcv_cookie_purge_period < HCV_POSTPONE_MINIMAL_DELAY || std::isnan(hcv_cookie_purge_period))
+    hcv_cookie_purge_period = HCV_POSTPONE_MINIMAL_DELAY;
+  else if (hcv_cookie_purge_period > HCV_POSTPONE_MAXIMAL_DELAY)
+    hcv_cookie_purge_period = HCV_POSTPONE_MAXIMAL_DELAY;
+  if (hcv_cookie_purge_target <= 0.0 || std::isnan(hcv_cookie_purge_target))
+    hcv_cookie_purge_target = HCV_COOKIE_PURGE_DEFAULT_TARGET;
+  if (hcv_cookie_purge_maxlag < 0.0 || std::isnan(hcv_cookie_purge_maxlag))
+    hcv_cookie_purge_maxlag = 0.0;
+  if (cookiepartitioning == "hourly")
+    hcv_cookie_partition_step = "hour";
+  else if (cookiepartitioning == "daily")
+    hcv_cookie_partition_step = "day";
+  else if (cookiepartitioning != "none")
+    HCV_FATALOUT("hcv_initialize_database: bad [postgresql] cookie_partitioning "
+                 << cookiepartitioning << ", should be none, hourly or daily");
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    hcv_dbpool_connstr = connstr;
+    hcv_dbpool_size = (unsigned) poolsize;
+    hcv_dbpool_checkout_timeout = checkouttimeout;
+    hcv_dbpool_health_interval = healthinterval;
+    hcv_dbreplica_maxlag = replicamaxlag;
+    for (const std::string& repstr: replicas)
+      hcv_dbreplicas.emplace_back(new hcv_dbreplica_st{repstr, {}, {}, 0.0, -HUGE_VAL, 0.0});
+  }
+  for (const std::string& repstr: replicas)
+    HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database read replica " << repstr
+                  << " used when lagging less than " << replicamaxlag << " s");
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database pool of " << poolsize
+                << " connections, checkout timeout " << checkouttimeout
+                << " s, health check after " << healthinterval << " s idle, web cookies inserted by "
+                << cookiebatchsize << " within " << cookiebatchdelay << " ms");
+  if (hcv_dbpooler_mode.load())
+    HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database in pooler mode, without prepared statements");
+  hcv_prepare_statements_in_database();
+  {
+    Hcv_database_connection dbconn;
+    HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database for connstr=" << connstr << " got first connection");
+    if (cleardata)
+      {
+        pqxx::work cleartransact(dbconn.conn());
+        // https://dba.stackexchange.com/a/154075/204015
+        /// our schema version is kept, since tables are only truncated
+        cleartransact.exec0(R"cleardatabase(
+DO
+$$
+DECLARE
+  l_stmt text;
+BEGIN
+  SELECT 'truncate ' || string_agg(format('%I.%I', schemaname, tablename), ',')
+    INTO l_stmt
+  FROM pg_tables
+  WHERE schemaname IN ('public') AND tablename <> 'tb_schema_version';
+  EXECUTE l_stmt;
+END;
+$$
+)cleardatabase");
+        cleartransact.commit();
+        HCV_SYSLOGOUT(LOG_NOTICE, "hcv_initialize_database cleared database");
+      }
+    ///================ add something into PostGreSQL log, and read in
+    ///================ the same round trip the versions of PostGreSQL
+    ///================ and of our schema
+    std::string webcookiekind;
+    {
+      /// see https://stackoverflow.com/a/60954480/841108
+      char logreqbuf[256];
+      memset (logreqbuf, 0, sizeof(logreqbuf));
+      char gitbuf[24];
+      memset (gitbuf, 0, sizeof(gitbuf));
+      strncpy(gitbuf, hcv_gitid, sizeof(gitbuf)-5);
+      if (strchr(hcv_gitid, '+'))
+        strcat(gitbuf, "+");
+      snprintf (logreqbuf, sizeof(logreqbuf),
+                "starting HelpCovid git %.22s (built %.80s, md5 %.20s...) %s on %.64s pid %d",
+                gitbuf, hcv_timestamp, hcv_md5sum,
+                (cleardata?"cleared":"initialized"),
+                hcv_get_hostname(), (int)getpid());
+      if (strchr(logreqbuf, '\'') || strchr(logreqbuf, ';') || strchr(logreqbuf, '\\'))
+        HCV_FATALOUT("hcv_initialize_database invalid logreqbuf:" << logreqbuf);
+      std::string startsql = std::string(R"startlog(
+DO $$BEGIN RAISE LOG ')startlog") + logreqbuf + R"startver(';
+  IF to_regclass('tb_schema_version') IS NULL THEN
+    CREATE TABLE IF NOT EXISTS tb_schema_version (
+      schemav_owner VARCHAR(64) NOT NULL, -- helpcovid, or the plugin name
+      schemav_step INT NOT NULL,          -- increasing within its owner
+      schemav_name TEXT NOT NULL,         -- what that step did
+      schemav_gitid VARCHAR(48),          -- of the helpcovid applying it
+      schemav_time TIMESTAMP DEFAULT current_timestamp,
+      PRIMARY KEY (schemav_owner, schemav_step));
+  END IF;
+END$$;
+SELECT version(), current_setting('server_version'),
+       COALESCE((SELECT relkind::text FROM pg_class
+                  WHERE oid = to_regclass('tb_web_cookie')), ''),
+       sv.schemav_owner, sv.schemav_step
+  FROM (SELECT 1) AS one
+  LEFT JOIN (SELECT schemav_owner, MAX(schemav_step) AS schemav_step
+               FROM tb_schema_version GROUP BY schemav_owner) AS sv ON true
+)startver";
+      pqxx::nontransaction starttransact(dbconn.conn());
+      pqxx::result startres = starttransact.exec(startsql);
+      std::string pqversion = startres[0][0].as<std::string>();
+      hcv_our_postgresql_server_version = startres[0][1].as<std::string>();
+      webcookiekind = startres[0][2].as<std::string>();
+      std::lock_guard<std::mutex> gu(hcv_dbmigration_mtx);
+      for (auto row: startres)
+        if (!row[3].is_null())
+          hcv_dbschema_versions[row[3].as<std::string>()] = row[4].as<int>();
+      HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database got PostGreSQL version " << pqversion
+                    << "(server version " << hcv_our_postgresql_server_version << ")");
+    }
+    if (!hcv_cookie_partition_step.empty() && !webcookiekind.empty() && webcookiekind != "p")
+      {
+        HCV_SYSLOGOUT(LOG_WARNING, "hcv_initialize_database: tb_web_cookie exists but is not partitioned,"
+                      " ignoring cookie_partitioning; it should be recreated");
+        hcv_cookie_partition_step.clear();
+      }
+    hcv_register_core_migrations(!hcv_cookie_partition_step.empty());
+    hcv_database_migrate(dbconn);
+    if (!hcv_cookie_partition_step.empty())
+      {
+        pqxx::nontransaction parttransact(dbconn.conn());
+        parttransact.exec_params("SELECT hcv_maintain_web_cookie_partitions($1, $2)",
+                                 hcv_cookie_partition_step,
+                                 (hcv_cookie_partition_step=="hour")
+                                 ?HCV_COOKIE_PARTITIONS_AHEAD_HOURS:HCV_COOKIE_PARTITIONS_AHEAD_DAYS);
+        HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_database: tb_web_cookie partitioned by "
+                      << hcv_cookie_partition_step);
+      }
+    /// plugins may register their own migration steps there
+    hcv_initialize_plugins_for_database(&dbconn.conn());
+    hcv_database_migrate(dbconn);
+  }
+  if (hcv_emailfilter_wanted)
+    hcv_emailfilter_load();
+  hcv_initialize_dbasync(connstr);
+  HCV_SYSLOGOUT(LOG_NOTICE, "PostGreSQL database " << connstr << " successfully initialized");
+} // end hcv_initialize_database
+
+
+//// the typed prepared statements; ids are given by RETURNING, so
+//// every insertion is a single round trip
+
+static const Hcv_statement<hcv_sql_params<std::string>, hcv_sql_row<long>>
+hcv_find_user_by_email_stmt
+("find_user_by_email_pstm",
+ R"finduseremail(
+SELECT user_id FROM tb_user WHERE lower(user_email)=lower($1)
+)finduseremail", HCV_SQL_READ);
+
+/// the users after some user_id, by increasing ids, for the filter
+/// of known emails
+static const Hcv_statement<hcv_sql_params<long,long>, hcv_sql_row<long,std::string>>
+hcv_scan_user_emails_stmt
+("scan_user_emails_pstm",
+ R"scanuseremails(
+SELECT user_id, user_email FROM tb_user
+ WHERE user_id > $1 ORDER BY user_id LIMIT $2
+)scanuseremails");
+
+/// insert a batch of web cookies, given as three PostGreSQL arrays of
+/// random keys, expiration times and web agent hashes; the
+/// insertions are matched to their ids by their random key
+static const Hcv_statement<hcv_sql_params<std::string,std::string,std::string>,
+       hcv_sql_row<long,std::string>>
+       hcv_add_web_cookies_stmt
+       ("add_web_cookies_pstm",
+        R"addwebcookies(
+INSERT INTO tb_web_cookie
+     (wcookie_random, wcookie_exptime, wcookie_webagenthash)
+SELECT cookrandom, to_timestamp(cookexptime), cookhash
+  FROM unnest($1::text[], $2::float8[], $3::int[])
+    AS cook(cookrandom, cookexptime, cookhash)
+RETURNING wcookie_id, rtrim(wcookie_random)
+)addwebcookies");
+
+/// the expiration time is given in seconds since the Unix Epoch,
+/// like it was given to to_timestamp. Expired cookies are not wanted,
+/// which also skips the expired partitions of a partitioned table
+static const Hcv_statement<hcv_sql_params<long>, hcv_sql_row<std::string,long,int,long>>
+hcv_find_web_cookie_stmt
+("find_web_cookie_pstm",
+ R"findwebcookie(
+SELECT rtrim(wcookie_random),
+       EXTRACT(EPOCH FROM wcookie_exptime::timestamptz)::bigint,
+       wcookie_webagenthash, COALESCE(wcookie_userid, 0)
+  FROM tb_web_cookie
+ WHERE wcookie_id = $1 AND wcookie_exptime >= LOCALTIMESTAMP
+)findwebcookie", HCV_SQL_READ);
+
+static const Hcv_statement<hcv_sql_params<long>, hcv_sql_row<>>
+hcv_purge_web_cookies_stmt
+("purge_web_cookies_pstm",
+ R"purgewebcookies(
+DELETE FROM tb_web_cookie WHERE (tableoid, ctid) IN
+  (SELECT tableoid, ctid FROM tb_web_cookie
+    WHERE wcookie_exptime < LOCALTIMESTAMP LIMIT $1)
+)purgewebcookies");
+
+static const Hcv_statement<hcv_sql_params<std::string,int>, hcv_sql_row<int>>
+hcv_maintain_web_cookie_partitions_stmt
+("maintain_web_cookie_partitions_pstm",
+ "SELECT hcv_maintain_web_cookie_partitions($1, $2)");
+
+/// the replay lag of the slowest replica, 0 without replicas or
+/// without the pg_monitor role
+static const Hcv_statement<hcv_sql_params<>, hcv_sql_row<double>>
+hcv_replication_lag_stmt
+("replication_lag_pstm",
+ R"replicationlag(
+SELECT COALESCE(MAX(EXTRACT(EPOCH FROM replay_lag)), 0)::float8
+  FROM pg_stat_replication
+)replicationlag");
+
+// user_crtime is updated by default; user_telephone is not yet in hcv_user_model
+const hcv_user_create_stmt_t
+hcv_user_create_stmt
+("user_create_pstm",
+ R"usercreate(
+INSERT INTO tb_user
+     (user_firstname, user_familyname, user_email, user_gender, user_telephone)
+VALUES ($1, $2, lower($3), $4, '')
+ON CONFLICT DO NOTHING
+RETURNING user_id
+)usercreate");
+
+const hcv_user_get_password_by_email_stmt_t
+hcv_user_get_password_by_email_stmt
+("user_get_password_by_email_pstm",
+ R"usergetpasswd(
+SELECT passw_encr FROM tb_password
+WHERE passw_userid = (SELECT user_id FROM tb_user WHERE lower(user_email) = lower($1))
+ORDER BY passw_mtime DESC LIMIT 1
+)usergetpasswd", HCV_SQL_READ);
+
+/// the older passwords of a user are kept
+const hcv_user_add_password_stmt_t
+hcv_user_add_password_stmt
+("user_add_password_pstm",
+ R"useraddpasswd(
+INSERT INTO tb_password (passw_userid, passw_encr)
+SELECT user_id, $2 FROM tb_user WHERE lower(user_email) = lower($1)
+)useraddpasswd");
+
+
+/// https://libpqxx.readthedocs.io/en/stable/a01331.html
+/// https://www.tutorialspoint.com/postgresql/postgresql_c_cpp.htm
+void
+hcv_prepare_statements_in_database(void)
+{
+  hcv_find_user_by_email_stmt.register_statement();
+  hcv_scan_user_emails_stmt.register_statement();
+  hcv_add_web_cookies_stmt.register_statement();
+  hcv_find_web_cookie_stmt.register_statement();
+  hcv_purge_web_cookies_stmt.register_statement();
+  hcv_maintain_web_cookie_partitions_stmt.register_statement();
+  hcv_replication_lag_stmt.register_statement();
+  hcv_user_create_stmt.register_statement();
+  hcv_user_get_password_by_email_stmt.register_statement();
+  hcv_user_add_password_stmt.register_statement();
+} // end hcv_prepare_statements_in_database
+
+
+
+
+void
+hcv_database_register_prepared_statement(const std::string& name, 
+                                         const std::string& sql)
+{
+    HCV_DEBUGOUT("Registering prepared SQL statement " << name);
+    /// prepared lazily on each pooled connection, by
+    /// Hcv_database_connection::prepare
+    {
+      std::unique_lock<std::shared_mutex> gu(hcv_dbstatements_mtx);
+      hcv_dbstatements_dict[name] = sql;
+    }
+    hcv_database_statement_stats(name);
+} // end hcv_database_register_prepared_statement
+
+
+bool
+hcv_database_pooler_mode(void)
+{
+  return hcv_dbpooler_mode.load(std::memory_order_relaxed);
+} // end hcv_database_pooler_mode
+
+
+bool
+hcv_database_registered_statement_sql(const std::string& name, std::string& sql)
+{
+  std::shared_lock<std::shared_mutex> gu(hcv_dbstatements_mtx);
+  auto stit = hcv_dbstatements_dict.find(name);
+  if (stit == hcv_dbstatements_dict.end())
+    return false;
+  sql = stit->second;
+  return true;
+} // end hcv_database_registered_statement_sql
+
+
+
+
+
+
+////////////////////////////////////////////////////////////////
+//// the filter of known emails
+
+/// the key of an email in the filter, in lowercase like the
+/// lower(user_email) of PostGreSQL; false for non-ASCII emails, whose
+/// lowercase depends upon the database locale, so are not filtered
+static bool
+hcv_emailfilter_key(const std::string& email, std::string& key)
+{
+  key.clear();
+  for (char c: email)
+    if ((unsigned char)c >= 0x80)
+      return false;
+  key.reserve(email.size());
+  for (char c: email)
+    key.push_back((c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c);
+  return true;
+} // end hcv_emailfilter_key
+
+
+/// the bits of a key are h1 + i*h2, as in Kirsch & Mitzenmacher
+static inline void
+hcv_emailfilter_hashes(const std::string& key, uint64_t& h1, uint64_t& h2)
+{
+  h1 = std::hash<std::string>()(key);
+  /// the finalizer of splitmix64
+  uint64_t z = h1 + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  h2 = (z ^ (z >> 31)) | 1;
+} // end hcv_emailfilter_hashes
+
+
+static bool
+hcv_emailfilter_test(const hcv_emailfilter_st* filt, const std::string& key)
+{
+  uint64_t h1=0, h2=0;
+  hcv_emailfilter_hashes(key, h1, h2);
+  for (int ix = 0; ix < HCV_EMAILFILTER_NBHASH; ix++)
+    {
+      uint64_t bit = (h1 + ix*h2) & (filt->hcvef_nbbits - 1);
+      if (!(filt->hcvef_words[bit/64].load(std::memory_order_relaxed) & (1ULL << (bit%64))))
+        return false;
+    }
+  return true;
+} // end hcv_emailfilter_test
+
+
+/// readers may run concurrently, since bits are only set
+static void
+hcv_emailfilter_add(hcv_emailfilter_st* filt, const std::string& key)
+{
+  uint64_t h1=0, h2=0;
+  hcv_emailfilter_hashes(key, h1, h2);
+  bool added = false;
+  for (int ix = 0; ix < HCV_EMAILFILTER_NBHASH; ix++)
+    {
+      uint64_t bit = (h1 + ix*h2) & (filt->hcvef_nbbits - 1);
+      uint64_t mask = 1ULL << (bit%64);
+      if (!(filt->hcvef_words[bit/64].fetch_or(mask, std::memory_order_relaxed) & mask))
+        added = true;
+    }
+  if (added)
+    filt->hcvef_count++;
+} // end hcv_emailfilter_add
+
+
+static std::unique_ptr<hcv_emailfilter_st>
+hcv_emailfilter_make(long capacity)
+{
+  if (capacity < HCV_EMAILFILTER_MINIMAL_CAPACITY)
+    capacity = HCV_EMAILFILTER_MINIMAL_CAPACITY;
+  size_t nbbits = 64;
+  while (nbbits < (size_t)capacity * HCV_EMAILFILTER_BITS_PER_EMAIL)
+    nbbits *= 2;
+  std::unique_ptr<hcv_emailfilter_st> filt(new hcv_emailfilter_st);
+  filt->hcvef_words.reset(new std::atomic<uint64_t>[nbbits/64]);
+  for (size_t wix = 0; wix < nbbits/64; wix++)
+    filt->hcvef_words[wix].store(0, std::memory_order_relaxed);
+  filt->hcvef_nbbits = nbbits;
+  filt->hcvef_capacity = (long) (nbbits / HCV_EMAILFILTER_BITS_PER_EMAIL);
+  filt->hcvef_count.store(0);
+  filt->hcvef_lastid = 0;
+  filt->hcvef_rescanid = 0;
+  return filt;
+} // end hcv_emailfilter_make
+
+
+/// add the emails of users whose user_id is above fromid, giving the
+/// greatest user_id seen
+static long
+hcv_emailfilter_scan(hcv_emailfilter_st* filt, long fromid)
+{
+  long lastid = fromid;
+  Hcv_database_connection dbconn;
+  hcv_scan_user_emails_stmt.prepare(dbconn);
+  for (;;)
+    {
+      long nbrows = 0;
+      pqxx::read_transaction transact(dbconn.conn());
+      hcv_scan_user_emails_stmt.for_each
+      (transact, [&](long id, const std::string& email)
+      {
+        std::string key;
+        if (hcv_emailfilter_key(email, key))
+          hcv_emailfilter_add(filt, key);
+        if (id > lastid)
+          lastid = id;
+        nbrows++;
+      }, lastid, (long)HCV_EMAILFILTER_SCAN_CHUNK);
+      transact.commit();
+      if (nbrows < HCV_EMAILFILTER_SCAN_CHUNK)
+        break;
+    }
+  return lastid;
+} // end hcv_emailfilter_scan
+
+
+/// called once by hcv_initialize_database; the filter is then used
+static void
+hcv_emailfilter_load(void)
+{
+  double starttime = hcv_monotonic_real_time();
+  long nbusers = 0;
+  try
+    {
+      {
+        Hcv_database_connection dbconn;
+        pqxx::read_transaction transact(dbconn.conn());
+        nbusers = transact.exec1("SELECT COUNT(*) FROM tb_user")[0].as<long>();
+        transact.commit();
+      }
+      std::unique_ptr<hcv_emailfilter_st> filt = hcv_emailfilter_make(2*nbusers);
+      filt->hcvef_lastid = filt->hcvef_rescanid = hcv_emailfilter_scan(filt.get(), 0);
+      std::unique_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+      hcv_emailfilter = std::move(filt);
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_emailfilter_load failed, known emails are checked in database: "
+                    << exc.what());
+      return;
+    }
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_emailfilter_load loaded " << nbusers << " emails in "
+                << (long) (1000.0*(hcv_monotonic_real_time()-starttime)) << " ms");
+} // end hcv_emailfilter_load
+
+
+void
+hcv_database_note_known_email(const std::string& email)
+{
+  std::string key;
+  if (!hcv_emailfilter_key(email, key))
+    return;
+  std::shared_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+  if (!hcv_emailfilter)
+    return;
+  hcv_emailfilter_add(hcv_emailfilter.get(), key);
+  if (hcv_emailfilter_rebuilding)
+    {
+      std::lock_guard<std::mutex> notedgu(hcv_emailfilter_notedmtx);
+      hcv_emailfilter_noted.push_back(key);
+    }
+} // end hcv_database_note_known_email
+
+
+/// scan the users created since the previous refresh, including by
+/// other helpcovid processes. Serial ids may commit out of order, so
+/// the ids of the previous refresh are scanned again. A full filter is
+/// rebuilt twice bigger. Gives the delay before the next refresh.
+double
+hcv_database_refresh_email_filter(void)
+{
+  hcv_emailfilter_st* filt = nullptr;
+  {
+    std::shared_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+    filt = hcv_emailfilter.get();
+  }
+  if (!filt)
+    return HCV_POSTPONE_MAXIMAL_DELAY;
+  /// only this background thread replaces the filter, so it stays valid
+  try
+    {
+      long lastid = hcv_emailfilter_scan(filt, filt->hcvef_rescanid);
+      filt->hcvef_rescanid = filt->hcvef_lastid;
+      filt->hcvef_lastid = lastid;
+      if (filt->hcvef_count.load() > filt->hcvef_capacity)
+        {
+          /// emails noted before that flag are committed, so scanned
+          {
+            std::unique_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+            hcv_emailfilter_rebuilding = true;
+          }
+          std::unique_ptr<hcv_emailfilter_st> newfilt
+            = hcv_emailfilter_make(2*filt->hcvef_count.load());
+          newfilt->hcvef_lastid = hcv_emailfilter_scan(newfilt.get(), 0);
+          /// users of other processes committed late are scanned again
+          newfilt->hcvef_rescanid = filt->hcvef_rescanid;
+          std::unique_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+          {
+            std::lock_guard<std::mutex> notedgu(hcv_emailfilter_notedmtx);
+            for (const std::string& key: hcv_emailfilter_noted)
+              hcv_emailfilter_add(newfilt.get(), key);
+            hcv_emailfilter_noted.clear();
+          }
+          hcv_emailfilter_rebuilding = false;
+          hcv_emailfilter = std::move(newfilt);
+          HCV_SYSLOGOUT(LOG_INFO, "hcv_database_refresh_email_filter rebuilt for "
+                        << hcv_emailfilter->hcvef_capacity << " emails");
+        }
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_refresh_email_filter got exception:" << exc.what());
+      std::unique_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+      hcv_emailfilter_rebuilding = false;
+      std::lock_guard<std::mutex> notedgu(hcv_emailfilter_notedmtx);
+      hcv_emailfilter_noted.clear();
+    }
+  return hcv_emailfilter_refresh;
+} // end hcv_database_refresh_email_filter
+
+
+void
+hcv_database_email_filter_statistics(long*pnbemails, long*pnbnegatives,
+                                     long*pnbconfirmed, long*pnbfalsepositives)
+{
+  if (pnbemails)
+    {
+      std::shared_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+      *pnbemails = hcv_emailfilter ? hcv_emailfilter->hcvef_count.load() : 0;
+    }
+  if (pnbnegatives)
+    *pnbnegatives = hcv_emailfilter_negatives.load();
+  if (pnbconfirmed)
+    *pnbconfirmed = hcv_emailfilter_confirmed.load();
+  if (pnbfalsepositives)
+    *pnbfalsepositives = hcv_emailfilter_falsepositives.load();
+} // end hcv_database_email_filter_statistics
+
+
+// https://www.postgresqltutorial.com/postgresql-where/
+// https://www.postgresql.org/docs/current/sql-prepare.html
+bool
+hcv_database_with_known_email (const std::string& emailstr)
+{
+  HCV_DEBUGOUT("hcv_database_with_known_email: emailstr='" << emailstr << "'");
+  if (emailstr.empty() || emailstr.find('@') == std::string::npos)
+    {
+      HCV_DEBUGOUT("hcv_database_with_known_email bad email" << emailstr);
+      return false;
+    }
+  std::string key;
+  bool filtered = false;
+  if (hcv_emailfilter_key(emailstr, key))
+    {
+      std::shared_lock<std::shared_mutex> gu(hcv_emailfilter_mtx);
+      if (hcv_emailfilter)
+        {
+          if (!hcv_emailfilter_test(hcv_emailfilter.get(), key))
+            {
+              hcv_emailfilter_negatives++;
+              return false;
+            }
+          filtered = true;
+        }
+    }
+  long id = -1;
+  try {
+    Hcv_database_connection dbconn(hcv_find_user_by_email_stmt.access());
+    hcv_find_user_by_email_stmt.prepare(dbconn);
+    pqxx::work transact(dbconn.conn());
+    std::tuple<long> row;
+    if (hcv_find_user_by_email_stmt.exec1(transact, row, emailstr))
+      id = std::get<0>(row);
+    transact.commit();
+  } catch (std::exception& exc) {
+    HCV_SYSLOGOUT(LOG_WARNING,
+		  "hcv_database_with_known_email got exception:"
+		  << exc.what());
+    return false;
+  }
+  if (filtered)
+    {
+      hcv_emailfilter_confirmed++;
+      if (id <= 0)
+        hcv_emailfilter_falsepositives++;
+    }
+  return id>0;
+} // end hcv_database_with_known_email
+
+
+
+/// a PostGreSQL array literal, see
+/// https://www.postgresql.org/docs/current/arrays.html#ARRAYS-IO
+static void
+hcv_sql_array_append(std::string& arr, const std::string& elem)
+{
+  arr += (arr.empty())?"{\"":",\"";
+  for (char c: elem)
+    {
+      if (c == '"' || c == '\\')
+        arr += '\\';
+      arr += c;
+    }
+  arr += '"';
+} // end hcv_sql_array_append
+
+
+/// insert a batch of cookies, setting their ids
+static void
+hcv_database_insert_cookie_batch(const std::vector<hcv_cookie_insert_st*>& batch)
+{
+  std::string randomarr, exptimearr, hasharr;
+  std::unordered_multimap<std::string,hcv_cookie_insert_st*> randomdict;
+  for (hcv_cookie_insert_st* ins: batch)
+    {
+      hcv_sql_array_append(randomarr, ins->hcvcookins_random);
+      hcv_sql_array_append(exptimearr, std::to_string(ins->hcvcookins_exptime));
+      hcv_sql_array_append(hasharr, std::to_string(ins->hcvcookins_webagenthash));
+      randomdict.insert({ins->hcvcookins_random, ins});
+    }
+  randomarr += '}';
+  exptimearr += '}';
+  hasharr += '}';
+  auto setid = [&](long id, const std::string& random)
+  {
+    auto it = randomdict.find(random);
+    if (it == randomdict.end())
+      return;
+    it->second->hcvcookins_id = id;
+    randomdict.erase(it);
+  };
+  hcv_cookie_batch_flushes++;
+  hcv_cookie_batch_inserted += batch.size();
+  if (hcv_dbasync_enabled())
+    {
+      auto fut = hcv_dbasync_submit_future
+                 ({hcv_add_web_cookies_stmt.async_stmt(randomarr, exptimearr, hasharr)});
+      if (fut.wait_for(std::chrono::duration<double>(HCV_COOKIE_BATCH_ASYNC_TIMEOUT))
+          == std::future_status::ready)
+        {
+          std::vector<Hcv_dbasync_result> results = fut.get();
+          if (!results[0].ok())
+            {
+              HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_insert_cookie_batch of " << batch.size()
+                            << " cookies failed:" << results[0].error_message());
+              for (hcv_cookie_insert_st* ins: batch)
+                ins->hcvcookins_id = -2;
+              return;
+            }
+          for (int rix = 0; rix < results[0].nb_rows(); rix++)
+            setid(atol(results[0].value(rix, 0)), results[0].value(rix, 1));
+          return;
+        }
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_insert_cookie_batch of " << batch.size()
+                    << " cookies timed out in the asynchronous executor, inserting them again");
+    }
+  try
+    {
+      Hcv_database_connection dbconn;
+      hcv_add_web_cookies_stmt.prepare(dbconn);
+      pqxx::work transact(dbconn.conn());
+      hcv_add_web_cookies_stmt.for_each(transact, setid, randomarr, exptimearr, hasharr);
+      transact.commit();
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_insert_cookie_batch of " << batch.size()
+                    << " cookies got exception:" << exc.what());
+      for (hcv_cookie_insert_st* ins: batch)
+        ins->hcvcookins_id = -2;
+    }
+} // end hcv_database_insert_cookie_batch
+
+
+/// insert a batch of cookies of several requests; called without lock
+/// by the leader, so without its own request deadline and session key
+static void
+hcv_database_flush_cookie_batch(const std::vector<hcv_cookie_insert_st*>& batch)
+{
+  double leaderdeadline = hcv_request_deadline_time;
+  size_t leadersessionkey = hcv_dbsession_key;
+  hcv_request_deadline_time = 0.0;
+  hcv_dbsession_key = 0;
+  try
+    {
+      hcv_database_insert_cookie_batch(batch);
+    }
+  catch (...)
+    {
+      hcv_request_deadline_time = leaderdeadline;
+      hcv_dbsession_key = leadersessionkey;
+      throw;
+    }
+  hcv_request_deadline_time = leaderdeadline;
+  hcv_dbsession_key = leadersessionkey;
+} // end hcv_database_flush_cookie_batch
+
+
+long
+hcv_database_get_id_of_added_web_cookie(const std::string& randomstr, time_t exptime, int webagenthash)
+{
+  HCV_ASSERT(!randomstr.empty());
+  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie start randomstr='"
+               << randomstr << " exptime=" << exptime
+               << " webagenthash=" << webagenthash);
+  hcv_cookie_insert_st ins {randomstr, (long)exptime, webagenthash, -1, false, false};
+  auto deadline = std::chrono::steady_clock::now()
+                  + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+                  (std::chrono::duration<double>(std::min(hcv_request_remaining_time(), 3600.0)));
+  std::unique_lock<std::mutex> lk(hcv_cookie_batch_mtx);
+  hcv_cookie_batch_pending.push_back(&ins);
+  long batchsize = hcv_cookie_batch_size.load();
+  if ((long)hcv_cookie_batch_pending.size() >= batchsize)
+    hcv_cookie_batch_changed.notify_all();
+  while (!ins.hcvcookins_done)
+    {
+      /// once taken, the leader of our batch sets our id, so we wait
+      /// for it whatever our deadline; until then we can give up
+      if (ins.hcvcookins_taken)
+        {
+          hcv_cookie_batch_changed.wait(lk);
+          continue;
+        }
+      if (hcv_cookie_batch_pending.empty() || hcv_cookie_batch_pending.front() != &ins)
+        {
+          if (hcv_cookie_batch_changed.wait_until(lk, deadline) == std::cv_status::timeout
+              && !ins.hcvcookins_taken && !ins.hcvcookins_done)
+            {
+              auto it = std::find(hcv_cookie_batch_pending.begin(), hcv_cookie_batch_pending.end(), &ins);
+              if (it != hcv_cookie_batch_pending.end())
+                hcv_cookie_batch_pending.erase(it);
+              /// maybe we were just becoming the leader
+              hcv_cookie_batch_changed.notify_all();
+              throw Hcv_deadline_exceeded("hcv_database_get_id_of_added_web_cookie");
+            }
+          continue;
+        }
+      /// we are the leader of the next batch
+      hcv_cookie_batch_changed.wait_for
+      (lk, std::chrono::duration<double,std::milli>(hcv_cookie_batch_delay.load()),
+       [&]
+      {
+        return (long)hcv_cookie_batch_pending.size() >= batchsize;
+      });
+      std::vector<hcv_cookie_insert_st*> batch;
+      while (!hcv_cookie_batch_pending.empty() && (long)batch.size() < batchsize)
+        {
+          batch.push_back(hcv_cookie_batch_pending.front());
+          batch.back()->hcvcookins_taken = true;
+          hcv_cookie_batch_pending.pop_front();
+        }
+      /// wake up the leader of the following batch, if any
+      if (!hcv_cookie_batch_pending.empty())
+        hcv_cookie_batch_changed.notify_all();
+      lk.unlock();
+      hcv_database_flush_cookie_batch(batch);
+      lk.lock();
+      for (hcv_cookie_insert_st* bins: batch)
+        bins->hcvcookins_done = true;
+      hcv_cookie_batch_changed.notify_all();
+    }
+  HCV_DEBUGOUT("hcv_database_get_id_of_added_web_cookie randomstr='"
+               << randomstr << "', exptime=" << exptime
+               << ", webagenthash=" << webagenthash
+               << " => id=" << ins.hcvcookins_id);
+  return ins.hcvcookins_id;
+} // end hcv_database_get_id_of_added_web_cookie
+
+
+bool
+hcv_database_find_web_cookie(long id, hcv_web_session_st*psess)
+{
+  HCV_ASSERT(psess != nullptr);
+  bool found = false;
+  try
+    {
+      /// a fresh cookie might not yet be on the replica, so is then
+      /// looked up again on the primary
+      for (hcv_sql_access_en access: {hcv_find_web_cookie_stmt.access(), HCV_SQL_WRITE})
+        {
+          Hcv_database_connection dbconn(access);
+          hcv_find_web_cookie_stmt.prepare(dbconn);
+          pqxx::work transact(dbconn.conn());
+          std::tuple<std::string,long,int,long> row;
+          found = hcv_find_web_cookie_stmt.exec1(transact, row, id);
+          transact.commit();
+          if (found)
+            {
+              memset (psess, 0, sizeof(*psess));
+              psess->hcvsess_id = id;
+              strncpy(psess->hcvsess_random, std::get<0>(row).c_str(), HCV_WEBCOOKIE_RANDOMSTR_WIDTH);
+              psess->hcvsess_exptime = (time_t) std::get<1>(row);
+              psess->hcvsess_webagenthash = std::get<2>(row);
+              psess->hcvsess_userid = std::get<3>(row);
+            }
+          if (found || !dbconn.on_replica())
+            break;
+        }
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_find_web_cookie id#" << id
+                    << " got exception:" << exc.what());
+      return false;
+    }
+  HCV_DEBUGOUT("hcv_database_find_web_cookie id#" << id << (found?" found":" unknown"));
+  return found;
+} // end hcv_database_find_web_cookie
+
+
+void
+hcv_database_cookie_batch_statistics(long*pnbflushes, long*pnbinserted)
+{
+  if (pnbflushes)
+    *pnbflushes = hcv_cookie_batch_flushes.load();
+  if (pnbinserted)
+    *pnbinserted = hcv_cookie_batch_inserted.load();
+} // end hcv_database_cookie_batch_statistics
+
+
+
+////////////////////////////////////////////////////////////////
+double
+hcv_database_purge_expired_cookies(void)
+{
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbpool_mtx);
+    if (hcv_dbpool_connstr.empty())
+      return HCV_POSTPONE_MAXIMAL_DELAY;
+  }
+  long batch = hcv_cookie_purge_batch;
+  long nbdeleted = 0;
+  double lag = 0.0;
+  double elapsed = 0.0;
+  try
+    {
+      Hcv_database_connection dbconn;
+      hcv_replication_lag_stmt.prepare(dbconn);
+      hcv_purge_web_cookies_stmt.prepare(dbconn);
+      if (!hcv_cookie_partition_step.empty())
+        {
+          /// expired partitions are dropped, instead of deleting rows;
+          /// never postponed by the replication lag, lest new cookies
+          /// go to the default partition, which would then forbid
+          /// creating their partition
+          hcv_maintain_web_cookie_partitions_stmt.prepare(dbconn);
+          pqxx::work transact(dbconn.conn());
+          transact.exec0("SET LOCAL lock_timeout = '" HCV_COOKIE_PURGE_LOCK_TIMEOUT "'");
+          std::tuple<int> row;
+          if (hcv_maintain_web_cookie_partitions_stmt.exec1
+              (transact, row, hcv_cookie_partition_step,
+               (hcv_cookie_partition_step=="hour")
+               ?HCV_COOKIE_PARTITIONS_AHEAD_HOURS:HCV_COOKIE_PARTITIONS_AHEAD_DAYS))
+            hcv_cookie_partitions_dropped += std::get<0>(row);
+          transact.commit();
+          return hcv_cookie_purge_period;
+        }
+      {
+        pqxx::read_transaction lagtransact(dbconn.conn());
+        std::tuple<double> row;
+        if (hcv_replication_lag_stmt.exec1(lagtransact, row))
+          lag = std::get<0>(row);
+      }
+      hcv_cookie_purge_lag.store(lag);
+      /// row deletions are throttled while the replicas lag behind
+      if (hcv_cookie_purge_maxlag > 0.0 && lag > hcv_cookie_purge_maxlag)
+        {
+          HCV_DEBUGOUT("hcv_database_purge_expired_cookies waits, replication lag " << lag << " s");
+          return std::min(hcv_cookie_purge_period, 2.0*lag);
+        }
+      double starttime = hcv_monotonic_real_time();
+      pqxx::work transact(dbconn.conn());
+      /// a batch should rather give up than wait for the locks of web requests
+      transact.exec0("SET LOCAL lock_timeout = '" HCV_COOKIE_PURGE_LOCK_TIMEOUT "'");
+      nbdeleted = hcv_purge_web_cookies_stmt.exec0(transact, batch);
+      transact.commit();
+      elapsed = hcv_monotonic_real_time() - starttime;
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_database_purge_expired_cookies batch of " << batch
+                    << " got exception:" << exc.what());
+      hcv_cookie_purge_batch = std::max(batch/2, (long)HCV_COOKIE_PURGE_MINIMAL_BATCH);
+      return hcv_cookie_purge_period;
+    }
+  hcv_cookie_purged += nbdeleted;
+  {
+    double nowt = hcv_monotonic_real_time();
+    std::lock_guard<std::mutex> gu(hcv_cookie_purge_mtx);
+    hcv_cookie_purge_recent.push_back({nowt, nbdeleted});
+    while (hcv_cookie_purge_recent.front().first < nowt - 60.0)
+      hcv_cookie_purge_recent.pop_front();
+  }
+  /// adapt the batch size to the observed time, so a batch holds its
+  /// row locks for about purge_target_time
+  if (elapsed > hcv_cookie_purge_target)
+    hcv_cookie_purge_batch = std::max(batch/2, (long)HCV_COOKIE_PURGE_MINIMAL_BATCH);
+  else if (nbdeleted >= batch && elapsed < hcv_cookie_purge_target/4)
+    hcv_cookie_purge_batch = std::min(batch*2, hcv_cookie_purge_maxbatch);
+  HCV_DEBUGOUT("hcv_database_purge_expired_cookies deleted " << nbdeleted << " of " << batch
+               << " in " << elapsed << " s, next batch " << hcv_cookie_purge_batch);
+  /// a full batch means more expired cookies; leave the database
+  /// some idle time, proportional to the time taken
+  if (nbdeleted >= batch)
+    return std::max(4*elapsed, (double)HCV_POSTPONE_MINIMAL_DELAY);
+  return hcv_cookie_purge_period;
+} // end hcv_database_purge_expired_cookies
+
+
+void
+hcv_database_purge_statistics(long*pnbpurged, long*pnbpurgedlastminute, long*pbatch, double*plag,
+                              long*pnbdroppedpartitions)
+{
+  if (pnbdroppedpartitions)
+    *pnbdroppedpartitions = hcv_cookie_partitions_dropped.load();
+  if (pnbpurged)
+    *pnbpurged = hcv_cookie_purged.load();
+  if (pnbpurgedlastminute)
+    {
+      double nowt = hcv_monotonic_real_time();
+      long nb = 0;
+      std::lock_guard<std::mutex> gu(hcv_cookie_purge_mtx);
+      for (auto& rec: hcv_cookie_purge_recent)
+        if (rec.first >= nowt - 60.0)
+          nb += rec.second;
+      *pnbpurgedlastminute = nb;
+    }
+  if (pbatch)
+    *pbatch = hcv_cookie_purge_batch;
+  if (plag)
+    *plag = hcv_cookie_purge_lag.load();
+} // end hcv_database_purge_statistics
+
+
+
+////////////////////////////////////////////////////////////////
+//// bulk import and export of users, by COPY of a temporary table,
+//// see the --import-users and --export-users program options. Files
+//// are CSV with a header line, or JSON lines when their name ends
+//// with .jsonl; the fields are email, first_name, family_name,
+//// gender, telephone and password. Rows are parsed and validated in
+//// parallel, a chunk at a time, each chunk loaded in one transaction
+//// skipping the emails already known, so an import can be run again.
+#define HCV_USERIMPORT_CHUNK 50000
+#define HCV_USERIMPORT_MAXIMAL_ERRORS 100 /* reported ones */
+
+struct hcv_user_import_row_st
+{
+  long hcvuimp_lineno;
+  std::string hcvuimp_email;	// in lowercase
+  std::string hcvuimp_firstname;
+  std::string hcvuimp_familyname;
+  std::string hcvuimp_gender;
+  std::string hcvuimp_telephone;
+  std::string hcvuimp_password;	// in clear, or encrypted by crypt(3)
+  std::string hcvuimp_error;	// empty when valid
+};
+
+static const std::vector<std::string> hcv_user_import_fields =
+{
+  "email", "first_name", "family_name", "gender", "telephone", "password"
+};
+
+static bool
+hcv_is_jsonl_path(const std::string& path)
+{
+  return path.size() > 6 && path.compare(path.size()-6, 6, ".jsonl") == 0;
+} // end hcv_is_jsonl_path
+
+
+/// split a CSV line as in RFC 4180, without newlines inside quotes
+static bool
+hcv_csv_split(const std::string& line, std::vector<std::string>& fields)
+{
+  fields.clear();
+  std::string cur;
+  bool quoted = false;
+  size_t ix = 0;
+  size_t len = line.size();
+  if (len > 0 && line[len-1] == '\r')
+    len--;
+  for (;;)
+    {
+      if (ix >= len)
+        {
+          if (quoted)
+            return false;
+          fields.push_back(cur);
+          return true;
+        }
+      char c = line[ix++];
+      if (quoted)
+        {
+          if (c != '"')
+            cur.push_back(c);
+          else if (ix < len && line[ix] == '"')
+            {
+              cur.push_back('"');
+              ix++;
+            }
+          else
+            quoted = false;
+        }
+      else if (c == '"')
+        quoted = true;
+      else if (c == ',')
+        {
+          fields.push_back(cur);
+          cur.clear();
+        }
+      else
+        cur.push_back(c);
+    }
+} // end hcv_csv_split
+
+
+static std::string
+hcv_csv_quote(const std::string& str)
+{
+  if (str.find_first_of(",\"\r\n") == std::string::npos)
+    return str;
+  std::string res = "\"";
+  for (char c: str)
+    {
+      if (c == '"')
+        res.push_back('"');
+      res.push_back(c);
+    }
+  res.push_back('"');
+  return res;
+} // end hcv_csv_quote
+
+
+/// parse and validate one line; colix gives the CSV column of every
+/// field of hcv_user_import_fields, or -1
+static void
+hcv_user_import_parse(const std::string& line, bool jsonl, const std::vector<int>& colix,
+                      hcv_user_import_row_st& row)
+{
+  std::vector<std::string> vals(hcv_user_import_fields.size());
+  if (jsonl)
+    {
+      static thread_local std::unique_ptr<Json::CharReader> jreader
+      (Json::CharReaderBuilder().newCharReader());
+      Json::Value jrow;
+      std::string jerr;
+      if (!jreader->parse(line.data(), line.data()+line.size(), &jrow, &jerr) || !jrow.isObject())
+        {
+          row.hcvuimp_error = "bad JSON: " + jerr;
+          return;
+        }
+      for (unsigned fix = 0; fix < hcv_user_import_fields.size(); fix++)
+        {
+          const Json::Value& jval = jrow[hcv_user_import_fields[fix]];
+          /// asString would throw on them
+          if (jval.isArray() || jval.isObject())
+            {
+              row.hcvuimp_error = "field " + hcv_user_import_fields[fix] + " is not a scalar";
+              return;
+            }
+          vals[fix] = jval.asString();
+        }
+    }
+  else
+    {
+      std::vector<std::string> cols;
+      if (!hcv_csv_split(line, cols))
+        {
+          row.hcvuimp_error = "bad CSV";
+          return;
+        }
+      for (unsigned fix = 0; fix < hcv_user_import_fields.size(); fix++)
+        if (colix[fix] >= 0 && colix[fix] < (int)cols.size())
+          vals[fix] = cols[colix[fix]];
+    }
+  hcv_user_model model;
+  model.user_email = vals[0];
+  for (char& c: model.user_email)
+    if (c >= 'A' && c <= 'Z')
+      c = c - 'A' + 'a';
+  model.user_first_name = vals[1];
+  model.user_family_name = vals[2];
+  model.user_gender = vals[3];
+  if (model.user_gender.size() == 1)
+    model.user_gender[0] = toupper(model.user_gender[0]);
+  hcv_user_model status;
+  if (!hcv_user_model_validate(model, status))
+    {
+      for (const std::string* msg: {&status.user_email, &status.user_first_name,
+                                    &status.user_family_name, &status.user_gender
+                                   })
+        if (!msg->empty() && *msg != "OK")
+          {
+            row.hcvuimp_error = *msg;
+            break;
+          }
+      if (row.hcvuimp_error.empty())
+        row.hcvuimp_error = "invalid user";
+      return;
+    }
+  /// the widths of the columns of tb_user, lest a long field fails
+  /// the COPY of its whole chunk
+  if (model.user_email.size() > 71 || model.user_first_name.size() > 31
+      || model.user_family_name.size() > 62 || vals[4].size() > 23)
+    row.hcvuimp_error = "too long field";
+  else if (model.user_gender != "F" && model.user_gender != "M" && model.user_gender != "?")
+    row.hcvuimp_error = "gender should be F, M or ?";
+  row.hcvuimp_email = model.user_email;
+  row.hcvuimp_firstname = model.user_first_name;
+  row.hcvuimp_familyname = model.user_family_name;
+  row.hcvuimp_gender = model.user_gender;
+  row.hcvuimp_telephone = vals[4];
+  row.hcvuimp_password = vals[5];
+} // end hcv_user_import_parse
+
+
+/// encrypt the passwords in clear of a chunk, on the password hashing
+/// threads, waiting for the oldest pending hash when they are busy
+static void
+hcv_user_import_hash_passwords(std::vector<hcv_user_import_row_st>& rows)
+{
+  std::deque<std::pair<hcv_user_import_row_st*,std::future<std::string>>> pending;
+  for (auto& row: rows)
+    {
+      /// only a well formed crypt(3) hash is kept as is, since it
+      /// is given as the setting of crypt_r at login
+      if (!row.hcvuimp_error.empty() || row.hcvuimp_password.empty()
+          || hcv_password_is_hash(row.hcvuimp_password))
+        continue;
+      for (;;)
+        {
+          try
+            {
+              pending.emplace_back(&row, hcv_password_hash(row.hcvuimp_password));
+              break;
+            }
+          catch (Hcv_password_overloaded&)
+            {
+              if (pending.empty())
+                throw;
+              pending.front().first->hcvuimp_password = pending.front().second.get();
+              pending.pop_front();
+            }
+        }
+    }
+  for (auto& pend: pending)
+    pend.first->hcvuimp_password = pend.second.get();
+} // end hcv_user_import_hash_passwords
+
+
+/// load a chunk of valid rows, giving the number of new users and of
+/// their passwords
+static void
+hcv_user_import_load(const std::vector<hcv_user_import_row_st>& rows,
+                     long& nbusers, long& nbpasswords)
+{
+  Hcv_database_connection dbconn;
+  pqxx::work transact(dbconn.conn());
+  transact.exec0(R"crimporttab(
+CREATE TEMP TABLE tmp_user_import (
+  imp_email VARCHAR(71) NOT NULL,
+  imp_firstname VARCHAR(31) NOT NULL,
+  imp_familyname VARCHAR(62) NOT NULL,
+  imp_gender CHAR(1) NOT NULL,
+  imp_telephone VARCHAR(23) NOT NULL,
+  imp_passwencr VARCHAR(128) NOT NULL
+) ON COMMIT DROP
+)crimporttab");
+  {
+    pqxx::stream_to copystream(transact, "tmp_user_import",
+                               std::vector<std::string> {"imp_email", "imp_firstname", "imp_familyname",
+                                   "imp_gender", "imp_telephone", "imp_passwencr"
+                                                        });
+    for (const auto& row: rows)
+      if (row.hcvuimp_error.empty())
+        copystream << std::make_tuple(row.hcvuimp_email, row.hcvuimp_firstname,
+                                      row.hcvuimp_familyname, row.hcvuimp_gender,
+                                      row.hcvuimp_telephone, row.hcvuimp_password);
+    copystream.complete();
+  }
+  /// emails were lowered in C++ for ASCII only, so are compared by
+  /// lower() here too, like user_create_pstm and ix_user_email_unique
+  pqxx::row res = transact.exec1(R"importusers(
+WITH imp AS (
+  SELECT DISTINCT ON (lower(imp_email)) lower(imp_email) AS imp_lowemail, *
+    FROM tmp_user_import
+   ORDER BY lower(imp_email)),
+ins AS (
+  INSERT INTO tb_user (user_email, user_firstname, user_familyname, user_gender, user_telephone)
+  SELECT imp_lowemail, imp_firstname, imp_familyname, imp_gender, imp_telephone
+    FROM imp
+   WHERE NOT EXISTS (SELECT 1 FROM tb_user WHERE lower(user_email) = imp_lowemail)
+  ON CONFLICT DO NOTHING
+  RETURNING user_id, user_email),
+pw AS (
+  INSERT INTO tb_password (passw_userid, passw_encr)
+  SELECT ins.user_id, imp_passwencr
+    FROM ins JOIN imp ON imp_lowemail = lower(ins.user_email)
+   WHERE imp_passwencr <> ''
+  RETURNING 1)
+SELECT (SELECT COUNT(*) FROM ins), (SELECT COUNT(*) FROM pw)
+)importusers");
+  transact.commit();
+  nbusers = res[0].as<long>();
+  nbpasswords = res[1].as<long>();
+} // end hcv_user_import_load
+
+
+void
+hcv_database_import_users(const std::string& path)
+{
+  double starttime = hcv_monotonic_real_time();
+  std::ifstream inp(path);
+  if (!inp)
+    HCV_FATALOUT("hcv_database_import_users: cannot open " << path);
+  bool jsonl = hcv_is_jsonl_path(path);
+  long lineno = 0;
+  std::string line;
+  std::vector<int> colix(hcv_user_import_fields.size(), -1);
+  if (!jsonl)
+    {
+      std::vector<std::string> header;
+      if (!std::getline(inp, line) || !hcv_csv_split(line, header))
+        HCV_FATALOUT("hcv_database_import_users: bad CSV header in " << path);
+      lineno++;
+      for (unsigned fix = 0; fix < hcv_user_import_fields.size(); fix++)
+        for (int cix = 0; cix < (int)header.size(); cix++)
+          if (header[cix] == hcv_user_import_fields[fix])
+            colix[fix] = cix;
+      if (colix[0] < 0)
+        HCV_FATALOUT("hcv_database_import_users: no email column in " << path);
+    }
+  int nbthreads = std::max(1, (int)std::thread::hardware_concurrency());
+  std::unordered_set<std::string> seenemails;
+  long nbread=0, nbinvalid=0, nbduplicate=0, nbusers=0, nbpasswords=0;
+  bool atend = false;
+  while (!atend)
+    {
+      std::vector<std::string> lines;
+      std::vector<hcv_user_import_row_st> rows;
+      lines.reserve(HCV_USERIMPORT_CHUNK);
+      while ((long)lines.size() < HCV_USERIMPORT_CHUNK)
+        {
+          if (!std::getline(inp, line))
+            {
+              atend = true;
+              break;
+            }
+          lineno++;
+          if (line.empty() || line == "\r")
+            continue;
+          lines.push_back(line);
+          rows.push_back(hcv_user_import_row_st {lineno, "", "", "", "", "", "", ""});
+        }
+      if (rows.empty())
+        break;
+      /// parse and validate slices of the chunk in parallel
+      {
+        std::vector<std::future<void>> slices;
+        size_t slicesize = (rows.size() + nbthreads - 1) / nbthreads;
+        for (size_t from = 0; from < rows.size(); from += slicesize)
+          slices.push_back(std::async(std::launch::async, [&, from]()
+          {
+            for (size_t ix = from; ix < std::min(from+slicesize, rows.size()); ix++)
+              try
+                {
+                  hcv_user_import_parse(lines[ix], jsonl, colix, rows[ix]);
+                }
+              catch (std::exception& exc)
+                {
+                  /// a bad row should not abort the whole import
+                  rows[ix].hcvuimp_error = exc.what();
+                }
+          }));
+        for (auto& sl: slices)
+          sl.get();
+      }
+      for (auto& row: rows)
+        {
+          nbread++;
+          if (row.hcvuimp_error.empty() && !seenemails.insert(row.hcvuimp_email).second)
+            {
+              row.hcvuimp_error = "duplicate email";
+              nbduplicate++;
+            }
+          else if (!row.hcvuimp_error.empty())
+            nbinvalid++;
+          if (!row.hcvuimp_error.empty() && nbinvalid+nbduplicate <= HCV_USERIMPORT_MAXIMAL_ERRORS)
+            std::clog << path << ":" << row.hcvuimp_lineno << ": " << row.hcvuimp_error << std::endl;
+        }
+      hcv_user_import_hash_passwords(rows);
+      long chunkusers=0, chunkpasswords=0;
+      hcv_user_import_load(rows, chunkusers, chunkpasswords);
+      nbusers += chunkusers;
+      nbpasswords += chunkpasswords;
+      for (const auto& row: rows)
+        if (row.hcvuimp_error.empty())
+          hcv_database_note_known_email(row.hcvuimp_email);
+      double elapsed = hcv_monotonic_real_time() - starttime;
+      std::cout << "imported " << nbusers << " users from " << nbread << " rows of " << path
+                << " in " << elapsed << " s (" << (long)(nbread/std::max(elapsed, 1.0e-3))
+                << " rows/s)" << std::endl;
+    }
+  double elapsed = hcv_monotonic_real_time() - starttime;
+  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_database_import_users from " << path << ": " << nbread << " rows, "
+                << nbusers << " new users, " << nbpasswords << " passwords, "
+                << nbinvalid << " invalid, " << nbduplicate << " duplicates, "
+                << (nbread-nbinvalid-nbduplicate-nbusers) << " already known, in "
+                << elapsed << " s (" << (long)(nbread/std::max(elapsed, 1.0e-3)) << " rows/s)");
+} // end hcv_database_import_users
+
+
+void
+hcv_database_export_users(const std::string& path)
+{
+  double starttime = hcv_monotonic_real_time();
+  std::ofstream out(path);
+  if (!out)
+    HCV_FATALOUT("hcv_database_export_users: cannot write " << path);
+  bool jsonl = hcv_is_jsonl_path(path);
+  Json::StreamWriterBuilder jwb;
+  jwb["indentation"] = "";
+  if (!jsonl)
+    {
+      for (unsigned fix = 0; fix < hcv_user_import_fields.size(); fix++)
+        out << (fix>0?",":"") << hcv_user_import_fields[fix];
+      out << "\n";
+    }
+  long nbusers = 0;
+  Hcv_database_connection dbconn;
+  pqxx::work transact(dbconn.conn());
+  /// COPY TO STDOUT of pqxx::stream_from needs a table, with the
+  /// latest password of every user
+  transact.exec0(R"crexporttab(
+CREATE TEMP TABLE tmp_user_export ON COMMIT DROP AS
+SELECT user_email, user_firstname, user_familyname, user_gender::text AS user_gender,
+       user_telephone, COALESCE(passw_encr, '') AS passw_encr
+  FROM tb_user
+  LEFT JOIN LATERAL (SELECT passw_encr FROM tb_password
+                      WHERE passw_userid = user_id
+                      ORDER BY passw_mtime DESC LIMIT 1) AS lastpassw ON true
+ ORDER BY user_id
+)crexporttab");
+  {
+    pqxx::stream_from copystream(transact, "tmp_user_export",
+                                 std::vector<std::string> {"user_email", "user_firstname", "user_familyname",
+                                     "user_gender", "user_telephone", "passw_encr"
+                                                          });
+    std::tuple<std::string,std::string,std::string,std::string,std::string,std::string> row;
+    while (copystream >> row)
+      {
+        std::vector<std::string> vals {std::get<0>(row), std::get<1>(row), std::get<2>(row),
+                                       std::get<3>(row), std::get<4>(row), std::get<5>(row)};
+        if (jsonl)
+          {
+            Json::Value jrow(Json::objectValue);
+            for (unsigned fix = 0; fix < hcv_user_import_fields.size(); fix++)
+              jrow[hcv_user_import_fields[fix]] = vals[fix];
+            out << Json::writeString(jwb, jrow) << "\n";
+          }
+        else
+          for (unsigned fix = 0; fix < vals.size(); fix++)
+            out << (fix>0?",":"") << hcv_csv_quote(vals[fix]) << (fix+1==vals.size()?"\n":"");
+        nbusers++;
+      }
+    copystream.complete();
+  }
+  transact.commit();
+  out.close();
+  if (!out)
+    HCV_FATALOUT("hcv_database_export_users: failed to write " << path);
+  double elapsed = hcv_monotonic_real_time() - starttime;
+  std::cout << "exported " << nbusers << " users to " << path << " in " << elapsed << " s ("
+            << (long)(nbusers/std::max(elapsed, 1.0e-3)) << " rows/s)" << std::endl;
+  HCV_SYSLOGOUT(LOG_NOTICE, "hcv_database_export_users to " << path << ": " << nbusers
+                << " users in " << elapsed << " s");
+} // end hcv_database_export_users
 
 
 /////////// end of file hcv_database.cc in github.com/bstarynk/helpcovid
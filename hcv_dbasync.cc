@@ -0,0 +1,653 @@
+/****************************************************************
+ * file hcv_dbasync.cc
+ *
+ * Description:
+ *      Asynchronous PostGreSQL executor of https://github.com/bstarynk/helpcovid
+ *      using the non-blocking API and pipeline mode of libpq.
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+#include <libpq-fe.h>
+
+extern "C" const char hcv_dbasync_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_dbasync_date[] = __DATE__;
+
+/// With libpq 14 or newer, every connection is in pipeline mode: the
+/// statements of all its batches are sent without waiting, each batch
+/// ending with a synchronization point, so is an implicit
+/// transaction. With an older libpq, the statements of a connection
+/// are sent one at a time, each in its own transaction.
+#ifndef LIBPQ_HAS_PIPELINING
+#warning libpq without pipeline mode, hcv_dbasync.cc sends one statement at a time
+#endif /*LIBPQ_HAS_PIPELINING*/
+
+#define HCV_DBASYNC_DEFAULT_CONNECTIONS 2
+#define HCV_DBASYNC_MAXIMAL_CONNECTIONS 16
+#define HCV_DBASYNC_MAX_BATCHES_PER_CONNECTION 16
+#define HCV_DBASYNC_TICK_TIMEOUT 1000 /*milliseconds*/
+#define HCV_DBASYNC_RECONNECT_DELAY 1.0 /*seconds*/
+#define HCV_DBASYNC_NO_RESULT "no result"
+
+struct hcv_dbasync_batch_st
+{
+  std::vector<hcv_dbasync_stmt_st> hcvdbab_stmts;
+  std::vector<Hcv_dbasync_result> hcvdbab_results;
+  hcv_dbasync_callback_t hcvdbab_callback;
+  std::string hcvdbab_error;	// first error, aborting the rest
+  double hcvdbab_submittime;	// monotonic time of submission
+  double hcvdbab_deadline;	// request deadline of the submitter, or 0
+};
+
+enum hcv_dbasync_op_en
+{
+  hcvdbop_prepare,
+  hcvdbop_query,
+  hcvdbop_sync,			// end of batch
+};
+
+/// some operation of a batch, sent or not yet
+struct hcv_dbasync_op_st
+{
+  hcv_dbasync_op_en hcvdbop_kind;
+  hcv_dbasync_batch_st* hcvdbop_batch;
+  int hcvdbop_stmtix;		// for prepare and query
+  std::string hcvdbop_sql;	// for prepare, or an unnamed query
+  double hcvdbop_senttime = 0.0;
+};
+
+struct hcv_dbasync_conn_st
+{
+  PGconn* hcvdbac_pgconn = nullptr;	// null when disconnected
+  std::set<std::string> hcvdbac_prepared;
+  std::deque<std::unique_ptr<hcv_dbasync_batch_st>> hcvdbac_batches;
+  std::deque<hcv_dbasync_op_st> hcvdbac_ops;
+  unsigned hcvdbac_nbsent = 0;	// the first ops already sent
+  bool hcvdbac_flushing = false;	// PQflush is incomplete
+  double hcvdbac_retrytime = 0.0;	// monotonic time to reconnect
+};
+
+static std::string hcv_dbasync_connstr;
+static std::deque<hcv_dbasync_conn_st> hcv_dbasync_conns; // owned by the executor thread
+static std::thread hcv_dbasync_thread;
+static int hcv_dbasync_event_fd = -1;
+static std::mutex hcv_dbasync_mtx;
+static std::deque<std::unique_ptr<hcv_dbasync_batch_st>> hcv_dbasync_pending;
+static std::atomic<bool> hcv_dbasync_started;
+static std::atomic<long> hcv_dbasync_submitted;
+static std::atomic<long> hcv_dbasync_completed;
+static std::atomic<long> hcv_dbasync_nbconnected;
+
+
+
+////////////////////////////////////////////////////////////////
+int
+Hcv_dbasync_result::nb_rows() const
+{
+  return _hcvdbar_res?PQntuples(_hcvdbar_res.get()):0;
+} // end Hcv_dbasync_result::nb_rows
+
+int
+Hcv_dbasync_result::nb_columns() const
+{
+  return _hcvdbar_res?PQnfields(_hcvdbar_res.get()):0;
+} // end Hcv_dbasync_result::nb_columns
+
+bool
+Hcv_dbasync_result::is_null(int row, int col) const
+{
+  if (!_hcvdbar_res || row < 0 || row >= nb_rows() || col < 0 || col >= nb_columns())
+    return true;
+  return PQgetisnull(_hcvdbar_res.get(), row, col);
+} // end Hcv_dbasync_result::is_null
+
+const char*
+Hcv_dbasync_result::value(int row, int col) const
+{
+  if (!_hcvdbar_res || row < 0 || row >= nb_rows() || col < 0 || col >= nb_columns())
+    return "";
+  return PQgetvalue(_hcvdbar_res.get(), row, col);
+} // end Hcv_dbasync_result::value
+
+long
+Hcv_dbasync_result::affected_rows() const
+{
+  if (!_hcvdbar_res)
+    return 0;
+  return atol(PQcmdTuples(_hcvdbar_res.get()));
+} // end Hcv_dbasync_result::affected_rows
+
+
+
+////////////////////////////////////////////////////////////////
+/// run the callback of a finished batch, in the executor thread
+static void
+hcv_dbasync_complete_batch(std::unique_ptr<hcv_dbasync_batch_st> batch)
+{
+  hcv_dbasync_completed++;
+  try
+    {
+      batch->hcvdbab_callback(batch->hcvdbab_results);
+    }
+  catch (std::exception& exc)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbasync_complete_batch: callback of "
+                    << batch->hcvdbab_stmts.size() << " statements, starting with "
+                    << batch->hcvdbab_stmts[0].hcvdbas_name << ", got exception " << exc.what());
+    }
+} // end hcv_dbasync_complete_batch
+
+
+static void
+hcv_dbasync_fail_batch(std::unique_ptr<hcv_dbasync_batch_st> batch, const std::string& err)
+{
+  for (Hcv_dbasync_result& res: batch->hcvdbab_results)
+    if (!res.ok() && res.error_message() == HCV_DBASYNC_NO_RESULT)
+      res = Hcv_dbasync_result(err);
+  hcv_dbasync_complete_batch(std::move(batch));
+} // end hcv_dbasync_fail_batch
+
+
+/// forget a broken connection, failing all its batches
+static void
+hcv_dbasync_fail_connection(hcv_dbasync_conn_st& conn, const std::string& err)
+{
+  HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbasync_fail_connection: " << err
+                << " with " << conn.hcvdbac_batches.size() << " batches");
+  if (conn.hcvdbac_pgconn)
+    {
+      PQfinish(conn.hcvdbac_pgconn);
+      hcv_dbasync_nbconnected--;
+    }
+  conn.hcvdbac_pgconn = nullptr;
+  conn.hcvdbac_prepared.clear();
+  conn.hcvdbac_ops.clear();
+  conn.hcvdbac_nbsent = 0;
+  conn.hcvdbac_flushing = false;
+  conn.hcvdbac_retrytime = hcv_monotonic_real_time() + HCV_DBASYNC_RECONNECT_DELAY;
+  auto batches = std::move(conn.hcvdbac_batches);
+  conn.hcvdbac_batches.clear();
+  for (auto& batch: batches)
+    hcv_dbasync_fail_batch(std::move(batch), err);
+} // end hcv_dbasync_fail_connection
+
+
+static void
+hcv_dbasync_connect(hcv_dbasync_conn_st& conn)
+{
+  PGconn* pgconn = PQconnectdb(hcv_dbasync_connstr.c_str());
+  if (!pgconn || PQstatus(pgconn) != CONNECTION_OK)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbasync_connect failed: "
+                    << (pgconn?PQerrorMessage(pgconn):"out of memory"));
+      if (pgconn)
+        PQfinish(pgconn);
+      conn.hcvdbac_retrytime = hcv_monotonic_real_time() + HCV_DBASYNC_RECONNECT_DELAY;
+      return;
+    }
+  if (PQsetnonblocking(pgconn, 1))
+    HCV_FATALOUT("hcv_dbasync_connect: PQsetnonblocking failed: " << PQerrorMessage(pgconn));
+#ifdef LIBPQ_HAS_PIPELINING
+  if (!PQenterPipelineMode(pgconn))
+    HCV_FATALOUT("hcv_dbasync_connect: PQenterPipelineMode failed: " << PQerrorMessage(pgconn));
+#endif /*LIBPQ_HAS_PIPELINING*/
+  conn.hcvdbac_pgconn = pgconn;
+  hcv_dbasync_nbconnected++;
+  HCV_DEBUGOUT("hcv_dbasync_connect connected socket#" << PQsocket(pgconn));
+} // end hcv_dbasync_connect
+
+
+/// queue the operations of a batch on some connection, preparing its
+/// statements there if needed; in pooler mode they are sent unnamed,
+/// with their SQL. A batch whose request deadline passed while it was
+/// pending fails without being sent. Once sent it is not cancelled,
+/// since a cancellation would hit whatever statement of the pipeline
+/// the connection is running, maybe of another batch.
+static void
+hcv_dbasync_assign_batch(hcv_dbasync_conn_st& conn, std::unique_ptr<hcv_dbasync_batch_st> batch)
+{
+  if (batch->hcvdbab_deadline > 0.0 && hcv_monotonic_real_time() >= batch->hcvdbab_deadline)
+    {
+      hcv_dbasync_fail_batch(std::move(batch), "request deadline exceeded");
+      return;
+    }
+  bool pooler = hcv_database_pooler_mode();
+  for (int stix = 0; stix < (int)batch->hcvdbab_stmts.size(); stix++)
+    {
+      const std::string& name = batch->hcvdbab_stmts[stix].hcvdbas_name;
+      if (pooler)
+        {
+          std::string sql;
+          hcv_database_registered_statement_sql(name, sql);
+          conn.hcvdbac_ops.push_back({hcvdbop_query, batch.get(), stix, sql});
+          continue;
+        }
+      if (conn.hcvdbac_prepared.find(name) == conn.hcvdbac_prepared.end())
+        {
+          std::string sql;
+          hcv_database_registered_statement_sql(name, sql);
+          conn.hcvdbac_ops.push_back({hcvdbop_prepare, batch.get(), stix, sql});
+          conn.hcvdbac_prepared.insert(name);
+        }
+      conn.hcvdbac_ops.push_back({hcvdbop_query, batch.get(), stix, std::string()});
+    }
+  conn.hcvdbac_ops.push_back({hcvdbop_sync, batch.get(), -1, std::string()});
+  conn.hcvdbac_batches.push_back(std::move(batch));
+} // end hcv_dbasync_assign_batch
+
+
+/// send the operations not yet sent, all of them when pipelining.
+/// Return true if something was sent.
+static bool
+hcv_dbasync_send_more(hcv_dbasync_conn_st& conn)
+{
+  bool sent = false;
+  PGconn* pgconn = conn.hcvdbac_pgconn;
+  while (pgconn && conn.hcvdbac_nbsent < conn.hcvdbac_ops.size())
+    {
+#ifndef LIBPQ_HAS_PIPELINING
+      if (conn.hcvdbac_nbsent > 0)
+        break;
+#endif /*LIBPQ_HAS_PIPELINING*/
+      hcv_dbasync_op_st& op = conn.hcvdbac_ops[conn.hcvdbac_nbsent];
+      op.hcvdbop_senttime = hcv_monotonic_real_time();
+      int ok = 1;
+      switch (op.hcvdbop_kind)
+        {
+        case hcvdbop_prepare:
+          ok = PQsendPrepare(pgconn, op.hcvdbop_batch->hcvdbab_stmts[op.hcvdbop_stmtix].hcvdbas_name.c_str(),
+                             op.hcvdbop_sql.c_str(), 0, nullptr);
+          break;
+        case hcvdbop_query:
+        {
+          const hcv_dbasync_stmt_st& stmt = op.hcvdbop_batch->hcvdbab_stmts[op.hcvdbop_stmtix];
+          std::vector<const char*> paramvalues;
+          paramvalues.reserve(stmt.hcvdbas_params.size());
+          for (const std::string& param: stmt.hcvdbas_params)
+            paramvalues.push_back(param.c_str());
+          if (!op.hcvdbop_sql.empty())
+            ok = PQsendQueryParams(pgconn, op.hcvdbop_sql.c_str(), (int)paramvalues.size(),
+                                   nullptr, paramvalues.data(), nullptr, nullptr, 0);
+          else
+            ok = PQsendQueryPrepared(pgconn, stmt.hcvdbas_name.c_str(), (int)paramvalues.size(),
+                                     paramvalues.data(), nullptr, nullptr, 0);
+        }
+        break;
+        case hcvdbop_sync:
+#ifdef LIBPQ_HAS_PIPELINING
+          ok = PQpipelineSync(pgconn);
+#endif /*LIBPQ_HAS_PIPELINING*/
+          break;
+        }
+      if (!ok)
+        {
+          hcv_dbasync_fail_connection(conn, std::string("libpq failed to send: ") + PQerrorMessage(pgconn));
+          return true;
+        }
+      conn.hcvdbac_nbsent++;
+      sent = true;
+    }
+  if (sent)
+    {
+      int fl = PQflush(pgconn);
+      if (fl < 0)
+        hcv_dbasync_fail_connection(conn, std::string("libpq failed to flush: ") + PQerrorMessage(pgconn));
+      else
+        conn.hcvdbac_flushing = (fl > 0);
+    }
+  return sent;
+} // end hcv_dbasync_send_more
+
+
+/// handle the results available without blocking. Return true if
+/// some operation was finished.
+static bool
+hcv_dbasync_read_results(hcv_dbasync_conn_st& conn)
+{
+  bool progress = false;
+  PGconn* pgconn = conn.hcvdbac_pgconn;
+  while (pgconn && conn.hcvdbac_nbsent > 0)
+    {
+      hcv_dbasync_op_st& op = conn.hcvdbac_ops.front();
+      hcv_dbasync_batch_st* batch = op.hcvdbop_batch;
+      if (op.hcvdbop_kind == hcvdbop_sync)
+        {
+#ifdef LIBPQ_HAS_PIPELINING
+          if (PQisBusy(pgconn))
+            break;
+          PGresult* res = PQgetResult(pgconn);
+          if (!res)
+            break;
+          if (PQresultStatus(res) != PGRES_PIPELINE_SYNC)
+            HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbasync_read_results: unexpected "
+                          << PQresStatus(PQresultStatus(res)) << " instead of pipeline sync");
+          PQclear(res);
+#endif /*LIBPQ_HAS_PIPELINING*/
+          HCV_ASSERT(conn.hcvdbac_batches.front().get() == batch);
+          auto donebatch = std::move(conn.hcvdbac_batches.front());
+          conn.hcvdbac_batches.pop_front();
+          conn.hcvdbac_ops.pop_front();
+          conn.hcvdbac_nbsent--;
+          hcv_dbasync_complete_batch(std::move(donebatch));
+          progress = true;
+          continue;
+        }
+      if (PQisBusy(pgconn))
+        break;
+      PGresult* res = PQgetResult(pgconn);
+      if (!res)
+        {
+          /// the end of the results of that operation
+          conn.hcvdbac_ops.pop_front();
+          conn.hcvdbac_nbsent--;
+          progress = true;
+          continue;
+        }
+      ExecStatusType status = PQresultStatus(res);
+      bool good = (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK);
+      std::string err;
+      if (!good)
+        {
+#ifdef LIBPQ_HAS_PIPELINING
+          if (status == PGRES_PIPELINE_ABORTED)
+            err = "aborted after: " + batch->hcvdbab_error;
+          else
+#endif /*LIBPQ_HAS_PIPELINING*/
+            err = PQresultErrorMessage(res);
+          while (!err.empty() && err.back() == '\n')
+            err.pop_back();
+          if (batch->hcvdbab_error.empty())
+            batch->hcvdbab_error = err;
+        }
+      const std::string& name = batch->hcvdbab_stmts[op.hcvdbop_stmtix].hcvdbas_name;
+      if (op.hcvdbop_kind == hcvdbop_prepare)
+        {
+          if (!good)
+            {
+              HCV_SYSLOGOUT(LOG_WARNING, "hcv_dbasync_read_results: failed to prepare "
+                            << name << ": " << err);
+              conn.hcvdbac_prepared.erase(name);
+            }
+          PQclear(res);
+        }
+      else if (good)
+        {
+          /// with pipelining, the execution time includes that of the
+          /// previous statements on the same connection
+          const hcv_dbasync_stmt_st& stmt = batch->hcvdbab_stmts[op.hcvdbop_stmtix];
+          hcv_dbstmt_stats_st* stats = hcv_database_statement_stats(name);
+          double exectime = hcv_monotonic_real_time() - op.hcvdbop_senttime;
+          long nbrows = PQntuples(res);
+          if (status == PGRES_COMMAND_OK)
+            nbrows = atol(PQcmdTuples(res));
+          hcv_database_record_statement_wait(stats, op.hcvdbop_senttime - batch->hcvdbab_submittime);
+          if (hcv_database_record_statement(stats, exectime, nbrows))
+            hcv_database_log_slow_statement(stats, exectime, nbrows, stmt.hcvdbas_params);
+          batch->hcvdbab_results[op.hcvdbop_stmtix]
+            = Hcv_dbasync_result(std::shared_ptr<pg_result>(res, PQclear), std::string());
+        }
+      else
+        {
+          PQclear(res);
+          batch->hcvdbab_results[op.hcvdbop_stmtix] = Hcv_dbasync_result(name + ": " + err);
+        }
+    }
+  return progress;
+} // end hcv_dbasync_read_results
+
+
+static void
+hcv_dbasync_progress(hcv_dbasync_conn_st& conn)
+{
+  bool progress = true;
+  while (progress && conn.hcvdbac_pgconn)
+    {
+      progress = hcv_dbasync_send_more(conn);
+      if (hcv_dbasync_read_results(conn))
+        progress = true;
+    }
+} // end hcv_dbasync_progress
+
+
+static void
+hcv_dbasync_thread_body(void)
+{
+  char thnambuf[16];
+  memset (&thnambuf, 0, sizeof(thnambuf));
+  snprintf(thnambuf, sizeof(thnambuf), "hcovidb%ld", (long)getpid());
+  pthread_setname_np(pthread_self(), thnambuf);
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_dbasync_thread_body starting thread " << thnambuf
+                << " with " << hcv_dbasync_conns.size() << " connections");
+  std::vector<struct pollfd> polltab;
+  std::vector<hcv_dbasync_conn_st*> pollconns;
+  for (;;)
+    {
+      double nowt = hcv_monotonic_real_time();
+      bool anyconnected = false;
+      for (hcv_dbasync_conn_st& conn: hcv_dbasync_conns)
+        {
+          if (!conn.hcvdbac_pgconn && nowt >= conn.hcvdbac_retrytime)
+            hcv_dbasync_connect(conn);
+          if (conn.hcvdbac_pgconn)
+            anyconnected = true;
+        }
+      /// dispatch the pending batches on the least busy connections
+      std::vector<std::unique_ptr<hcv_dbasync_batch_st>> unconnected;
+      {
+        std::lock_guard<std::mutex> gu(hcv_dbasync_mtx);
+        while (!hcv_dbasync_pending.empty())
+          {
+            if (!anyconnected)
+              {
+                unconnected.push_back(std::move(hcv_dbasync_pending.front()));
+                hcv_dbasync_pending.pop_front();
+                continue;
+              }
+            hcv_dbasync_conn_st* bestconn = nullptr;
+            for (hcv_dbasync_conn_st& conn: hcv_dbasync_conns)
+              {
+#ifdef LIBPQ_HAS_PIPELINING
+                if (conn.hcvdbac_batches.size() >= HCV_DBASYNC_MAX_BATCHES_PER_CONNECTION)
+                  continue;
+#else
+                if (!conn.hcvdbac_batches.empty())
+                  continue;
+#endif /*LIBPQ_HAS_PIPELINING*/
+                if (conn.hcvdbac_pgconn
+                    && (!bestconn || conn.hcvdbac_batches.size() < bestconn->hcvdbac_batches.size()))
+                  bestconn = &conn;
+              }
+            if (!bestconn)
+              break;
+            hcv_dbasync_assign_batch(*bestconn, std::move(hcv_dbasync_pending.front()));
+            hcv_dbasync_pending.pop_front();
+          }
+      }
+      for (auto& batch: unconnected)
+        hcv_dbasync_fail_batch(std::move(batch), "no asynchronous PostGreSQL connection");
+      for (hcv_dbasync_conn_st& conn: hcv_dbasync_conns)
+        hcv_dbasync_progress(conn);
+      ////
+      polltab.clear();
+      pollconns.clear();
+      polltab.push_back({hcv_dbasync_event_fd, POLLIN, 0});
+      pollconns.push_back(nullptr);
+      for (hcv_dbasync_conn_st& conn: hcv_dbasync_conns)
+        if (conn.hcvdbac_pgconn)
+          {
+            short events = POLLIN;
+            if (conn.hcvdbac_flushing)
+              events |= POLLOUT;
+            polltab.push_back({PQsocket(conn.hcvdbac_pgconn), events, 0});
+            pollconns.push_back(&conn);
+          }
+      int nbfd = poll(polltab.data(), polltab.size(), HCV_DBASYNC_TICK_TIMEOUT);
+      if (nbfd < 0 && errno != EINTR)
+        HCV_FATALOUT("hcv_dbasync_thread_body: poll failed");
+      if (nbfd <= 0)
+        continue;
+      if (polltab[0].revents & POLLIN)
+        {
+          int64_t evcnt = 0;
+          if (read(hcv_dbasync_event_fd, &evcnt, sizeof(evcnt)) != sizeof(evcnt))
+            HCV_DEBUGOUT("hcv_dbasync_thread_body: nothing read on event fd");
+        }
+      for (unsigned pix = 1; pix < polltab.size(); pix++)
+        {
+          hcv_dbasync_conn_st& conn = *pollconns[pix];
+          if (!polltab[pix].revents || !conn.hcvdbac_pgconn)
+            continue;
+          if (polltab[pix].revents & POLLOUT)
+            {
+              int fl = PQflush(conn.hcvdbac_pgconn);
+              if (fl < 0)
+                {
+                  hcv_dbasync_fail_connection(conn, std::string("libpq failed to flush: ")
+                                              + PQerrorMessage(conn.hcvdbac_pgconn));
+                  continue;
+                }
+              conn.hcvdbac_flushing = (fl > 0);
+            }
+          if (polltab[pix].revents & (POLLIN|POLLERR|POLLHUP))
+            {
+              if (!PQconsumeInput(conn.hcvdbac_pgconn))
+                {
+                  hcv_dbasync_fail_connection(conn, std::string("libpq failed to read: ")
+                                              + PQerrorMessage(conn.hcvdbac_pgconn));
+                  continue;
+                }
+              hcv_dbasync_progress(conn);
+            }
+        }
+    }
+} // end hcv_dbasync_thread_body
+
+
+
+////////////////////////////////////////////////////////////////
+void
+hcv_dbasync_submit(std::vector<hcv_dbasync_stmt_st> stmts, const hcv_dbasync_callback_t& callback)
+{
+  auto batch = std::make_unique<hcv_dbasync_batch_st>();
+  batch->hcvdbab_results.assign(stmts.size(), Hcv_dbasync_result(std::string(HCV_DBASYNC_NO_RESULT)));
+  batch->hcvdbab_stmts = std::move(stmts);
+  batch->hcvdbab_callback = callback;
+  batch->hcvdbab_submittime = hcv_monotonic_real_time();
+  batch->hcvdbab_deadline = hcv_request_deadline_time;
+  hcv_dbasync_submitted++;
+  std::string err;
+  std::string sql;
+  if (!hcv_dbasync_started.load())
+    err = "no asynchronous database executor";
+  else if (batch->hcvdbab_deadline > 0.0 && batch->hcvdbab_submittime >= batch->hcvdbab_deadline)
+    err = "request deadline exceeded";
+  else if (batch->hcvdbab_stmts.empty())
+    err = "empty batch";
+  else
+    for (const hcv_dbasync_stmt_st& stmt: batch->hcvdbab_stmts)
+      if (!hcv_database_registered_statement_sql(stmt.hcvdbas_name, sql))
+        {
+          err = "unregistered prepared statement " + stmt.hcvdbas_name;
+          break;
+        }
+  if (!err.empty())
+    {
+      hcv_dbasync_fail_batch(std::move(batch), err);
+      return;
+    }
+  {
+    std::lock_guard<std::mutex> gu(hcv_dbasync_mtx);
+    hcv_dbasync_pending.push_back(std::move(batch));
+  }
+  int64_t one = 1;
+  if (write(hcv_dbasync_event_fd, &one, sizeof(one)) != sizeof(one))
+    HCV_FATALOUT("hcv_dbasync_submit: failed to write on hcv_dbasync_event_fd");
+} // end hcv_dbasync_submit
+
+
+std::future<std::vector<Hcv_dbasync_result>>
+    hcv_dbasync_submit_future(std::vector<hcv_dbasync_stmt_st> stmts)
+{
+  auto promise = std::make_shared<std::promise<std::vector<Hcv_dbasync_result>>>();
+  auto future = promise->get_future();
+  hcv_dbasync_submit(std::move(stmts), [=](std::vector<Hcv_dbasync_result>& results)
+  {
+    promise->set_value(std::move(results));
+  });
+  return future;
+} // end hcv_dbasync_submit_future
+
+
+bool
+hcv_dbasync_enabled(void)
+{
+  return hcv_dbasync_started.load();
+} // end hcv_dbasync_enabled
+
+
+void
+hcv_dbasync_statistics(long*pnbsubmitted, long*pnbcompleted, long*pnbconnections)
+{
+  if (pnbsubmitted)
+    *pnbsubmitted = hcv_dbasync_submitted.load();
+  if (pnbcompleted)
+    *pnbcompleted = hcv_dbasync_completed.load();
+  if (pnbconnections)
+    *pnbconnections = hcv_dbasync_nbconnected.load();
+} // end hcv_dbasync_statistics
+
+
+void
+hcv_initialize_dbasync(const std::string& connstr)
+{
+  long nbconns = HCV_DBASYNC_DEFAULT_CONNECTIONS;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (kf->has_group("postgresql") && kf->has_key("postgresql","async_connections"))
+      nbconns = (long) kf->get_int64("postgresql","async_connections");
+  });
+  if (nbconns <= 0)
+    {
+      HCV_SYSLOGOUT(LOG_NOTICE, "hcv_initialize_dbasync: no asynchronous database executor");
+      return;
+    }
+  if (nbconns > HCV_DBASYNC_MAXIMAL_CONNECTIONS)
+    nbconns = HCV_DBASYNC_MAXIMAL_CONNECTIONS;
+  if (hcv_dbasync_started.load())
+    HCV_FATALOUT("hcv_initialize_dbasync called twice");
+  hcv_dbasync_connstr = connstr;
+  hcv_dbasync_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (hcv_dbasync_event_fd < 0)
+    HCV_FATALOUT("hcv_initialize_dbasync: eventfd failed");
+  hcv_dbasync_conns.resize(nbconns);
+  hcv_dbasync_started.store(true);
+  hcv_dbasync_thread = std::thread(hcv_dbasync_thread_body);
+  hcv_dbasync_thread.detach();
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_dbasync started with " << nbconns << " connections"
+#ifdef LIBPQ_HAS_PIPELINING
+                << " in pipeline mode"
+#endif /*LIBPQ_HAS_PIPELINING*/
+               );
+} // end hcv_initialize_dbasync
+
+
+/////////// end of file hcv_dbasync.cc in github.com/bstarynk/helpcovid
@@ -46,6 +46,8 @@
 #include <shared_mutex>
 #include <thread>
 #include <condition_variable>
+#include <future>
+#include <tuple>
 #include <atomic>
 #include <stdexcept>
 #include <functional>
@@ -247,6 +249,9 @@ extern "C" void hcv_config_do(const std::function<void(const Glib::KeyFile*)>&do
 
 extern "C" void hcv_load_config_file(const char*configfile=nullptr);
 
+/// incremented at each load of the configuration file, used in cache keys
+extern "C" long hcv_get_config_generation(void);
+
 
 //// get a string in [html] section of configuration file.
 //// if missing, return an empty string.
@@ -254,28 +259,104 @@ extern "C" void hcv_load_config_file(const char*configfile=nullptr);
 extern "C" std::string hcv_get_config_html(const std::string &name);
 ////////////////////////////////////////////////////////////////
 
-class Hcv_PreparedStatement
-{
-public:
-  Hcv_PreparedStatement(const std::string& name);
-  ~Hcv_PreparedStatement();
-
-  void bind(const std::string& arg);
-  void bind(char arg);
-  void bind(std::int64_t arg);
-  pqxx::result query();
+//// PostGreSQL database, used thru a pool of connections, see
+//// [postgresql] pool_size in the configuration file
+extern "C" void hcv_initialize_database(const std::string&uri, bool cleardata);
 
-private:
-  std::string m_name;
-  pqxx::prepare::invocation* m_inv;
-  pqxx::work* m_txn;
+/// the schema is versioned by steps in tb_schema_version, per owner
+/// (our own is "helpcovid"). Plugins register their steps from their
+/// hcvplugin_initialize_database; they are applied just after it. A
+/// non-empty concurrentindex names the index built, outside of any
+/// transaction, by a CREATE INDEX CONCURRENTLY step
+extern "C" void hcv_database_register_migration(const std::string& owner, int step,
+    const std::string& name, const std::string& sql,
+    const std::string& concurrentindex = "");
+
+/// statements are classified as reads, which may run on some replica
+/// of [postgresql] replicas, or writes (including anything which
+/// should see the latest data), which run on the primary
+enum hcv_sql_access_en
+{
+  HCV_SQL_WRITE,
+  HCV_SQL_READ
 };
 
+struct hcv_dbpool_slot_st;	// private to hcv_database.cc
+struct hcv_dbstmt_stats_st;	// private to hcv_database.cc
+
+/// a database connection leased from the pool for the lifetime of this
+/// object, waiting at most timeout seconds (by default [postgresql]
+/// checkout_timeout) for a free one, otherwise throwing some
+/// std::runtime_error. Statements registered with
+/// hcv_database_register_prepared_statement are prepared lazily on
+/// each connection, by the prepare method, before any transaction
+/// (which does nothing in pooler mode).
+class Hcv_database_connection
+{
+  hcv_dbpool_slot_st* _hcvdbc_slot;
+  hcv_sql_access_en _hcvdbc_access;
+  double _hcvdbc_leasewait;
+public:
+  Hcv_database_connection(double timeout = -1.0);
+  /// for HCV_SQL_READ, lease a connection to some replica lagging less
+  /// than [postgresql] replica_max_lag, and than the time elapsed since
+  /// the last write of the current web session; or else to the primary
+  Hcv_database_connection(hcv_sql_access_en access, double timeout = -1.0);
+  ~Hcv_database_connection();
+  Hcv_database_connection(const Hcv_database_connection&) = delete;
+  Hcv_database_connection& operator = (const Hcv_database_connection&) = delete;
+  pqxx::connection& conn() const;
+  void prepare(const std::string& name);
+  /// after some pqxx::broken_connection, reconnect at next lease
+  void mark_broken();
+  /// true when leased on some replica
+  bool on_replica() const;
+  /// the seconds spent waiting for that lease
+  double lease_wait() const
+  {
+    return _hcvdbc_leasewait;
+  };
+};				// end Hcv_database_connection
+
+extern "C" void hcv_database_pool_statistics(long*pnbconnections, long*pnbidle,
+    long*pnbwaits, long*pnbtimeouts, long*pnbreconnects);
+
+/// the web session served by the current thread, for read-your-writes;
+/// 0 for none
+extern "C" void hcv_database_set_session_key(size_t key);
+extern "C" void hcv_database_replica_statistics(long*pnbreplicas, long*pnbreplicareads,
+    long*pnbprimaryreads, double*pmaxlag);
+
+/// every execution of a registered statement is measured, in
+/// histograms of its queue wait, execution time and rows, keyed by
+/// statement name and shown in /status.json. Executions slower than
+/// [postgresql] slow_statement_threshold milliseconds are logged, with
+/// only the size of their parameters.
+extern hcv_dbstmt_stats_st* hcv_database_statement_stats(const std::string& name);
+extern void hcv_database_record_statement_wait(hcv_dbstmt_stats_st* stats, double waittime);
+/// give true if that execution was slow, then its parameters should
+/// be given to hcv_database_log_slow_statement
+extern bool hcv_database_record_statement(hcv_dbstmt_stats_st* stats, double exectime, long nbrows);
+extern void hcv_database_log_slow_statement(hcv_dbstmt_stats_st* stats, double exectime, long nbrows,
+    const std::vector<std::string>& params);
+extern void hcv_database_statement_statistics(Json::Value& jsob);
+
+struct hcv_dbwatch_st;		// private to hcv_database.cc
+/// while a statement runs for a request with a deadline, sets its
+/// statement_timeout and lets a watchdog thread cancel it (by
+/// pg_cancel_backend) when that deadline passes; throws Hcv_deadline_exceeded
+/// if it already passed
+class Hcv_statement_deadline_guard
+{
+  hcv_dbwatch_st* _hcvsdg_watch;
+public:
+  Hcv_statement_deadline_guard(pqxx::transaction_base& transact, const char*stmtname);
+  ~Hcv_statement_deadline_guard();
+  Hcv_statement_deadline_guard(const Hcv_statement_deadline_guard&) = delete;
+  Hcv_statement_deadline_guard& operator = (const Hcv_statement_deadline_guard&) = delete;
+};
+extern "C" void hcv_database_deadline_statistics(long*pnbcancelled);
 
-//// PostGreSQL database
-extern "C" std::unique_ptr<pqxx::connection> hcv_dbconn;
-extern "C" std::recursive_mutex hcv_dbmtx;
-extern "C" void hcv_initialize_database(const std::string&uri, bool cleardata);
 
 extern "C" const std::string hcv_postgresql_version(void);
 
@@ -285,13 +366,261 @@ hcv_database_register_prepared_statement(const std::string& name,
     const std::string& sql);
 
 
-// query if an email is known or not
+// query if an email is known or not; emails are compared in
+// lowercase, and unknown ones are mostly answered by an in-memory
+// filter, see [postgresql] email_filter
 extern "C" bool hcv_database_with_known_email(const std::string&emailstr);
+// add the email of a user just created to that filter
+extern "C" void hcv_database_note_known_email(const std::string&email);
+// add the users created meanwhile, by any process, to that filter,
+// giving the delay before the next refresh; called by the background thread
+extern "C" double hcv_database_refresh_email_filter(void);
+extern "C" void hcv_database_email_filter_statistics(long*pnbemails, long*pnbnegatives,
+    long*pnbconfirmed, long*pnbfalsepositives);
+
+// bulk load users (and their passwords) from a CSV or JSON lines
+// file, streamed by COPY, or write them all; see --import-users and
+// --export-users
+extern "C" void hcv_database_import_users(const std::string& path);
+extern "C" void hcv_database_export_users(const std::string& path);
 
 // INSERT some web cookie in the database, returning its serial
 extern "C" long
 hcv_database_get_id_of_added_web_cookie(const std::string& randomstr,
                                         time_t exptime, int webagenthash);
+
+// web cookie insertions are coalesced in multi-row INSERTs, see
+// [postgresql] cookie_batch_size and cookie_batch_delay
+extern "C" void hcv_database_cookie_batch_statistics(long*pnbflushes, long*pnbinserted);
+
+#define HCV_WEBCOOKIE_RANDOMSTR_WIDTH 24 /* also width of wcookie_random in hcv_database.cc */
+/// a web session, that is a row of tb_web_cookie, also cached in
+/// memory by hcv_web_session_of_request
+struct hcv_web_session_st
+{
+  long hcvsess_id;		// the wcookie_id
+  char hcvsess_random[HCV_WEBCOOKIE_RANDOMSTR_WIDTH+4];
+  time_t hcvsess_exptime;
+  int hcvsess_webagenthash;
+  long hcvsess_userid;		// 0 for an anonymous session
+};
+
+// DELETE one batch of expired web cookies, giving the delay in seconds
+// before the next batch; called by the background thread
+extern "C" double hcv_database_purge_expired_cookies(void);
+extern "C" void hcv_database_purge_statistics(long*pnbpurged, long*pnbpurgedlastminute,
+    long*pbatch, double*plag, long*pnbdroppedpartitions);
+
+// SELECT some web cookie by its id, false if unknown
+extern "C" bool hcv_database_find_web_cookie(long id, hcv_web_session_st*psess);
+
+// the SQL of a statement registered by hcv_database_register_prepared_statement
+extern "C" bool hcv_database_registered_statement_sql(const std::string& name, std::string& sql);
+
+// true with [postgresql] pooler_mode, behind a transaction pooler like
+// PgBouncer: registered statements are not prepared in the server
+// session, but run unnamed with their SQL
+extern "C" bool hcv_database_pooler_mode(void);
+
+// run a registered statement by its name, prepared or not; plugins
+// should use it instead of pqxx exec_prepared
+template <typename... Args>
+pqxx::result hcv_database_exec_registered(pqxx::transaction_base& transact,
+    const std::string& name, const Args&... args)
+{
+  if (!hcv_database_pooler_mode())
+    return transact.exec_prepared(name, args...);
+  std::string sql;
+  if (!hcv_database_registered_statement_sql(name, sql))
+    throw std::runtime_error("unregistered prepared statement " + name);
+  return transact.exec_params(sql, args...);
+} // end hcv_database_exec_registered
+
+
+//// asynchronous database executor, see hcv_dbasync.cc: a few
+//// non-blocking libpq connections, driven by one event loop thread,
+//// on which batches of registered prepared statements are pipelined.
+struct pg_result;		// the PGresult of <libpq-fe.h>
+
+class Hcv_dbasync_result
+{
+  std::shared_ptr<pg_result> _hcvdbar_res;
+  std::string _hcvdbar_error;	// empty when successful
+public:
+  Hcv_dbasync_result(const std::shared_ptr<pg_result>&res, const std::string&err)
+    : _hcvdbar_res(res), _hcvdbar_error(err) {};
+  Hcv_dbasync_result(const std::string&err)
+    : _hcvdbar_res(nullptr), _hcvdbar_error(err) {};
+  bool ok() const
+  {
+    return _hcvdbar_error.empty();
+  };
+  const std::string& error_message() const
+  {
+    return _hcvdbar_error;
+  };
+  int nb_rows() const;
+  int nb_columns() const;
+  bool is_null(int row, int col) const;
+  /// the text value of some field, or an empty string if null
+  const char* value(int row, int col) const;
+  long affected_rows() const;
+};				// end Hcv_dbasync_result
+
+struct hcv_dbasync_stmt_st
+{
+  std::string hcvdbas_name;	// a registered prepared statement
+  std::vector<std::string> hcvdbas_params; // in text format
+};
+
+typedef std::function<void(std::vector<Hcv_dbasync_result>&)> hcv_dbasync_callback_t;
+
+/// submit a batch of statements, run in that order on the same
+/// connection, in one round trip and in one implicit transaction. The
+/// callback gets one result per statement. It runs in the executor
+/// thread, so should be quick and never wait for the database. When
+/// the request deadline of the submitting thread passes before the
+/// batch is sent, its statements fail without running.
+extern void hcv_dbasync_submit(std::vector<hcv_dbasync_stmt_st> stmts,
+                               const hcv_dbasync_callback_t& callback);
+/// likewise, but the results are given by a future, e.g. for a view
+/// which submits several batches then waits for all of them
+extern std::future<std::vector<Hcv_dbasync_result>>
+    hcv_dbasync_submit_future(std::vector<hcv_dbasync_stmt_st> stmts);
+
+/// called by hcv_initialize_database, see [postgresql] async_connections
+extern "C" void hcv_initialize_dbasync(const std::string& connstr);
+extern "C" bool hcv_dbasync_enabled(void);
+extern "C" void hcv_dbasync_statistics(long*pnbsubmitted, long*pnbcompleted,
+                                       long*pnbconnections);
+
+
+//// typed prepared statements, whose parameter and result column types
+//// are checked at compile time. Each is registered once by
+//// hcv_prepare_statements_in_database, and runs on a stack allocated
+//// transaction of a leased connection, e.g.
+////
+////   Hcv_database_connection dbconn;
+////   hcv_user_create_stmt.prepare(dbconn);
+////   pqxx::work transact(dbconn.conn());
+////   hcv_user_create_stmt_t::row_type row;
+////   if (hcv_user_create_stmt.exec1(transact, row, first, family, email, gender)) ...
+template <typename... Params> struct hcv_sql_params {};
+template <typename... Columns> struct hcv_sql_row {};
+
+template <typename ParamsT, typename RowT> class Hcv_statement;
+
+static inline double hcv_monotonic_real_time(void);
+
+template <typename... Params, typename... Columns>
+class Hcv_statement<hcv_sql_params<Params...>, hcv_sql_row<Columns...>>
+{
+  const char* _hcvstmt_name;
+  const char* _hcvstmt_sql;
+  hcv_sql_access_en _hcvstmt_access;
+  mutable std::atomic<hcv_dbstmt_stats_st*> _hcvstmt_stats; // set when registered
+  template <std::size_t... Ix>
+  static std::tuple<Columns...> row_tuple(const pqxx::row& row, std::index_sequence<Ix...>)
+  {
+    return std::tuple<Columns...>(row[(int)Ix].template as<Columns>()...);
+  };
+  void record(double starttime, long nbrows, const Params&... args) const
+  {
+    double exectime = hcv_monotonic_real_time() - starttime;
+    hcv_dbstmt_stats_st* stats = _hcvstmt_stats.load(std::memory_order_relaxed);
+    if (stats && hcv_database_record_statement(stats, exectime, nbrows))
+      hcv_database_log_slow_statement(stats, exectime, nbrows,
+                                      std::vector<std::string> {pqxx::to_string(args)...});
+  };
+  pqxx::result run(pqxx::transaction_base& transact, const Params&... args) const
+  {
+    if (hcv_database_pooler_mode())
+      return transact.exec_params(_hcvstmt_sql, args...);
+    return transact.exec_prepared(_hcvstmt_name, args...);
+  };
+public:
+  typedef std::tuple<Columns...> row_type;
+  constexpr Hcv_statement(const char*name, const char*sql,
+                          hcv_sql_access_en access = HCV_SQL_WRITE)
+    : _hcvstmt_name(name), _hcvstmt_sql(sql), _hcvstmt_access(access),
+      _hcvstmt_stats(nullptr) {};
+  const char* name() const
+  {
+    return _hcvstmt_name;
+  };
+  const char* sql() const
+  {
+    return _hcvstmt_sql;
+  };
+  /// to lease its connection, e.g. Hcv_database_connection dbconn(stmt.access());
+  hcv_sql_access_en access() const
+  {
+    return _hcvstmt_access;
+  };
+  void register_statement() const
+  {
+    hcv_database_register_prepared_statement(_hcvstmt_name, _hcvstmt_sql);
+    _hcvstmt_stats.store(hcv_database_statement_stats(_hcvstmt_name));
+  };
+  /// on a leased connection, before starting any transaction
+  void prepare(Hcv_database_connection& dbconn) const
+  {
+    dbconn.prepare(_hcvstmt_name);
+    hcv_dbstmt_stats_st* stats = _hcvstmt_stats.load(std::memory_order_relaxed);
+    if (stats)
+      hcv_database_record_statement_wait(stats, dbconn.lease_wait());
+  };
+  /// run a statement without result columns, giving the number of affected rows
+  long exec0(pqxx::transaction_base& transact, const Params&... args) const
+  {
+    static_assert(sizeof...(Columns) == 0, "Hcv_statement::exec0 needs no result column");
+    Hcv_statement_deadline_guard guard(transact, _hcvstmt_name);
+    double starttime = hcv_monotonic_real_time();
+    long nbrows = (long) run(transact, args...).affected_rows();
+    record(starttime, nbrows, args...);
+    return nbrows;
+  };
+  /// fill the first row of the result, or give false without any row
+  bool exec1(pqxx::transaction_base& transact, row_type& row, const Params&... args) const
+  {
+    Hcv_statement_deadline_guard guard(transact, _hcvstmt_name);
+    double starttime = hcv_monotonic_real_time();
+    pqxx::result res = run(transact, args...);
+    record(starttime, (long) res.size(), args...);
+    if (res.empty())
+      return false;
+    row = row_tuple(res[0], std::index_sequence_for<Columns...>());
+    return true;
+  };
+  /// apply some function to the columns of every row of the result
+  template <typename Fun>
+  void for_each(pqxx::transaction_base& transact, Fun fun, const Params&... args) const
+  {
+    Hcv_statement_deadline_guard guard(transact, _hcvstmt_name);
+    double starttime = hcv_monotonic_real_time();
+    pqxx::result res = run(transact, args...);
+    record(starttime, (long) res.size(), args...);
+    for (auto rowit : res)
+      std::apply(fun, row_tuple(rowit, std::index_sequence_for<Columns...>()));
+  };
+  /// the same statement, for the asynchronous executor
+  hcv_dbasync_stmt_st async_stmt(const Params&... args) const
+  {
+    return hcv_dbasync_stmt_st{_hcvstmt_name, {pqxx::to_string(args)...}};
+  };
+};				// end Hcv_statement
+
+typedef Hcv_statement<hcv_sql_params<std::string,std::string,std::string,std::string>,
+        hcv_sql_row<long>> hcv_user_create_stmt_t;
+extern const hcv_user_create_stmt_t hcv_user_create_stmt;
+
+typedef Hcv_statement<hcv_sql_params<std::string>,
+        hcv_sql_row<std::string>> hcv_user_get_password_by_email_stmt_t;
+extern const hcv_user_get_password_by_email_stmt_t hcv_user_get_password_by_email_stmt;
+
+typedef Hcv_statement<hcv_sql_params<std::string,std::string>,
+        hcv_sql_row<>> hcv_user_add_password_stmt_t;
+extern const hcv_user_add_password_stmt_t hcv_user_add_password_stmt;
 ////////////////////////////////////////////////////////////////
 
 //// Web service
@@ -320,6 +649,14 @@ extern "C" void hcv_webserver_run(void);
 
 extern "C" void hcv_output_encoded_html(std::ostream&out, const std::string&str);
 extern "C" void hcv_output_cstr_encoded_html(std::ostream&out, const char*cstr);
+extern "C" void hcv_output_encoded_html_buffer(std::ostream&out, const char*buf, size_t len);
+/// append to outstr the HTML encoding of some buffer
+extern "C" void hcv_append_encoded_html(std::string&outstr, const char*buf, size_t len);
+/// check of the SIMD encoders against the byte per byte one, fatal
+/// on failure; run at every start, exhaustive when debugging
+extern "C" void hcv_check_encoded_html(bool exhaustive);
+/// nanoseconds per input byte of HTML encoding, see hcv_web.cc
+extern "C" double hcv_benchmark_encoded_html(bool withref, long nbrepeat);
 
 extern "C" std::string hcv_get_web_root(void);
 
@@ -332,8 +669,23 @@ extern "C" std::string hcv_get_web_root(void);
 
 /// return a string, perhaps 0123-9wI1QOXiH0M03Pf1ef14ab69-1abc4, for a fresh web cookie for HCV_COOKIE_NAME
 extern "C" std::string hcv_web_register_fresh_cookie(Hcv_http_template_data*);
+/// likewise, but always kept in the database, even with [web]
+/// cookie_mode=signed, e.g. for an authenticated user
+extern "C" std::string hcv_web_register_persistent_cookie(Hcv_http_template_data*);
 /// forget our HCV_COOKIE_NAME cookie
 extern "C" void hcv_web_forget_cookie(Hcv_http_template_data*htpl);
+/// replace the HMAC key of signed cookies, giving the delay in seconds
+/// before the next rotation; called by the background thread
+extern "C" double hcv_web_rotate_cookie_key(void);
+
+/// authenticate a request by its HCV_COOKIE_NAME cookie, with one
+/// lookup in a sharded in-memory session table, which is read through
+/// to the database on a miss. Return false for a missing, forged or
+/// expired cookie, else fill *psess if given
+extern "C" bool hcv_web_session_of_request(const httplib::Request&req, hcv_web_session_st*psess);
+/// remove expired sessions from memory, called by the background thread
+extern "C" void hcv_web_expire_sessions(void);
+extern "C" void hcv_web_session_statistics(long*pnbsessions, long*pnbhits, long*pnbmisses);
 
 ////////////////////////////////////////////////////////////////
 
@@ -343,6 +695,136 @@ extern "C" void hcv_web_forget_cookie(Hcv_http_template_data*htpl);
 
 extern "C" const unsigned hcv_max_template_size;
 
+//// message catalogs from webroot/i18n/helpcovid.<lang>.po files, see
+//// hcv_i18n.cc; a language index is -1 for the literal texts of
+//// templates, and a slot is -1 for an unknown msgid
+extern "C" void hcv_initialize_messages(void);
+extern "C" int hcv_message_slot(const char*msgid);
+/// the translation of some slot, or null if untranslated
+extern "C" const char* hcv_message_text(int langix, int slot);
+/// the language index from some Accept-Language HTTP header
+extern "C" int hcv_negotiate_language(const char*acceptlang);
+extern "C" const char* hcv_language_name(int langix);
+
+//// row data for <?hcv foreach rows?> ... <?hcv end?> loops of
+//// templates: inside the loop body, <?hcv cell column?> outputs the
+//// HTML encoding of a cell of the current row, and <?hcv if column?>
+//// tests it. Columns are resolved once when entering the loop.
+class Hcv_template_rows
+{
+public:
+  virtual ~Hcv_template_rows() {};
+  virtual size_t nb_rows() const =0;
+  /// the index of some column, or -1 if it is unknown
+  virtual int column_index(const std::string&colname) const =0;
+  /// output the HTML encoding of some cell
+  virtual void output_cell(std::ostream&out, size_t rowix, int colix) const =0;
+  /// a cell is false if it is null, empty, "0" or "f"
+  virtual bool cell_is_true(size_t rowix, int colix) const =0;
+};				// end Hcv_template_rows
+
+
+/// rows of some PostGreSQL query result, whose columns are named
+/// like in the SELECT
+class Hcv_pqxx_template_rows : public Hcv_template_rows
+{
+  const pqxx::result& _hcvpqrows_res;
+public:
+  Hcv_pqxx_template_rows(const pqxx::result& res) : _hcvpqrows_res(res) {};
+  virtual ~Hcv_pqxx_template_rows() {};
+  virtual size_t nb_rows() const
+  {
+    return _hcvpqrows_res.size();
+  };
+  virtual int column_index(const std::string&colname) const
+  {
+    try
+      {
+        return (int) _hcvpqrows_res.column_number(colname);
+      }
+    catch (std::exception&)
+      {
+        return -1;
+      }
+  };
+  virtual void output_cell(std::ostream&out, size_t rowix, int colix) const
+  {
+    const pqxx::field fld = _hcvpqrows_res[(pqxx::result::size_type)rowix][(pqxx::row::size_type)colix];
+    if (!fld.is_null())
+      hcv_output_encoded_html_buffer(out, fld.c_str(), fld.size());
+  };
+  virtual bool cell_is_true(size_t rowix, int colix) const
+  {
+    const pqxx::field fld = _hcvpqrows_res[(pqxx::result::size_type)rowix][(pqxx::row::size_type)colix];
+    if (fld.is_null() || fld.size() == 0)
+      return false;
+    return strcmp(fld.c_str(), "0") && strcmp(fld.c_str(), "f");
+  };
+};				// end Hcv_pqxx_template_rows
+
+
+/// rows of some vector of structures, with named columns being either
+/// std::string members or functions of the row
+template <typename RowT> class Hcv_vector_template_rows : public Hcv_template_rows
+{
+public:
+  typedef std::function<std::string(const RowT&)> column_function_t;
+private:
+  typedef std::variant<std::string RowT::*, column_function_t> column_t;
+  const std::vector<RowT>& _hcvvecrows_vec;
+  std::vector<std::pair<std::string,column_t>> _hcvvecrows_columns;
+  static bool string_is_true(const std::string&str)
+  {
+    return !str.empty() && str != "0" && str != "f";
+  };
+public:
+  Hcv_vector_template_rows(const std::vector<RowT>& vec) : _hcvvecrows_vec(vec), _hcvvecrows_columns() {};
+  virtual ~Hcv_vector_template_rows() {};
+  Hcv_vector_template_rows& add_column(const std::string&colname, std::string RowT::*memb)
+  {
+    _hcvvecrows_columns.push_back({colname, column_t(memb)});
+    return *this;
+  };
+  Hcv_vector_template_rows& add_column(const std::string&colname, const column_function_t&fun)
+  {
+    _hcvvecrows_columns.push_back({colname, column_t(fun)});
+    return *this;
+  };
+  virtual size_t nb_rows() const
+  {
+    return _hcvvecrows_vec.size();
+  };
+  virtual int column_index(const std::string&colname) const
+  {
+    for (unsigned colix=0; colix<_hcvvecrows_columns.size(); colix++)
+      if (_hcvvecrows_columns[colix].first == colname)
+        return (int)colix;
+    return -1;
+  };
+  virtual void output_cell(std::ostream&out, size_t rowix, int colix) const
+  {
+    const column_t& col = _hcvvecrows_columns[colix].second;
+    if (auto pmemb = std::get_if<std::string RowT::*>(&col))
+      {
+        const std::string& str = _hcvvecrows_vec[rowix].*(*pmemb);
+        hcv_output_encoded_html_buffer(out, str.data(), str.size());
+      }
+    else
+      {
+        std::string str = std::get<column_function_t>(col)(_hcvvecrows_vec[rowix]);
+        hcv_output_encoded_html_buffer(out, str.data(), str.size());
+      }
+  };
+  virtual bool cell_is_true(size_t rowix, int colix) const
+  {
+    const column_t& col = _hcvvecrows_columns[colix].second;
+    if (auto pmemb = std::get_if<std::string RowT::*>(&col))
+      return string_is_true(_hcvvecrows_vec[rowix].*(*pmemb));
+    return string_is_true(std::get<column_function_t>(col)(_hcvvecrows_vec[rowix]));
+  };
+};				// end Hcv_vector_template_rows
+
+
 class Hcv_template_data
 {
 protected:
@@ -358,20 +840,57 @@ public:
   };
   virtual std::ostream* output_stream() const =0;
   virtual long serial() const =0;
+  /// grow the output buffer ahead, e.g. to the high-water mark of the
+  /// template, see hcv_template_high_water
+  virtual void reserve_output(size_t sz HCV_UNUSED)
+  {
+  };
 private:
   const TmplKind_en _hcvt_kind;
+  /// row data for <?hcv foreach name?>, owned by the view
+  std::map<std::string, const Hcv_template_rows*> _hcvt_rows;
+  /// flags for <?hcv if name?>
+  std::map<std::string, bool> _hcvt_conditions;
 protected:
   Hcv_template_data(TmplKind_en knd)
-    : _hcvt_kind(knd)
+    : _hcvt_kind(knd), _hcvt_rows(), _hcvt_conditions()
   {
     if (knd == TmplKind_en::hcvtk_none)
       HCV_FATALOUT("no kind in Hcv_template_data @" << (void*)this);
   };
+  void clear_template_data(void)
+  {
+    _hcvt_rows.clear();
+    _hcvt_conditions.clear();
+  };
 public:
   TmplKind_en kind() const
   {
     return _hcvt_kind;
   };
+  void set_template_rows(const std::string&name, const Hcv_template_rows*rows)
+  {
+    _hcvt_rows[name] = rows;
+  };
+  const Hcv_template_rows* template_rows(const std::string&name) const
+  {
+    auto it = _hcvt_rows.find(name);
+    return (it == _hcvt_rows.end())?nullptr:it->second;
+  };
+  void set_template_condition(const std::string&name, bool flag)
+  {
+    _hcvt_conditions[name] = flag;
+  };
+  /// return true and set *pflag if the condition name is known
+  bool template_condition(const std::string&name, bool*pflag) const
+  {
+    auto it = _hcvt_conditions.find(name);
+    if (it == _hcvt_conditions.end())
+      return false;
+    if (pflag)
+      *pflag = it->second;
+    return true;
+  };
 };				// end of Hcv_template_data
 
 
@@ -385,13 +904,18 @@ protected:
   long _hcvhttp_reqnum;
   mutable std::ostringstream _hcvhttp_outs;
   std::string _hcvhttp_cookie_header;
+  std::string _hcvhttp_user_segment; // empty for anonymous requests
+  mutable int _hcvhttp_langix;	// -2 until negotiated
+  size_t _hcvhttp_outcapacity;	// reserved size of _hcvhttp_outs
 public:
   Hcv_http_template_data(const httplib::Request& req, httplib::Response&resp, long reqnum)
     : Hcv_template_data(TmplKind_en::hcvtk_http),
       _hcvhttp_request(&req),
       _hcvhttp_response(&resp),
       _hcvhttp_reqnum(reqnum),
-      _hcvhttp_outs()
+      _hcvhttp_outs(),
+      _hcvhttp_langix(-2),
+      _hcvhttp_outcapacity(0)
   {
   };
 protected:
@@ -400,7 +924,9 @@ protected:
       _hcvhttp_request(&req),
       _hcvhttp_response(&resp),
       _hcvhttp_reqnum(reqnum),
-      _hcvhttp_outs()
+      _hcvhttp_outs(),
+      _hcvhttp_langix(-2),
+      _hcvhttp_outcapacity(0)
   {
   };
 public:
@@ -430,6 +956,36 @@ public:
     else
       return "";
   };
+  //
+  /// the user segment keys the cache of fragments included with
+  /// <?hcv include fragment per_user?>, e.g. some user role
+  const std::string& user_segment() const
+  {
+    return _hcvhttp_user_segment;
+  };
+  void set_user_segment(const std::string&seg)
+  {
+    _hcvhttp_user_segment = seg;
+  };
+  //
+  /// the index of the message catalog negotiated from the
+  /// Accept-Language header, see hcv_negotiate_language
+  int language_index() const
+  {
+    if (_hcvhttp_langix < -1)
+      {
+        _hcvhttp_langix = hcv_negotiate_language
+                          (_hcvhttp_request
+                           ?_hcvhttp_request->get_header_value("Accept-Language").c_str()
+                           :nullptr);
+        if (_hcvhttp_response)
+          {
+            _hcvhttp_response->set_header("Content-Language", hcv_language_name(_hcvhttp_langix));
+            _hcvhttp_response->set_header("Vary", "Accept-Language");
+          }
+      }
+    return _hcvhttp_langix;
+  };
   virtual std::ostream* output_stream() const
   {
     return &_hcvhttp_outs;
@@ -438,6 +994,32 @@ public:
   {
     return _hcvhttp_reqnum;
   };
+  /// the output string keeps its capacity when reset by str(""), so
+  /// assigning a long string once grows it for all later requests
+  virtual void reserve_output(size_t sz)
+  {
+    if (sz <= _hcvhttp_outcapacity)
+      return;
+    std::string curout = _hcvhttp_outs.str();
+    _hcvhttp_outs.str(std::string(sz, ' '));
+    _hcvhttp_outs.str(curout);
+    _hcvhttp_outs.seekp(0, std::ios_base::end);
+    _hcvhttp_outcapacity = sz;
+  };
+  /// reuse this template data for another request, keeping the
+  /// capacity of its output, see Hcv_http_render_context
+  void reset(const httplib::Request* req, httplib::Response* resp, long reqnum)
+  {
+    _hcvhttp_request = req;
+    _hcvhttp_response = resp;
+    _hcvhttp_reqnum = reqnum;
+    _hcvhttp_outs.str("");
+    _hcvhttp_outs.clear();
+    _hcvhttp_cookie_header.clear();
+    _hcvhttp_user_segment.clear();
+    _hcvhttp_langix = -2;
+    clear_template_data();
+  };
   const httplib::Request*request() const
   {
     return _hcvhttp_request;
@@ -481,6 +1063,29 @@ public:
 };				// end of Hcv_https_template_data
 
 
+/// a render context leases some Hcv_http_template_data from a small
+/// per-thread pool, so the output buffers of the worker threads keep
+/// their capacity across requests; see hcv_web.cc
+class Hcv_http_render_context
+{
+  Hcv_http_template_data* _hcvrctx_data;
+public:
+  Hcv_http_render_context(const httplib::Request& req, httplib::Response&resp, long reqnum);
+  ~Hcv_http_render_context();
+  Hcv_http_render_context(const Hcv_http_render_context&) = delete;
+  Hcv_http_render_context& operator = (const Hcv_http_render_context&) = delete;
+  Hcv_http_template_data* get() const
+  {
+    return _hcvrctx_data;
+  };
+  Hcv_http_template_data* operator -> () const
+  {
+    return _hcvrctx_data;
+  };
+};				// end Hcv_http_render_context
+
+extern "C" void hcv_render_context_statistics(long*pnbcreated, long*pnbreused);
+
 #warning TODO: add class Hcv_websocket_template_data
 #if 0
 class Hcv_websocket_template_data : public Hcv_template_data
@@ -552,6 +1157,11 @@ typedef std::function<void(Hcv_template_data*templdata, const std::string &proci
 // the name should be like a C identifier
 extern "C" void hcv_register_template_expander_closure(const std::string&name, const hcv_template_expanding_closure_t&expfun);
 
+/// register an expander whose expansion depends only on the
+/// template, the language and the configuration, so can be kept in the
+/// page cache; other expanders are "holes" expanded on every request
+extern "C" void hcv_register_cacheable_template_expander_closure(const std::string&name, const hcv_template_expanding_closure_t&expfun);
+
 extern "C" void hcv_forget_template_expander(const std::string&name);
 
 extern "C" void
@@ -559,6 +1169,48 @@ hcv_expand_processing_instruction(Hcv_template_data*templdata, const std::string
 
 extern "C" void hcv_initialize_templates(void);
 
+//// page cache for anonymous GET pages, see [web] page_cache_ttl in
+//// configuration: expand the template file like
+//// hcv_expand_template_file, but reuse a recent expansion of its
+//// cacheable parts
+extern "C" std::string hcv_expand_cached_template_file(const std::string& filepath,Hcv_template_data*templdata);
+extern "C" void hcv_invalidate_page_cache(void);
+/// the biggest expansion of some template file, in bytes
+extern "C" size_t hcv_template_high_water(const std::string& filepath);
+extern "C" void hcv_page_cache_statistics(long*phits, long*pmisses, long*pnbpages);
+
+//// fragment cache for <?hcv include fragment?> and <?hcv include
+//// fragment per_user?>, see [web] fragment_cache_ttl in
+//// configuration; fragment paths are relative to the web root
+extern "C" void hcv_fragment_cache_statistics(long*phits, long*pmisses, long*pnbfragments);
+
+//// error pages, planned once from html/error.html under the web root
+//// (or else from builtinsrc) and cached per status code and language,
+//// see <?hcv response_status?>
+extern "C" std::string hcv_expand_error_page(int status, const char*builtinsrc, Hcv_template_data*templdata);
+extern "C" void hcv_error_page_cache_statistics(long*phits, long*pmisses, long*pnbpages);
+
+//// compiled templates, generated by generate-templates.py into
+//// __compiled_templates.cc (see `make compiled-templates`). A
+//// compiled template is a table of parts, each being some literal
+//// text or some whole <?hcv ...?> processing instruction, registered
+//// before main with the size and FNV-1a hash of its source file
+//// relative to the web root.
+struct Hcv_template_part
+{
+  const char* tpart_text;	// literal text or processing instruction
+  unsigned tpart_len;		// its length in bytes
+  bool tpart_is_pi;		// true for a <?hcv ...?> part
+  int tpart_lineno;		// line number in source file
+  long tpart_offset;		// offset of that line in source file
+};
+
+extern "C" void hcv_register_compiled_template(const char*relpath, long srcsize, uint64_t srchash,
+    const Hcv_template_part*parts, unsigned nbparts);
+
+/// the FNV-1a 64 bits hash, also computed by generate-templates.py
+extern "C" uint64_t hcv_template_source_hash(const char*buf, size_t len);
+
 ////////////////////////////////////////////////////////////////
 //////////////// timing functions
 // see http://man7.org/linux/man-pages/man2/clock_gettime.2.html
@@ -601,6 +1253,88 @@ hcv_thread_cpu_time(void)
   return 1.0*ts.tv_sec + 1.0e-9*ts.tv_nsec;
 } // end hcv_thread_cpu_time
 
+
+//////////////// request deadlines
+//// every web request gets a deadline from the budget of its route, see
+//// [web] request_deadline. Database statements then run with a
+//// statement_timeout and are cancelled when it passes, and template
+//// expansion stops, so the request gives an error page.
+class Hcv_deadline_exceeded : public std::runtime_error
+{
+public:
+  Hcv_deadline_exceeded(const std::string& where)
+    : std::runtime_error("request deadline exceeded in " + where) {};
+};
+
+/// monotonic time of the deadline of the current thread, or 0 for none
+extern thread_local double hcv_request_deadline_time;
+
+/// set the deadline of the current thread, budget seconds from now;
+/// none when budget is not positive
+extern "C" void hcv_set_request_deadline(double budget);
+
+/// remaining seconds, HUGE_VAL without any deadline
+static inline double
+hcv_request_remaining_time(void)
+{
+  if (hcv_request_deadline_time <= 0.0)
+    return HUGE_VAL;
+  return hcv_request_deadline_time - hcv_monotonic_real_time();
+} // end hcv_request_remaining_time
+
+static inline void
+hcv_check_request_deadline(const char*where)
+{
+  if (hcv_request_deadline_time > 0.0
+      && hcv_monotonic_real_time() >= hcv_request_deadline_time)
+    throw Hcv_deadline_exceeded(where);
+} // end hcv_check_request_deadline
+
+/// see hcv_web.cc, better used thru Hcv_web_request_scope below
+extern "C" void hcv_web_begin_request(const httplib::Request&req, const char*route);
+extern "C" void hcv_web_end_request(bool throwing);
+
+/// the scope of a web request in its httplib handler: sets the
+/// deadline of the route and the database session key of the request
+/// on the worker thread, and clears both when the handler returns or
+/// throws. Every handler, plugins' ones too, should start with one.
+class Hcv_web_request_scope
+{
+public:
+  Hcv_web_request_scope(const httplib::Request&req, const char*route)
+  {
+    hcv_web_begin_request(req, route);
+  };
+  ~Hcv_web_request_scope()
+  {
+    hcv_web_end_request(std::uncaught_exceptions() > 0);
+  };
+  Hcv_web_request_scope(const Hcv_web_request_scope&) = delete;
+  Hcv_web_request_scope& operator = (const Hcv_web_request_scope&) = delete;
+};
+
+//////////////// password hashing, see hcv_passwd.cc
+//// passwords are hashed with crypt(3), on [helpcovid]
+//// password_hash_threads dedicated threads. When password_hash_queue
+//// hashes are already waiting, a new one is refused by throwing:
+class Hcv_password_overloaded : public std::runtime_error
+{
+public:
+  Hcv_password_overloaded()
+    : std::runtime_error("too many password hashes queued") {};
+};
+
+extern "C" void hcv_initialize_password_hashing(void);
+/// true for a well formed $6$, $5$ or $2b$ crypt(3) hash
+extern bool hcv_password_is_hash(const std::string& encrypted);
+/// give the encrypted password, as $6$rounds=N$salt$hash
+extern std::future<std::string> hcv_password_hash(const std::string& passwd);
+/// an empty encrypted password, for an unknown user, is never
+/// verified but costs the same time; a failure of crypt(3) gives false
+extern std::future<bool> hcv_password_verify(const std::string& passwd,
+    const std::string& encrypted);
+extern "C" void hcv_password_statistics(long*pnbdone, long*pnbrejected, long*pnbqueued);
+
 ///////////////////////////////////////////////////////////////////////////////
 // random numbers - shameless copied from code of http://refpersys.org/
 
@@ -771,6 +1505,12 @@ hcv_user_model_validate(const hcv_user_model& model, hcv_user_model& status);
 extern "C" bool
 hcv_user_model_create(const hcv_user_model& model, hcv_user_model& status);
 
+/// the encrypted password is read at once, then verified on the
+/// password hashing threads; may throw Hcv_password_overloaded
+extern std::future<bool>
+hcv_user_model_authenticate_async(const std::string& email,
+                                  const std::string& passwd);
+
 extern "C" bool
 hcv_user_model_authenticate(const std::string& email,
                             const std::string& passwd);
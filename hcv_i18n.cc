@@ -0,0 +1,387 @@
+/****************************************************************
+ * file hcv_i18n.cc
+ *
+ * Description:
+ *      Message catalogs of https://github.com/bstarynk/helpcovid
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+
+extern "C" const char hcv_i18n_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_i18n_date[] = __DATE__;
+
+//// The message catalogs are the webroot/i18n/helpcovid.<lang>.po
+//// files written by generate-i18n.py and then translated. They are
+//// all loaded once by hcv_initialize_messages, before any template
+//// is planned, and are read-only afterwards, so used without
+//// locking. Every msgid of any catalog gets a slot, found by a
+//// minimal perfect hash, and each catalog is a vector of translations
+//// indexed by slot, so <?hcv msg ...?> of a template plan is bound to
+//// its slot once, and expanded by indexing the catalog of the
+//// language negotiated for the request.
+
+struct hcv_message_catalog_st
+{
+  std::string hcvmcat_lang;	// lower case, like "fr" or "fr-ca"
+  std::string hcvmcat_path;
+  /// indexed by slot, empty when untranslated
+  std::vector<std::string> hcvmcat_texts;
+};
+
+static std::vector<hcv_message_catalog_st> hcv_message_catalogs;
+/// the msgid of each slot
+static std::vector<std::string> hcv_message_msgids;
+/// the displacement seed of every bucket of the perfect hash
+static std::vector<uint32_t> hcv_message_seeds;
+/// the catalog used when Accept-Language gives nothing better, or -1
+static int hcv_default_language_index = -1;
+
+/// the language of the literal texts in webroot/html/ templates
+#define HCV_TEMPLATE_LANGUAGE "en"
+#define HCV_MESSAGE_BUCKET_LOAD 4
+
+static inline uint32_t
+hcv_message_hash(const char*str, size_t len, uint32_t seed)
+{
+  /// 32 bits FNV-1a, whose offset basis is perturbed by the seed
+  uint32_t h = 0x811c9dc5u ^ (seed * 0x9e3779b9u);
+  for (size_t ix=0; ix<len; ix++)
+    {
+      h ^= (unsigned char) str[ix];
+      h *= 0x01000193u;
+    }
+  return h;
+} // end hcv_message_hash
+
+
+/// build the perfect hash by hash and displace: the msgids are
+/// dispatched into buckets, and the biggest buckets first get the
+/// smallest seed putting all their msgids into free slots
+static void
+hcv_build_message_perfect_hash(const std::set<std::string>&msgidset)
+{
+  size_t nbkeys = msgidset.size();
+  hcv_message_msgids.clear();
+  hcv_message_seeds.clear();
+  if (nbkeys == 0)
+    return;
+  size_t nbbuckets = nbkeys/HCV_MESSAGE_BUCKET_LOAD + 1;
+  std::vector<std::vector<const std::string*>> buckets(nbbuckets);
+  for (const std::string& msgid: msgidset)
+    buckets[hcv_message_hash(msgid.data(), msgid.size(), 0) % nbbuckets].push_back(&msgid);
+  std::vector<size_t> order(nbbuckets);
+  for (size_t bix=0; bix<nbbuckets; bix++)
+    order[bix] = bix;
+  std::stable_sort(order.begin(), order.end(), [&](size_t l, size_t r)
+  {
+    return buckets[l].size() > buckets[r].size();
+  });
+  std::vector<const std::string*> slots(nbkeys, nullptr);
+  hcv_message_seeds.assign(nbbuckets, 0);
+  for (size_t bix: order)
+    {
+      const auto& bucket = buckets[bix];
+      if (bucket.empty())
+        break;
+      for (uint32_t seed=1; ; seed++)
+        {
+          if (HCV_UNLIKELY(seed > 100*1000*1000))
+            HCV_FATALOUT("hcv_build_message_perfect_hash failed for " << nbkeys << " msgids");
+          std::vector<size_t> tried;
+          bool ok = true;
+          for (const std::string* pmsgid: bucket)
+            {
+              size_t slot = hcv_message_hash(pmsgid->data(), pmsgid->size(), seed) % nbkeys;
+              if (slots[slot] || std::find(tried.begin(), tried.end(), slot) != tried.end())
+                {
+                  ok = false;
+                  break;
+                }
+              tried.push_back(slot);
+            }
+          if (!ok)
+            continue;
+          for (unsigned kix=0; kix<bucket.size(); kix++)
+            slots[tried[kix]] = bucket[kix];
+          hcv_message_seeds[bix] = seed;
+          break;
+        }
+    }
+  hcv_message_msgids.resize(nbkeys);
+  for (size_t slot=0; slot<nbkeys; slot++)
+    hcv_message_msgids[slot] = *slots[slot];
+} // end hcv_build_message_perfect_hash
+
+
+int
+hcv_message_slot(const char*msgid)
+{
+  if (!msgid || hcv_message_msgids.empty())
+    return -1;
+  size_t len = strlen(msgid);
+  size_t nbbuckets = hcv_message_seeds.size();
+  uint32_t seed = hcv_message_seeds[hcv_message_hash(msgid, len, 0) % nbbuckets];
+  if (seed == 0)
+    return -1;
+  size_t slot = hcv_message_hash(msgid, len, seed) % hcv_message_msgids.size();
+  if (hcv_message_msgids[slot] != msgid)
+    return -1;
+  return (int)slot;
+} // end hcv_message_slot
+
+
+const char*
+hcv_message_text(int langix, int slot)
+{
+  if (langix < 0 || langix >= (int)hcv_message_catalogs.size()
+      || slot < 0 || slot >= (int)hcv_message_msgids.size())
+    return nullptr;
+  const std::string& text = hcv_message_catalogs[langix].hcvmcat_texts[slot];
+  return text.empty()?nullptr:text.c_str();
+} // end hcv_message_text
+
+
+const char*
+hcv_language_name(int langix)
+{
+  if (langix < 0 || langix >= (int)hcv_message_catalogs.size())
+    return HCV_TEMPLATE_LANGUAGE;
+  return hcv_message_catalogs[langix].hcvmcat_lang.c_str();
+} // end hcv_language_name
+
+
+static int
+hcv_find_language(const std::string&lang)
+{
+  for (int lix=0; lix<(int)hcv_message_catalogs.size(); lix++)
+    if (hcv_message_catalogs[lix].hcvmcat_lang == lang)
+      return lix;
+  return -1;
+} // end hcv_find_language
+
+
+/// see https://tools.ietf.org/html/rfc7231#section-5.3.5 ; return
+/// the index of the catalog of the preferred language, or -1 for the
+/// literal texts of templates
+int
+hcv_negotiate_language(const char*acceptlang)
+{
+  if (!acceptlang || !acceptlang[0] || hcv_message_catalogs.empty())
+    return hcv_default_language_index;
+  /// parse the language ranges with their quality
+  std::vector<std::pair<double,std::string>> ranges;
+  const char*pc = acceptlang;
+  while (*pc)
+    {
+      while (*pc == ' ' || *pc == ',')
+        pc++;
+      std::string lang;
+      while (*pc && *pc != ',' && *pc != ';' && *pc != ' ')
+        lang.push_back((char)tolower(*pc++));
+      double quality = 1.0;
+      while (*pc && *pc != ',')
+        {
+          if (*pc == ';')
+            {
+              while (*++pc == ' ')
+                continue;
+              if (pc[0] == 'q' && pc[1] == '=')
+                quality = atof(pc+2);
+            }
+          else
+            pc++;
+        }
+      if (!lang.empty() && quality > 0.0)
+        ranges.push_back({quality, lang});
+      if (ranges.size() > 16)
+        break;
+    }
+  std::stable_sort(ranges.begin(), ranges.end(),
+                   [](const std::pair<double,std::string>&l, const std::pair<double,std::string>&r)
+  {
+    return l.first > r.first;
+  });
+  for (auto& qrange: ranges)
+    {
+      const std::string& lang = qrange.second;
+      if (lang == "*")
+        return hcv_default_language_index;
+      int lix = hcv_find_language(lang);
+      if (lix >= 0)
+        return lix;
+      std::string primary = lang.substr(0, lang.find('-'));
+      if (primary != lang && (lix = hcv_find_language(primary)) >= 0)
+        return lix;
+      if (primary == HCV_TEMPLATE_LANGUAGE)
+        return -1;
+    }
+  return hcv_default_language_index;
+} // end hcv_negotiate_language
+
+
+/// append to str the C-like string starting at the quote of pc
+static bool
+hcv_parse_po_string(const char*pc, std::string&str)
+{
+  while (*pc == ' ' || *pc == '\t')
+    pc++;
+  if (*pc != '"')
+    return false;
+  for (pc++; *pc && *pc != '"'; pc++)
+    {
+      if (*pc != '\\')
+        {
+          str.push_back(*pc);
+          continue;
+        }
+      switch (*++pc)
+        {
+        case 'n':
+          str.push_back('\n');
+          break;
+        case 't':
+          str.push_back('\t');
+          break;
+        case 0:
+          return false;
+        default:
+          str.push_back(*pc);
+          break;
+        }
+    }
+  return *pc == '"';
+} // end hcv_parse_po_string
+
+
+/// parse a PO file, adding its msgid to msgidset, and return its
+/// translations
+static std::map<std::string,std::string>
+hcv_parse_po_file(const std::string&popath, std::set<std::string>&msgidset)
+{
+  std::map<std::string,std::string> translations;
+  std::ifstream poinp(popath);
+  std::string msgid, msgstr;
+  enum { po_none, po_msgid, po_msgstr, po_other } state = po_none;
+  int lineno = 0;
+  auto flush = [&]()
+  {
+    if (!msgid.empty())
+      {
+        msgidset.insert(msgid);
+        if (!msgstr.empty())
+          translations[msgid] = msgstr;
+      }
+    msgid.clear();
+    msgstr.clear();
+  };
+  for (std::string linbuf; std::getline(poinp, linbuf); )
+    {
+      lineno++;
+      const char*linestr = linbuf.c_str();
+      bool ok = true;
+      if (linbuf.empty() || linestr[0] == '#')
+        continue;
+      else if (!strncmp(linestr, "msgid ", 6))
+        {
+          flush();
+          state = po_msgid;
+          ok = hcv_parse_po_string(linestr+6, msgid);
+        }
+      else if (!strncmp(linestr, "msgstr ", 7))
+        {
+          state = po_msgstr;
+          ok = hcv_parse_po_string(linestr+7, msgstr);
+        }
+      else if (linestr[0] == '"')
+        {
+          if (state == po_msgid)
+            ok = hcv_parse_po_string(linestr, msgid);
+          else if (state == po_msgstr)
+            ok = hcv_parse_po_string(linestr, msgstr);
+        }
+      else
+        /// msgctxt, msgid_plural, msgstr[N] are not used by HelpCovid
+        state = po_other;
+      if (!ok)
+        HCV_SYSLOGOUT(LOG_WARNING, "hcv_parse_po_file: bad line " << popath << ":" << lineno
+                      << " " << linbuf);
+    }
+  flush();
+  return translations;
+} // end hcv_parse_po_file
+
+
+void
+hcv_initialize_messages(void)
+{
+  std::string i18ndir = hcv_get_web_root() + "i18n/";
+  std::vector<std::pair<std::string,std::string>> langpaths;
+  if (DIR*dir = opendir(i18ndir.c_str()))
+    {
+      while (struct dirent*de = readdir(dir))
+        {
+          /// like helpcovid.fr.po or helpcovid.fr-ca.po
+          const char*name = de->d_name;
+          size_t namelen = strlen(name);
+          if (namelen > strlen("helpcovid..po") && !strncmp(name, "helpcovid.", 10)
+              && !strcmp(name+namelen-3, ".po"))
+            {
+              std::string lang(name+10, namelen-13);
+              for (char&c: lang)
+                c = (char)tolower(c);
+              langpaths.push_back({lang, i18ndir+name});
+            }
+        }
+      closedir(dir);
+    }
+  std::sort(langpaths.begin(), langpaths.end());
+  std::set<std::string> msgidset;
+  std::vector<std::map<std::string,std::string>> translations;
+  for (auto& langpath: langpaths)
+    translations.push_back(hcv_parse_po_file(langpath.second, msgidset));
+  hcv_build_message_perfect_hash(msgidset);
+  hcv_message_catalogs.clear();
+  for (unsigned lix=0; lix<langpaths.size(); lix++)
+    {
+      hcv_message_catalog_st cat {langpaths[lix].first, langpaths[lix].second,
+                                  std::vector<std::string>(hcv_message_msgids.size())};
+      for (auto& tr: translations[lix])
+        cat.hcvmcat_texts[hcv_message_slot(tr.first.c_str())] = tr.second;
+      HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_messages: " << translations[lix].size()
+                    << " translations in " << cat.hcvmcat_path);
+      hcv_message_catalogs.push_back(std::move(cat));
+    }
+  /// the default language comes from the locale, e.g. fr_FR.UTF-8
+  std::string loc = hcv_get_locale()?:"";
+  loc = loc.substr(0, loc.find_first_of(".@"));
+  for (char&c: loc)
+    c = (c=='_')?'-':(char)tolower(c);
+  hcv_default_language_index = hcv_find_language(loc);
+  if (hcv_default_language_index < 0)
+    hcv_default_language_index = hcv_find_language(loc.substr(0, loc.find('-')));
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_messages: " << hcv_message_catalogs.size()
+                << " catalogs with " << hcv_message_msgids.size() << " msgids, default language "
+                << hcv_language_name(hcv_default_language_index));
+} // end hcv_initialize_messages
+
+//////////////////// end of file hcv_i18n.cc of github.com/bstarynk/helpcovid
@@ -81,6 +81,8 @@ enum hcv_progoption_en
   HCVPROGOPT_WEBSSLKEY=1001,
   HCVPROGOPT_PLUGIN=1002,
   HCVPROGOPT_CLEARDATABASE=1003,
+  HCVPROGOPT_IMPORTUSERS=1004,
+  HCVPROGOPT_EXPORTUSERS=1005,
 };
 
 struct argp_option hcv_progoptions[] =
@@ -197,6 +199,22 @@ struct argp_option hcv_progoptions[] =
     /*doc:*/ "clear database entirely", ///
     /*group:*/0 ///
   },
+  /* ======= bulk import of users, then exit ======= */
+  {/*name:*/ "import-users", ///
+    /*key:*/ HCVPROGOPT_IMPORTUSERS, ///
+    /*arg:*/ "FILE", ///
+    /*flags:*/0, ///
+    /*doc:*/ "load users from FILE (CSV, or JSON lines if ending with .jsonl), then exit", ///
+    /*group:*/0 ///
+  },
+  /* ======= bulk export of users, then exit ======= */
+  {/*name:*/ "export-users", ///
+    /*key:*/ HCVPROGOPT_EXPORTUSERS, ///
+    /*arg:*/ "FILE", ///
+    /*flags:*/0, ///
+    /*doc:*/ "write all users to FILE (CSV, or JSON lines if ending with .jsonl), then exit", ///
+    /*group:*/0 ///
+  },
   /* ======= load a plugin ======= */
   {/*name:*/ "plugin", ///
     /*key:*/ HCVPROGOPT_PLUGIN, ///
@@ -231,6 +249,8 @@ struct hcv_progarguments
   std::string hcvprog_opensslcert;
   std::string hcvprog_opensslkey;
   std::string hcvprog_pidfile;
+  std::string hcvprog_importusers;
+  std::string hcvprog_exportusers;
 };
 
 static struct hcv_progarguments hcv_progargs =
@@ -245,6 +265,8 @@ static struct hcv_progarguments hcv_progargs =
   .hcvprog_opensslcert = "",
   .hcvprog_opensslkey = "",
   .hcvprog_pidfile = "",
+  .hcvprog_importusers = "",
+  .hcvprog_exportusers = "",
 };
 
 static char hcv_hostname[64];
@@ -404,6 +426,14 @@ hcv_parse1opt (int key, char *arg, struct argp_state *state)
       hcv_should_clear_database = true;
       return 0;
 
+    case HCVPROGOPT_IMPORTUSERS:
+      progargs->hcvprog_importusers = std::string(arg);
+      return 0;
+
+    case HCVPROGOPT_EXPORTUSERS:
+      progargs->hcvprog_exportusers = std::string(arg);
+      return 0;
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -588,6 +618,14 @@ Glib::KeyFile hcv_config_key_file;
 extern "C" std::recursive_mutex hcv_config_mtx;
 std::recursive_mutex hcv_config_mtx;
 std::string hcv_config_file_path;
+/// incremented at each load of the configuration file
+static std::atomic<long> hcv_config_generation;
+
+long
+hcv_get_config_generation(void)
+{
+  return hcv_config_generation.load();
+} // end hcv_get_config_generation
 
 std::string
 hcv_get_config_file_path(void)
@@ -631,6 +669,7 @@ hcv_load_config_file(const char*configfile)
         {
           HCV_SYSLOGOUT(LOG_NOTICE, "helpcovid loaded configuration file " << configpath);
           hcv_config_file_path = configpath;
+          hcv_config_generation++;
         }
       else
         HCV_FATALOUT("helpcovid configuration file " << configpath << " failed to load");
@@ -873,6 +912,9 @@ Hcv_Random::deterministic_reseed(void)
 } // end of Hcv_Random::deterministic_reseed
 
 ////////////////////////////////////////////////////////////////
+/// the helpcovid-bench program of hcvbench_main.cc links an object
+/// of this file compiled with -DHELPCOVID_NOMAIN
+#ifndef HELPCOVID_NOMAIN
 int
 main(int argc, char**argv)
 {
@@ -1028,6 +1070,18 @@ main(int argc, char**argv)
   errno = 0;
   hcv_initialize_database(hcv_progargs.hcvprog_postgresuri, hcv_should_clear_database);
   errno = 0;
+  hcv_initialize_password_hashing();
+  /// bulk tools, without web service
+  if (!hcv_progargs.hcvprog_importusers.empty() || !hcv_progargs.hcvprog_exportusers.empty())
+    {
+      if (!hcv_progargs.hcvprog_importusers.empty())
+        hcv_database_import_users(hcv_progargs.hcvprog_importusers);
+      if (!hcv_progargs.hcvprog_exportusers.empty())
+        hcv_database_export_users(hcv_progargs.hcvprog_exportusers);
+      HCV_SYSLOGOUT(LOG_INFO, "end of bulk users " << argv[0]);
+      return 0;
+    }
+  errno = 0;
   hcv_initialize_templates();
   errno = 0;
   hcv_start_background_thread();
@@ -1039,6 +1093,7 @@ main(int argc, char**argv)
   hcv_main_argv = nullptr;
   return 0;
 } // end of main
+#endif /*HELPCOVID_NOMAIN*/
 
 
 
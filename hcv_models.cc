@@ -52,7 +52,9 @@ extern "C" bool
 hcv_model_validator_email(const std::string& field, const std::string& tag,
                           std::string& msg)
 {
-  const std::regex pattern("(\\w+)(\\.|_)?(\\w*)@(\\w+)(\\.(\\w+))+");
+  /// compiled once; matching with it is thread-safe, e.g. for
+  /// hcv_database_import_users
+  static const std::regex pattern("(\\w+)(\\.|_)?(\\w*)@(\\w+)(\\.(\\w+))+");
 
   if (!std::regex_match(field, pattern))
     {
@@ -88,7 +90,7 @@ hcv_user_model_validate(const hcv_user_model& model, hcv_user_model& status)
                                        status.user_email);
     }
 
-  return true;
+  return false;
 }
 
 
@@ -98,14 +100,40 @@ hcv_user_model_create(const hcv_user_model& model, hcv_user_model& status)
   if (!hcv_user_model_validate(model, status))
     return false;
 
-  Hcv_PreparedStatement stmt("user_create");
-  stmt.bind(model.user_first_name);
-  stmt.bind(model.user_family_name);
-  stmt.bind(model.user_email);
-  stmt.bind(model.user_gender);
+  Hcv_database_connection dbconn;
+  hcv_user_create_stmt.prepare(dbconn);
+  pqxx::work transact(dbconn.conn());
+  hcv_user_create_stmt_t::row_type row;
+  bool created = hcv_user_create_stmt.exec1(transact, row, model.user_first_name,
+                 model.user_family_name, model.user_email,
+                 model.user_gender);
+  transact.commit();
+  /// the unique index on lower(user_email) is the authority, since
+  /// the filter of known emails may lag behind other processes
+  if (created)
+    hcv_database_note_known_email(model.user_email);
+  else
+    status.user_email = "The e-mail address is already registered";
+  return created;
+}
+
 
-  stmt.query();
-  return true;
+std::future<bool>
+hcv_user_model_authenticate_async(const std::string& email,
+                                  const std::string& passwd)
+{
+  std::string encrypted;
+  {
+    Hcv_database_connection dbconn(hcv_user_get_password_by_email_stmt.access());
+    hcv_user_get_password_by_email_stmt.prepare(dbconn);
+    pqxx::work transact(dbconn.conn());
+    hcv_user_get_password_by_email_stmt_t::row_type row;
+    if (hcv_user_get_password_by_email_stmt.exec1(transact, row, email))
+      encrypted = std::get<0>(row);
+    transact.commit();
+  }
+  /// the connection is given back before hashing
+  return hcv_password_verify(passwd, encrypted);
 }
 
 
@@ -113,12 +141,19 @@ extern "C" bool
 hcv_user_model_authenticate(const std::string& email,
                             const std::string& passwd)
 {
-  Hcv_PreparedStatement stmt("user_get_password_by_email");
-  stmt.bind(email);
+  return hcv_user_model_authenticate_async(email, passwd).get();
+}
 
-  auto res = stmt.query();
-  auto row = res.begin();
 
-  return row[0].as<std::string>() == passwd;
+extern "C" void
+hcv_user_model_update_password(const std::string& email,
+                               const std::string& password)
+{
+  std::string encrypted = hcv_password_hash(password).get();
+  Hcv_database_connection dbconn;
+  hcv_user_add_password_stmt.prepare(dbconn);
+  pqxx::work transact(dbconn.conn());
+  hcv_user_add_password_stmt.exec0(transact, email, encrypted);
+  transact.commit();
 }
 
@@ -0,0 +1,316 @@
+/****************************************************************
+ * file hcv_passwd.cc
+ *
+ * Description:
+ *      Password hashing of https://github.com/bstarynk/helpcovid
+ *      using crypt(3) on a bounded pool of threads.
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "hcv_header.hh"
+#include <crypt.h>
+#include <sys/random.h>
+
+extern "C" const char hcv_passwd_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcv_passwd_date[] = __DATE__;
+
+/// Passwords are hashed by the SHA-512 method of crypt(3), as
+/// $6$rounds=N$salt$hash, whose cost grows with the rounds. That
+/// CPU-bound work runs on a few dedicated threads, so a burst of
+/// logins cannot take every web worker thread; when too many hashes
+/// are queued, new ones are refused at once.
+#define HCV_PASSWD_DEFAULT_ROUNDS 100000
+#define HCV_PASSWD_MINIMAL_ROUNDS 1000
+#define HCV_PASSWD_MAXIMAL_ROUNDS 10000000
+#define HCV_PASSWD_MAXIMAL_THREADS 16
+#define HCV_PASSWD_DEFAULT_QUEUE 32
+#define HCV_PASSWD_MAXIMAL_QUEUE 4096
+#define HCV_PASSWD_SALT_LEN 16
+
+static std::mutex hcv_passwd_mtx;
+static std::condition_variable hcv_passwd_changed;
+static std::deque<std::function<void(struct crypt_data*)>> hcv_passwd_queue;
+static unsigned hcv_passwd_maxqueue = HCV_PASSWD_DEFAULT_QUEUE;
+static long hcv_passwd_rounds = HCV_PASSWD_DEFAULT_ROUNDS;
+static bool hcv_passwd_started;
+/// verified for unknown users, so they take as long as known ones
+static std::string hcv_passwd_dummy_hash;
+static std::atomic<long> hcv_passwd_nbdone;
+static std::atomic<long> hcv_passwd_nbrejected;
+
+
+static std::string
+hcv_passwd_make_salt(void)
+{
+  static const char saltchars[] =
+    "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  unsigned char randbuf[HCV_PASSWD_SALT_LEN];
+  memset (randbuf, 0, sizeof(randbuf));
+  if (getrandom(randbuf, sizeof(randbuf), 0) != (ssize_t)sizeof(randbuf))
+    HCV_FATALOUT("hcv_passwd_make_salt: getrandom failed");
+  std::string salt;
+  for (unsigned char b: randbuf)
+    salt.push_back(saltchars[b % 64]);
+  return salt;
+} // end hcv_passwd_make_salt
+
+
+static std::string
+hcv_passwd_crypt(struct crypt_data*cdata, const std::string& passwd, const std::string& setting)
+{
+  const char*res = crypt_r(passwd.c_str(), setting.c_str(), cdata);
+  /// some implementations give a "*" prefixed failure token, not null
+  if (!res || res[0] == '*')
+    throw std::runtime_error("crypt_r failed");
+  return std::string(res);
+} // end hcv_passwd_crypt
+
+
+/// compare in a time independent of where they differ
+static bool
+hcv_passwd_same(const std::string& left, const std::string& right)
+{
+  if (left.size() != right.size())
+    return false;
+  unsigned char diff = 0;
+  for (size_t ix = 0; ix < left.size(); ix++)
+    diff |= (unsigned char)(left[ix] ^ right[ix]);
+  return diff == 0;
+} // end hcv_passwd_same
+
+
+static void
+hcv_passwd_thread_body(int rank)
+{
+  char thnambuf[16];
+  memset (&thnambuf, 0, sizeof(thnambuf));
+  snprintf(thnambuf, sizeof(thnambuf), "hcovpass%d", rank);
+  pthread_setname_np(pthread_self(), thnambuf);
+  /// large, so allocated once per thread
+  std::unique_ptr<struct crypt_data> cdata(new struct crypt_data);
+  memset (cdata.get(), 0, sizeof(struct crypt_data));
+  for (;;)
+    {
+      std::function<void(struct crypt_data*)> todo;
+      {
+        std::unique_lock<std::mutex> gu(hcv_passwd_mtx);
+        hcv_passwd_changed.wait(gu, []()
+        {
+          return !hcv_passwd_queue.empty();
+        });
+        todo = std::move(hcv_passwd_queue.front());
+        hcv_passwd_queue.pop_front();
+      }
+      todo(cdata.get());
+      hcv_passwd_nbdone++;
+    }
+} // end hcv_passwd_thread_body
+
+
+/// queue some work, or throw Hcv_password_overloaded
+static void
+hcv_passwd_submit(std::function<void(struct crypt_data*)> todo)
+{
+  {
+    std::lock_guard<std::mutex> gu(hcv_passwd_mtx);
+    if (!hcv_passwd_started)
+      throw std::runtime_error("password hashing not initialized");
+    if (hcv_passwd_queue.size() >= hcv_passwd_maxqueue)
+      {
+        hcv_passwd_nbrejected++;
+        throw Hcv_password_overloaded();
+      }
+    hcv_passwd_queue.push_back(std::move(todo));
+  }
+  hcv_passwd_changed.notify_one();
+} // end hcv_passwd_submit
+
+
+/// true for a well formed crypt(3) hash, that is
+/// $6$[rounds=N$]salt$hash or $5$[rounds=N$]salt$hash (SHA-512 or
+/// SHA-256), or $2b$NN$ followed by 53 characters (bcrypt)
+bool
+hcv_password_is_hash(const std::string& encrypted)
+{
+  static const char cryptchars[] =
+    "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  /// true if encrypted[pos...pos+len) is made of cryptchars
+  auto iscryptchars = [&](size_t pos, size_t len)
+  {
+    for (size_t ix=pos; ix<pos+len; ix++)
+      if (ix >= encrypted.size() || !strchr(cryptchars, encrypted[ix]))
+        return false;
+    return true;
+  };
+  if (encrypted.compare(0, 4, "$2a$") == 0 || encrypted.compare(0, 4, "$2b$") == 0
+      || encrypted.compare(0, 4, "$2y$") == 0)
+    return encrypted.size() == 60 && isdigit(encrypted[4]) && isdigit(encrypted[5])
+           && encrypted[6] == '$' && iscryptchars(7, 53);
+  size_t hashlen = 0;
+  if (encrypted.compare(0, 3, "$6$") == 0)
+    hashlen = 86;
+  else if (encrypted.compare(0, 3, "$5$") == 0)
+    hashlen = 43;
+  else
+    return false;
+  size_t pos = 3;
+  if (encrypted.compare(pos, 7, "rounds=") == 0)
+    {
+      size_t endrounds = encrypted.find('$', pos+7);
+      if (endrounds == std::string::npos || endrounds == pos+7
+          || encrypted.find_first_not_of("0123456789", pos+7) != endrounds)
+        return false;
+      pos = endrounds+1;
+    }
+  size_t endsalt = encrypted.find('$', pos);
+  if (endsalt == std::string::npos || endsalt == pos || endsalt-pos > 16)
+    return false;
+  return iscryptchars(pos, endsalt-pos)
+         && encrypted.size()-endsalt-1 == hashlen && iscryptchars(endsalt+1, hashlen);
+} // end hcv_password_is_hash
+
+
+std::future<std::string>
+hcv_password_hash(const std::string& passwd)
+{
+  auto prom = std::make_shared<std::promise<std::string>>();
+  std::future<std::string> fut = prom->get_future();
+  std::string setting = "$6$rounds=" + std::to_string(hcv_passwd_rounds)
+                        + "$" + hcv_passwd_make_salt() + "$";
+  hcv_passwd_submit([=](struct crypt_data*cdata)
+  {
+    try
+      {
+        prom->set_value(hcv_passwd_crypt(cdata, passwd, setting));
+      }
+    catch (...)
+      {
+        prom->set_exception(std::current_exception());
+      }
+  });
+  return fut;
+} // end hcv_password_hash
+
+
+std::future<bool>
+hcv_password_verify(const std::string& passwd, const std::string& encrypted)
+{
+  auto prom = std::make_shared<std::promise<bool>>();
+  std::future<bool> fut = prom->get_future();
+  /// an empty encrypted password is for an unknown user, and older
+  /// passwords were stored in clear; both still cost a hash
+  bool hashed = hcv_password_is_hash(encrypted);
+  std::string setting = hashed ? encrypted : hcv_passwd_dummy_hash;
+  hcv_passwd_submit([=](struct crypt_data*cdata)
+  {
+    try
+      {
+        std::string res = hcv_passwd_crypt(cdata, passwd, setting);
+        if (hashed)
+          prom->set_value(hcv_passwd_same(res, encrypted));
+        else
+          prom->set_value(!encrypted.empty() && hcv_passwd_same(passwd, encrypted));
+      }
+    catch (std::exception& exc)
+      {
+        /// e.g. a hash of some crypt(3) method unknown here: that
+        /// password does not match, and the login is refused
+        HCV_SYSLOGOUT(LOG_WARNING, "hcv_password_verify failed: " << exc.what());
+        prom->set_value(false);
+      }
+  });
+  return fut;
+} // end hcv_password_verify
+
+
+void
+hcv_password_statistics(long*pnbdone, long*pnbrejected, long*pnbqueued)
+{
+  if (pnbdone)
+    *pnbdone = hcv_passwd_nbdone.load();
+  if (pnbrejected)
+    *pnbrejected = hcv_passwd_nbrejected.load();
+  if (pnbqueued)
+    {
+      std::lock_guard<std::mutex> gu(hcv_passwd_mtx);
+      *pnbqueued = (long) hcv_passwd_queue.size();
+    }
+} // end hcv_password_statistics
+
+
+void
+hcv_initialize_password_hashing(void)
+{
+  long nbthreads = std::max(1, (int)std::thread::hardware_concurrency()/4);
+  long maxqueue = HCV_PASSWD_DEFAULT_QUEUE;
+  long rounds = HCV_PASSWD_DEFAULT_ROUNDS;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("helpcovid"))
+      return;
+    if (kf->has_key("helpcovid","password_hash_threads"))
+      nbthreads = (long) kf->get_int64("helpcovid","password_hash_threads");
+    if (kf->has_key("helpcovid","password_hash_queue"))
+      maxqueue = (long) kf->get_int64("helpcovid","password_hash_queue");
+    if (kf->has_key("helpcovid","password_hash_rounds"))
+      rounds = (long) kf->get_int64("helpcovid","password_hash_rounds");
+  });
+  if (nbthreads < 1)
+    nbthreads = 1;
+  else if (nbthreads > HCV_PASSWD_MAXIMAL_THREADS)
+    nbthreads = HCV_PASSWD_MAXIMAL_THREADS;
+  if (maxqueue < nbthreads)
+    maxqueue = nbthreads;
+  else if (maxqueue > HCV_PASSWD_MAXIMAL_QUEUE)
+    maxqueue = HCV_PASSWD_MAXIMAL_QUEUE;
+  if (rounds < HCV_PASSWD_MINIMAL_ROUNDS)
+    rounds = HCV_PASSWD_MINIMAL_ROUNDS;
+  else if (rounds > HCV_PASSWD_MAXIMAL_ROUNDS)
+    rounds = HCV_PASSWD_MAXIMAL_ROUNDS;
+  double starttime = hcv_monotonic_real_time();
+  std::string dummyhash;
+  {
+    std::unique_ptr<struct crypt_data> cdata(new struct crypt_data);
+    memset (cdata.get(), 0, sizeof(struct crypt_data));
+    dummyhash = hcv_passwd_crypt(cdata.get(), hcv_passwd_make_salt(),
+                                 "$6$rounds=" + std::to_string(rounds)
+                                 + "$" + hcv_passwd_make_salt() + "$");
+  }
+  double hashtime = hcv_monotonic_real_time() - starttime;
+  {
+    std::lock_guard<std::mutex> gu(hcv_passwd_mtx);
+    if (hcv_passwd_started)
+      HCV_FATALOUT("hcv_initialize_password_hashing called twice");
+    hcv_passwd_maxqueue = (unsigned) maxqueue;
+    hcv_passwd_rounds = rounds;
+    hcv_passwd_dummy_hash = dummyhash;
+    hcv_passwd_started = true;
+  }
+  for (int rk = 1; rk <= nbthreads; rk++)
+    std::thread(hcv_passwd_thread_body, rk).detach();
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_password_hashing " << nbthreads << " threads, queue of "
+                << maxqueue << ", " << rounds << " rounds taking "
+                << (long) (1000.0*hashtime) << " ms");
+} // end hcv_initialize_password_hashing
+
+
+/////////// end of file hcv_passwd.cc in github.com/bstarynk/helpcovid
@@ -33,6 +33,78 @@ extern "C" const char hcv_template_date[] = __DATE__;
 static std::map<std::string, hcv_template_expanding_closure_t> hcv_template_expander_dict;
 static std::recursive_mutex hcv_template_mtx;
 
+//// compiled templates, as registered before main by the generated
+//// __compiled_templates.cc
+struct hcv_registered_template_st
+{
+  std::string hcvregtempl_relpath;
+  long hcvregtempl_size;
+  uint64_t hcvregtempl_hash;
+  const Hcv_template_part* hcvregtempl_parts;
+  unsigned hcvregtempl_nbparts;
+};
+
+/// a function-local static, since registration happens in static
+/// constructors, in unspecified order
+static std::vector<hcv_registered_template_st>&
+hcv_registered_templates(void)
+{
+  static std::vector<hcv_registered_template_st> regvec;
+  return regvec;
+} // end hcv_registered_templates
+
+//// names of expanders whose expansion depends only on the page
+//// cache key (template, language, configuration generation)
+static std::set<std::string> hcv_template_cacheable_set;
+
+//// a template plan is a sequence of parts; each literal part points
+//// into static compiled data or into hcvplan_source, and each
+//// processing instruction part is bound to its expanding closure,
+//// except the block ones <?hcv foreach rows?>, <?hcv if name?>,
+//// <?hcv else?>, <?hcv end?> and <?hcv cell column?>, and the
+//// <?hcv msg ...?> bound to their message catalog slot, handled by
+//// hcv_expand_plan_range
+enum hcv_plan_block_en
+{
+  hcvpblk_none=0,
+  hcvpblk_foreach,
+  hcvpblk_if,
+  hcvpblk_else,
+  hcvpblk_end,
+  hcvpblk_cell,
+  hcvpblk_msg,
+};
+
+struct hcv_plan_part_st
+{
+  const char* hcvppart_text;
+  unsigned hcvppart_len;
+  bool hcvppart_is_pi;
+  bool hcvppart_cacheable;	// see hcv_template_cacheable_set
+  int hcvppart_lineno;
+  long hcvppart_offset;
+  std::string hcvppart_procinstr; // empty for literal parts
+  hcv_template_expanding_closure_t hcvppart_closure; // null if unbound
+  hcv_plan_block_en hcvppart_block;
+  std::string hcvppart_blockname; // rows, condition or column name
+  int hcvppart_elseix;		// index of <?hcv else?> of an if, or -1
+  int hcvppart_endix;		// index of <?hcv end?> of foreach, if, else
+  int hcvppart_msgslot;		// catalog slot of a msg, or -1
+  std::string hcvppart_msgdefault; // literal text of a msg, in English
+};
+
+struct hcv_template_plan_st
+{
+  std::string hcvplan_path;	// full path of source file
+  std::string hcvplan_source;	// owned source text, empty when compiled
+  std::vector<hcv_plan_part_st> hcvplan_parts;
+};
+
+//// compiled templates, filled once by hcv_initialize_templates,
+//// read-only afterwards, so used without locking; keyed by the full
+//// path of the source file
+static std::map<std::string, std::shared_ptr<const hcv_template_plan_st>> hcv_compiled_template_dict;
+
 ////////////////////////////////////////////////////////////////
 
 
@@ -139,6 +211,15 @@ hcv_register_template_expander_closure(const std::string&name, const hcv_templat
 } // end hcv_register_expander_closure
 
 
+void
+hcv_register_cacheable_template_expander_closure(const std::string&name, const hcv_template_expanding_closure_t&expfun)
+{
+  std::lock_guard<std::recursive_mutex> gu(hcv_template_mtx);
+  hcv_register_template_expander_closure(name, expfun);
+  hcv_template_cacheable_set.insert(name);
+} // end hcv_register_cacheable_template_expander_closure
+
+
 
 void
 hcv_forget_template_expander(const std::string&name)
@@ -151,6 +232,7 @@ hcv_forget_template_expander(const std::string&name)
       return;
     };
   hcv_template_expander_dict.erase(it);
+  hcv_template_cacheable_set.erase(name);
 } // end hcv_forget_template_expander
 
 
@@ -200,6 +282,933 @@ hcv_expand_processing_instruction(Hcv_template_data*templdata, const std::string
 const unsigned hcv_max_template_size = 128*1024;
 
 
+////////////////////////////////////////////////////////////////
+//// template plans: compiled templates, or templates split at runtime
+
+uint64_t
+hcv_template_source_hash(const char*buf, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t ix=0; ix<len; ix++)
+    {
+      h ^= (unsigned char)buf[ix];
+      h *= 0x100000001b3ULL;
+    }
+  return h;
+} // end hcv_template_source_hash
+
+
+void
+hcv_register_compiled_template(const char*relpath, long srcsize, uint64_t srchash,
+                               const Hcv_template_part*parts, unsigned nbparts)
+{
+  /// called before main from static constructors, so single-threaded
+  /// and without syslog
+  if (!relpath || !relpath[0] || relpath[0]=='/' || !parts)
+    HCV_FATALOUT("hcv_register_compiled_template: bad relpath " << (relpath?:"*null*"));
+  hcv_registered_templates().push_back({std::string(relpath), srcsize, srchash, parts, nbparts});
+} // end hcv_register_compiled_template
+
+
+/// bind a processing instruction part to its expanding closure, if
+/// it is already registered. Same parsing as
+/// hcv_expand_processing_instruction, which handles the unbound
+/// parts at expansion time.
+static void
+hcv_bind_plan_part(hcv_plan_part_st&ppart)
+{
+  std::lock_guard<std::recursive_mutex> gu(hcv_template_mtx);
+  char namebuf[80];
+  memset (namebuf, 0, sizeof(namebuf));
+  int endpos = -1;
+  if (sscanf(ppart.hcvppart_procinstr.c_str(), "<?hcv %64[a-zA-Z0-9_] %n",
+             namebuf, &endpos) >= 1 && endpos >= 0)
+    {
+      std::string name(namebuf);
+      static const std::map<std::string,hcv_plan_block_en> blockmap =
+      {
+        {"foreach", hcvpblk_foreach},
+        {"if", hcvpblk_if},
+        {"else", hcvpblk_else},
+        {"end", hcvpblk_end},
+        {"cell", hcvpblk_cell},
+      };
+      auto blkit = blockmap.find(name);
+      if (blkit != blockmap.end())
+        {
+          char blknamebuf[80];
+          memset (blknamebuf, 0, sizeof(blknamebuf));
+          ppart.hcvppart_block = blkit->second;
+          if (sscanf(ppart.hcvppart_procinstr.c_str()+endpos, "%64[a-zA-Z0-9_]", blknamebuf) >= 1)
+            ppart.hcvppart_blockname = blknamebuf;
+        }
+      if (name == "msg")
+        {
+          /// like hcv_view_expand_msg, but resolved once
+          char msgidbuf[40];
+          memset (msgidbuf, 0, sizeof(msgidbuf));
+          int msgpos = -1;
+          const char*pistr = ppart.hcvppart_procinstr.c_str();
+          if (sscanf(pistr, "<?hcv msg %38[A-Za-z0-9_] %n", msgidbuf, &msgpos) >= 1
+              && msgpos > 0 && isalpha(msgidbuf[0]))
+            {
+              ppart.hcvppart_block = hcvpblk_msg;
+              ppart.hcvppart_blockname = msgidbuf;
+              ppart.hcvppart_msgslot = hcv_message_slot(msgidbuf);
+              const char*endmsg = strstr(pistr+msgpos, "?>");
+              /// never translated by the process locale, which might
+              /// not be the language negotiated for the request
+              ppart.hcvppart_msgdefault.assign(pistr+msgpos, endmsg-(pistr+msgpos));
+            }
+        }
+      auto it = hcv_template_expander_dict.find(name);
+      if (it != hcv_template_expander_dict.end())
+        {
+          ppart.hcvppart_closure = it->second;
+          ppart.hcvppart_cacheable =
+            hcv_template_cacheable_set.find(name) != hcv_template_cacheable_set.end();
+        }
+    }
+} // end hcv_bind_plan_part
+
+
+static void
+hcv_add_plan_part(hcv_template_plan_st&plan, const char*text, unsigned len, bool ispi,
+                  int lineno, long offset)
+{
+  if (len == 0)
+    return;
+  if (!ispi && !plan.hcvplan_parts.empty())
+    {
+      /// merge with the previous literal part when contiguous
+      hcv_plan_part_st& prevpart = plan.hcvplan_parts.back();
+      if (!prevpart.hcvppart_is_pi && prevpart.hcvppart_text + prevpart.hcvppart_len == text)
+        {
+          prevpart.hcvppart_len += len;
+          return;
+        }
+    }
+  hcv_plan_part_st ppart {text, len, ispi, false, lineno, offset, std::string(), nullptr,
+                          hcvpblk_none, std::string(), -1, -1, -1, std::string()};
+  if (ispi)
+    {
+      ppart.hcvppart_procinstr.assign(text, len);
+      hcv_bind_plan_part(ppart);
+    }
+  plan.hcvplan_parts.push_back(std::move(ppart));
+} // end hcv_add_plan_part
+
+
+/// split the source of a plan into parts, exactly like the line by
+/// line scanning of hcv_expand_template_file (and of
+/// generate-templates.py). Return false on oddities that line
+/// scanning handles differently, such as NUL bytes.
+static bool
+hcv_split_template_plan(hcv_template_plan_st&plan)
+{
+  const std::string& src = plan.hcvplan_source;
+  static const char newline[] = "\n";
+  if (src.find('\0') != std::string::npos)
+    return false;
+  size_t linestart = 0;
+  int lincnt = 0;
+  while (linestart < src.size())
+    {
+      size_t eol = src.find('\n', linestart);
+      size_t linelen = ((eol == std::string::npos)?src.size():eol) - linestart;
+      const char*linestr = src.data() + linestart;
+      const char*nlstr = (eol == std::string::npos)?newline:(src.data()+eol);
+      lincnt++;
+      if (lincnt < 8 && linelen > 4 && linestr[0]=='<' && linestr[1]=='!')
+        hcv_add_plan_part(plan, linestr, linelen, false, lincnt, linestart);
+      else if (linelen > 0)
+        {
+          std::string linbuf(linestr, linelen);
+          const char*curpc = linbuf.c_str();
+          const char*startpi = nullptr;
+          while (curpc && (startpi = strstr(curpc, "<?hcv ")) != nullptr)
+            {
+              const char*endpi = strstr(curpc+strlen("<?hcv "), "?>");
+              if (endpi == nullptr)
+                {
+                  hcv_add_plan_part(plan, linestr+(curpc-linbuf.c_str()), linbuf.c_str()+linelen-curpc,
+                                    false, lincnt, linestart);
+                  curpc = nullptr;
+                  break;
+                }
+              if (endpi < startpi+strlen("<?hcv "))
+                return false;
+              hcv_add_plan_part(plan, linestr+(curpc-linbuf.c_str()), startpi-curpc,
+                                false, lincnt, linestart);
+              hcv_add_plan_part(plan, linestr+(startpi-linbuf.c_str()), (endpi+2)-startpi,
+                                true, lincnt, linestart);
+              curpc = endpi+2;
+            }
+          if (curpc && !startpi)
+            hcv_add_plan_part(plan, linestr+(curpc-linbuf.c_str()), linbuf.c_str()+linelen-curpc,
+                              false, lincnt, linestart);
+        }
+      hcv_add_plan_part(plan, nlstr, 1, false, lincnt, linestart);
+      if (eol == std::string::npos)
+        break;
+      linestart = eol+1;
+    }
+  return true;
+} // end hcv_split_template_plan
+
+
+/// match the block processing instructions of a plan, filling their
+/// hcvppart_elseix and hcvppart_endix. Return false if they are
+/// unbalanced, or if some cell is outside of any foreach.
+static bool
+hcv_structure_template_plan(hcv_template_plan_st&plan)
+{
+  std::vector<int> blockstack;
+  int nbloops = 0;
+  for (int pix=0; pix<(int)plan.hcvplan_parts.size(); pix++)
+    {
+      hcv_plan_part_st& ppart = plan.hcvplan_parts[pix];
+      const char*oddity = nullptr;
+      switch (ppart.hcvppart_block)
+        {
+        case hcvpblk_none:
+        case hcvpblk_msg:
+          break;
+        case hcvpblk_foreach:
+          nbloops++;
+        /// FALLTHRU
+        case hcvpblk_if:
+          if (ppart.hcvppart_blockname.empty())
+            oddity = "nameless block";
+          blockstack.push_back(pix);
+          break;
+        case hcvpblk_else:
+          if (blockstack.empty()
+              || plan.hcvplan_parts[blockstack.back()].hcvppart_block != hcvpblk_if
+              || plan.hcvplan_parts[blockstack.back()].hcvppart_elseix >= 0)
+            oddity = "misplaced else";
+          else
+            plan.hcvplan_parts[blockstack.back()].hcvppart_elseix = pix;
+          break;
+        case hcvpblk_end:
+          if (blockstack.empty())
+            oddity = "unmatched end";
+          else
+            {
+              hcv_plan_part_st& startpart = plan.hcvplan_parts[blockstack.back()];
+              blockstack.pop_back();
+              startpart.hcvppart_endix = pix;
+              if (startpart.hcvppart_elseix >= 0)
+                plan.hcvplan_parts[startpart.hcvppart_elseix].hcvppart_endix = pix;
+              if (startpart.hcvppart_block == hcvpblk_foreach)
+                nbloops--;
+            }
+          break;
+        case hcvpblk_cell:
+          if (nbloops == 0 || ppart.hcvppart_blockname.empty())
+            oddity = "cell outside of foreach";
+          break;
+        }
+      if (oddity)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_structure_template_plan: " << oddity
+                        << " in " << plan.hcvplan_path << ":" << ppart.hcvppart_lineno
+                        << " " << ppart.hcvppart_procinstr);
+          return false;
+        }
+    }
+  if (!blockstack.empty())
+    {
+      const hcv_plan_part_st& startpart = plan.hcvplan_parts[blockstack.back()];
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_structure_template_plan: unclosed block in "
+                    << plan.hcvplan_path << ":" << startpart.hcvppart_lineno
+                    << " " << startpart.hcvppart_procinstr);
+      return false;
+    }
+  return true;
+} // end hcv_structure_template_plan
+
+
+/// check every registered compiled template against its source file
+/// under the web root, and bind its processing instructions to their
+/// expanding closure. Called once at end of hcv_initialize_templates.
+static void
+hcv_bind_compiled_templates(void)
+{
+  std::lock_guard<std::recursive_mutex> gu(hcv_template_mtx);
+  std::string webroot = hcv_get_web_root();
+  int nbstale = 0;
+  for (auto& regtempl: hcv_registered_templates())
+    {
+      std::string srcpath = webroot + regtempl.hcvregtempl_relpath;
+      std::string srcbuf;
+      {
+        std::ifstream srcinp(srcpath, std::ios::in | std::ios::binary);
+        if (srcinp)
+          {
+            std::ostringstream srcouts;
+            srcouts << srcinp.rdbuf();
+            srcbuf = srcouts.str();
+          }
+      }
+      if ((long)srcbuf.size() != regtempl.hcvregtempl_size
+          || hcv_template_source_hash(srcbuf.c_str(), srcbuf.size()) != regtempl.hcvregtempl_hash)
+        {
+          HCV_SYSLOGOUT(LOG_WARNING, "hcv_bind_compiled_templates: source " << srcpath
+                        << " changed since compiled, so expanded at runtime");
+          nbstale++;
+          continue;
+        }
+      auto plan = std::make_shared<hcv_template_plan_st>();
+      plan->hcvplan_path = srcpath;
+      plan->hcvplan_parts.reserve(regtempl.hcvregtempl_nbparts);
+      for (unsigned pix=0; pix<regtempl.hcvregtempl_nbparts; pix++)
+        {
+          const Hcv_template_part* curpart = regtempl.hcvregtempl_parts+pix;
+          hcv_plan_part_st ppart {curpart->tpart_text, curpart->tpart_len, curpart->tpart_is_pi, false,
+                                  curpart->tpart_lineno, curpart->tpart_offset, std::string(), nullptr,
+                                  hcvpblk_none, std::string(), -1, -1, -1, std::string()};
+          if (curpart->tpart_is_pi)
+            {
+              ppart.hcvppart_procinstr.assign(curpart->tpart_text, curpart->tpart_len);
+              hcv_bind_plan_part(ppart);
+            }
+          plan->hcvplan_parts.push_back(std::move(ppart));
+        }
+      if (!hcv_structure_template_plan(*plan))
+        {
+          nbstale++;
+          continue;
+        }
+      hcv_compiled_template_dict[srcpath] = plan;
+    }
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_bind_compiled_templates: " << hcv_compiled_template_dict.size()
+                << " compiled templates used, " << nbstale << " stale ones");
+} // end hcv_bind_compiled_templates
+
+
+/// get the plan of a template file: its compiled one if any, or else
+/// a fresh one from its current source. Return null if the file
+/// cannot be planned, then it should be expanded by
+/// hcv_expand_template_file.
+static std::shared_ptr<const hcv_template_plan_st>
+hcv_get_template_plan(const std::string& srcfilepath)
+{
+  auto ctit = hcv_compiled_template_dict.find(srcfilepath);
+  if (ctit != hcv_compiled_template_dict.end())
+    return ctit->second;
+  struct stat srcfilestat;
+  memset (&srcfilestat, 0, sizeof(srcfilestat));
+  if (srcfilepath.empty() || stat(srcfilepath.c_str(), &srcfilestat)
+      || !S_ISREG(srcfilestat.st_mode) || srcfilestat.st_size > hcv_max_template_size)
+    return nullptr;
+  auto plan = std::make_shared<hcv_template_plan_st>();
+  plan->hcvplan_path = srcfilepath;
+  {
+    std::ifstream srcinp(srcfilepath, std::ios::in | std::ios::binary);
+    if (!srcinp)
+      return nullptr;
+    std::ostringstream srcouts;
+    srcouts << srcinp.rdbuf();
+    plan->hcvplan_source = srcouts.str();
+  }
+  if (!hcv_split_template_plan(*plan) || !hcv_structure_template_plan(*plan))
+    return nullptr;
+  return plan;
+} // end hcv_get_template_plan
+
+
+/// plan some template source given as a string, e.g. a builtin one
+static std::shared_ptr<const hcv_template_plan_st>
+hcv_get_string_template_plan(const std::string& src, const char*name)
+{
+  auto plan = std::make_shared<hcv_template_plan_st>();
+  plan->hcvplan_path = name;
+  plan->hcvplan_source = src;
+  if (!hcv_split_template_plan(*plan) || !hcv_structure_template_plan(*plan))
+    return nullptr;
+  return plan;
+} // end hcv_get_string_template_plan
+
+
+static inline void
+hcv_expand_plan_part(const hcv_plan_part_st& ppart, const std::string& srcfilepath,
+                     Hcv_template_data* templdata, std::ostream&out)
+{
+  if (!ppart.hcvppart_is_pi)
+    out.write(ppart.hcvppart_text, ppart.hcvppart_len);
+  else if (ppart.hcvppart_closure)
+    ppart.hcvppart_closure(templdata, ppart.hcvppart_procinstr, srcfilepath.c_str(),
+                           ppart.hcvppart_lineno, ppart.hcvppart_offset);
+  else
+    hcv_expand_processing_instruction(templdata, ppart.hcvppart_procinstr, srcfilepath.c_str(),
+                                      ppart.hcvppart_lineno, ppart.hcvppart_offset);
+} // end hcv_expand_plan_part
+
+
+/// the message catalog index of some template data, see hcv_i18n.cc
+static inline int
+hcv_template_language_index(Hcv_template_data* templdata)
+{
+  if (auto httptempl = dynamic_cast<Hcv_http_template_data*>(templdata))
+    return httptempl->language_index();
+  return hcv_negotiate_language(nullptr);
+} // end hcv_template_language_index
+
+
+/// a running <?hcv foreach rows?> loop, with the column index of every
+/// cell and if part of its body, or -1
+struct hcv_loop_frame_st
+{
+  const Hcv_template_rows* hcvloop_rows;
+  size_t hcvloop_rowix;
+  int hcvloop_firstix;		// index of first part of the body
+  std::vector<int> hcvloop_colix;
+  const hcv_loop_frame_st* hcvloop_outer;
+};
+
+/// index of the part after the given one and its block, if any
+static inline int
+hcv_plan_part_extent(const hcv_template_plan_st&plan, int pix)
+{
+  const hcv_plan_part_st& ppart = plan.hcvplan_parts[pix];
+  if (ppart.hcvppart_block == hcvpblk_foreach || ppart.hcvppart_block == hcvpblk_if)
+    return ppart.hcvppart_endix+1;
+  return pix+1;
+} // end hcv_plan_part_extent
+
+
+static int
+hcv_loop_column(const hcv_loop_frame_st* loop, int pix, const hcv_loop_frame_st**ploop)
+{
+  for (; loop != nullptr; loop = loop->hcvloop_outer)
+    {
+      int colix = loop->hcvloop_colix[pix - loop->hcvloop_firstix];
+      if (colix >= 0)
+        {
+          *ploop = loop;
+          return colix;
+        }
+    }
+  return -1;
+} // end hcv_loop_column
+
+
+static bool
+hcv_plan_condition(const hcv_template_plan_st&plan, int pix,
+                   Hcv_template_data* templdata, const hcv_loop_frame_st* loop)
+{
+  const hcv_plan_part_st& ppart = plan.hcvplan_parts[pix];
+  const hcv_loop_frame_st* colloop = nullptr;
+  int colix = hcv_loop_column(loop, pix, &colloop);
+  if (colix >= 0)
+    return colloop->hcvloop_rows->cell_is_true(colloop->hcvloop_rowix, colix);
+  bool flag = false;
+  if (templdata->template_condition(ppart.hcvppart_blockname, &flag))
+    return flag;
+  if (auto rows = templdata->template_rows(ppart.hcvppart_blockname))
+    return rows->nb_rows() > 0;
+  HCV_DEBUGOUT("hcv_plan_condition: unknown " << ppart.hcvppart_procinstr
+               << " in " << plan.hcvplan_path << ":" << ppart.hcvppart_lineno);
+  return false;
+} // end hcv_plan_condition
+
+
+/// expand the parts of a plan from fromix included to toix excluded,
+/// running the loops and the conditionals
+static void
+hcv_expand_plan_range(const hcv_template_plan_st&plan, int fromix, int toix,
+                      Hcv_template_data* templdata, std::ostream&out,
+                      const hcv_loop_frame_st* loop)
+{
+  int pix = fromix;
+  while (pix < toix)
+    {
+      hcv_check_request_deadline("template expansion");
+      const hcv_plan_part_st& ppart = plan.hcvplan_parts[pix];
+      switch (ppart.hcvppart_block)
+        {
+        case hcvpblk_none:
+          hcv_expand_plan_part(ppart, plan.hcvplan_path, templdata, out);
+          pix++;
+          break;
+        case hcvpblk_foreach:
+        {
+          const Hcv_template_rows* rows = templdata->template_rows(ppart.hcvppart_blockname);
+          if (rows == nullptr)
+            HCV_DEBUGOUT("hcv_expand_plan_range: no rows for " << ppart.hcvppart_procinstr
+                         << " in " << plan.hcvplan_path << ":" << ppart.hcvppart_lineno);
+          size_t nbrows = rows?rows->nb_rows():0;
+          if (nbrows > 0)
+            {
+              hcv_loop_frame_st frame {rows, 0, pix+1, std::vector<int>(), loop};
+              frame.hcvloop_colix.resize(ppart.hcvppart_endix - (pix+1), -1);
+              /// resolve the columns once for all the rows
+              for (int bix=pix+1; bix<ppart.hcvppart_endix; bix++)
+                {
+                  const hcv_plan_part_st& bpart = plan.hcvplan_parts[bix];
+                  if (bpart.hcvppart_block == hcvpblk_cell || bpart.hcvppart_block == hcvpblk_if)
+                    frame.hcvloop_colix[bix-(pix+1)] = rows->column_index(bpart.hcvppart_blockname);
+                }
+              for (frame.hcvloop_rowix=0; frame.hcvloop_rowix<nbrows; frame.hcvloop_rowix++)
+                hcv_expand_plan_range(plan, pix+1, ppart.hcvppart_endix, templdata, out, &frame);
+            }
+          pix = ppart.hcvppart_endix+1;
+        }
+        break;
+        case hcvpblk_if:
+          if (hcv_plan_condition(plan, pix, templdata, loop))
+            hcv_expand_plan_range(plan, pix+1,
+                                  (ppart.hcvppart_elseix>=0)?ppart.hcvppart_elseix:ppart.hcvppart_endix,
+                                  templdata, out, loop);
+          else if (ppart.hcvppart_elseix >= 0)
+            hcv_expand_plan_range(plan, ppart.hcvppart_elseix+1, ppart.hcvppart_endix,
+                                  templdata, out, loop);
+          pix = ppart.hcvppart_endix+1;
+          break;
+        case hcvpblk_cell:
+        {
+          const hcv_loop_frame_st* colloop = nullptr;
+          int colix = hcv_loop_column(loop, pix, &colloop);
+          if (colix >= 0)
+            colloop->hcvloop_rows->output_cell(out, colloop->hcvloop_rowix, colix);
+          else
+            HCV_DEBUGOUT("hcv_expand_plan_range: unknown column " << ppart.hcvppart_procinstr
+                         << " in " << plan.hcvplan_path << ":" << ppart.hcvppart_lineno);
+          pix++;
+        }
+        break;
+        case hcvpblk_msg:
+        {
+          const char*msgtext =
+            hcv_message_text(hcv_template_language_index(templdata), ppart.hcvppart_msgslot);
+          if (msgtext)
+            out << msgtext;
+          else
+            out.write(ppart.hcvppart_msgdefault.data(), ppart.hcvppart_msgdefault.size());
+          pix++;
+        }
+        break;
+        case hcvpblk_else:
+        case hcvpblk_end:
+          /// never reached in a structured plan
+          pix++;
+          break;
+        }
+    }
+} // end hcv_expand_plan_range
+
+
+static void
+hcv_expand_template_plan(const hcv_template_plan_st&plan,
+                         Hcv_template_data* templdata, std::ostream&out)
+{
+  hcv_expand_plan_range(plan, 0, (int)plan.hcvplan_parts.size(), templdata, out, nullptr);
+} // end hcv_expand_template_plan
+
+
+////////////////////////////////////////////////////////////////
+//// the high-water mark of every expanded template file, used to
+//// size ahead the output of pooled render contexts
+static std::shared_mutex hcv_template_hwm_mtx;
+static std::unordered_map<std::string, size_t> hcv_template_hwm_dict;
+
+size_t
+hcv_template_high_water(const std::string& srcfilepath)
+{
+  std::shared_lock<std::shared_mutex> gu(hcv_template_hwm_mtx);
+  auto it = hcv_template_hwm_dict.find(srcfilepath);
+  return (it == hcv_template_hwm_dict.end())?0:it->second;
+} // end hcv_template_high_water
+
+
+static void
+hcv_note_template_high_water(const std::string& srcfilepath, long size)
+{
+  if (size <= (long) hcv_template_high_water(srcfilepath))
+    return;
+  std::unique_lock<std::shared_mutex> gu(hcv_template_hwm_mtx);
+  size_t& hwm = hcv_template_hwm_dict[srcfilepath];
+  if ((size_t)size > hwm)
+    hwm = (size_t)size;
+} // end hcv_note_template_high_water
+
+
+////////////////////////////////////////////////////////////////
+//// the page cache: for anonymous GET pages, the expansion of a
+//// template is kept as literal segments around the "holes" of
+//// processing instructions which are not cacheable, for a short
+//// time, per template, language and configuration generation.  The
+//// fragment cache works likewise for <?hcv include ...?> fragments,
+//// whose cache key may also contain the user segment.
+struct hcv_page_cache_segment_st
+{
+  std::string hcvpcseg_literal;	// expanded text before the hole
+  int hcvpcseg_holeix;		// index of hole part, -1 in the last segment
+};
+
+struct hcv_page_cache_entry_st
+{
+  std::shared_ptr<const hcv_template_plan_st> hcvpce_plan; // keeps holes alive
+  double hcvpce_expiry;		// monotonic time
+  std::vector<hcv_page_cache_segment_st> hcvpce_segments;
+};
+
+struct hcv_segment_cache_st
+{
+  const char* hcvsegc_name;	// for debugging
+  std::shared_mutex hcvsegc_mtx;
+  std::unordered_map<std::string, std::shared_ptr<const hcv_page_cache_entry_st>> hcvsegc_dict;
+  std::atomic<double> hcvsegc_ttl; // in seconds; no caching if zero
+  std::atomic<long> hcvsegc_hits;
+  std::atomic<long> hcvsegc_misses;
+  hcv_segment_cache_st(const char*name)
+    : hcvsegc_name(name), hcvsegc_mtx(), hcvsegc_dict(),
+      hcvsegc_ttl(0.0), hcvsegc_hits(0), hcvsegc_misses(0) {};
+};
+
+/// from [web] page_cache_ttl
+static hcv_segment_cache_st hcv_page_cache("page cache");
+/// from [web] fragment_cache_ttl
+static hcv_segment_cache_st hcv_fragment_cache("fragment cache");
+/// from [web] error_page_cache_ttl, see hcv_expand_error_page
+static hcv_segment_cache_st hcv_error_page_cache("error page cache");
+
+#define HCV_PAGE_CACHE_DEFAULT_TTL 5.0
+#define HCV_PAGE_CACHE_MAXIMAL_TTL 600.0
+#define HCV_FRAGMENT_CACHE_DEFAULT_TTL 60.0
+#define HCV_FRAGMENT_CACHE_MAXIMAL_TTL 3600.0
+#define HCV_ERROR_PAGE_CACHE_DEFAULT_TTL 3600.0
+#define HCV_ERROR_PAGE_CACHE_MAXIMAL_TTL 86400.0
+
+static std::string
+hcv_page_cache_key(const std::string& srcfilepath, Hcv_template_data* templdata)
+{
+  std::string key = srcfilepath;
+  key += '\n';
+  key += hcv_language_name(hcv_template_language_index(templdata));
+  key += '\n';
+  key += std::to_string(hcv_get_config_generation());
+  return key;
+} // end hcv_page_cache_key
+
+
+static std::mutex hcv_error_page_mtx;
+/// planned from html/error.html or else the builtin error page, and
+/// planned again after error_page_cache_ttl seconds
+static std::shared_ptr<const hcv_template_plan_st> hcv_error_page_plan;
+static double hcv_error_page_plan_time; // monotonic time of planning
+
+void
+hcv_invalidate_page_cache(void)
+{
+  for (hcv_segment_cache_st* segc: {&hcv_page_cache, &hcv_fragment_cache, &hcv_error_page_cache})
+    {
+      std::unique_lock<std::shared_mutex> gu(segc->hcvsegc_mtx);
+      HCV_DEBUGOUT("hcv_invalidate_page_cache: forgetting " << segc->hcvsegc_dict.size()
+                   << " entries of " << segc->hcvsegc_name);
+      segc->hcvsegc_dict.clear();
+    }
+  std::lock_guard<std::mutex> gu(hcv_error_page_mtx);
+  hcv_error_page_plan.reset();
+} // end hcv_invalidate_page_cache
+
+
+static void
+hcv_segment_cache_statistics(hcv_segment_cache_st&segc, long*phits, long*pmisses, long*pnbentries)
+{
+  if (phits)
+    *phits = segc.hcvsegc_hits.load();
+  if (pmisses)
+    *pmisses = segc.hcvsegc_misses.load();
+  if (pnbentries)
+    {
+      std::shared_lock<std::shared_mutex> gu(segc.hcvsegc_mtx);
+      *pnbentries = (long) segc.hcvsegc_dict.size();
+    }
+} // end hcv_segment_cache_statistics
+
+
+void
+hcv_page_cache_statistics(long*phits, long*pmisses, long*pnbpages)
+{
+  hcv_segment_cache_statistics(hcv_page_cache, phits, pmisses, pnbpages);
+} // end hcv_page_cache_statistics
+
+
+void
+hcv_fragment_cache_statistics(long*phits, long*pmisses, long*pnbfragments)
+{
+  hcv_segment_cache_statistics(hcv_fragment_cache, phits, pmisses, pnbfragments);
+} // end hcv_fragment_cache_statistics
+
+
+void
+hcv_error_page_cache_statistics(long*phits, long*pmisses, long*pnbpages)
+{
+  hcv_segment_cache_statistics(hcv_error_page_cache, phits, pmisses, pnbpages);
+} // end hcv_error_page_cache_statistics
+
+
+/// expand into *outp the template of srcfilepath, or the given plan,
+/// reusing the segments cached under key if they did not expire.
+/// Return false, without any output, if that template cannot be
+/// planned.
+static bool
+hcv_expand_segment_cached(hcv_segment_cache_st&segc, const std::string&key,
+                          const std::string& srcfilepath, Hcv_template_data* templdata,
+                          std::ostringstream*outp,
+                          std::shared_ptr<const hcv_template_plan_st> knownplan = nullptr)
+{
+  double ttl = segc.hcvsegc_ttl.load();
+  double nowt = hcv_monotonic_real_time();
+  std::shared_ptr<const hcv_page_cache_entry_st> entry;
+  {
+    std::shared_lock<std::shared_mutex> gu(segc.hcvsegc_mtx);
+    auto pcit = segc.hcvsegc_dict.find(key);
+    if (pcit != segc.hcvsegc_dict.end() && pcit->second->hcvpce_expiry > nowt)
+      entry = pcit->second;
+  }
+  if (entry)
+    {
+      /// cache hit: only the holes are expanded
+      segc.hcvsegc_hits++;
+      for (const hcv_page_cache_segment_st& seg: entry->hcvpce_segments)
+        {
+          outp->write(seg.hcvpcseg_literal.data(), seg.hcvpcseg_literal.size());
+          if (seg.hcvpcseg_holeix >= 0)
+            hcv_expand_plan_range(*entry->hcvpce_plan, seg.hcvpcseg_holeix,
+                                  hcv_plan_part_extent(*entry->hcvpce_plan, seg.hcvpcseg_holeix),
+                                  templdata, *outp, nullptr);
+        }
+      return true;
+    }
+  /// cache miss: expand the whole plan, noting where the holes are
+  segc.hcvsegc_misses++;
+  auto plan = knownplan?knownplan:hcv_get_template_plan(srcfilepath);
+  if (!plan)
+    return false;
+  auto newentry = std::make_shared<hcv_page_cache_entry_st>();
+  newentry->hcvpce_plan = plan;
+  newentry->hcvpce_expiry = nowt + ttl;
+  std::vector<std::pair<long,long>> holebounds;
+  std::vector<int> holes;
+  long startpos = (long) outp->tellp();
+  /// a whole foreach or if block is a single hole
+  for (int pix=0; pix<(int)plan->hcvplan_parts.size(); )
+    {
+      const hcv_plan_part_st& ppart = plan->hcvplan_parts[pix];
+      int nextix = hcv_plan_part_extent(*plan, pix);
+      bool ishole = ppart.hcvppart_is_pi && !ppart.hcvppart_cacheable;
+      long beforepos = ishole?(long)outp->tellp():0L;
+      hcv_expand_plan_range(*plan, pix, nextix, templdata, *outp, nullptr);
+      if (ishole)
+        {
+          holebounds.push_back({beforepos-startpos, (long)outp->tellp()-startpos});
+          holes.push_back(pix);
+        }
+      pix = nextix;
+    }
+  std::string page = outp->str().substr(startpos);
+  long prevend = 0;
+  for (unsigned hix=0; hix<holes.size(); hix++)
+    {
+      newentry->hcvpce_segments.push_back({page.substr(prevend, holebounds[hix].first-prevend), holes[hix]});
+      prevend = holebounds[hix].second;
+    }
+  newentry->hcvpce_segments.push_back({page.substr(prevend), -1});
+  {
+    std::unique_lock<std::shared_mutex> gu(segc.hcvsegc_mtx);
+    /// forget expired entries, e.g. of previous configuration generations
+    for (auto pcit = segc.hcvsegc_dict.begin(); pcit != segc.hcvsegc_dict.end(); )
+      {
+        if (pcit->second->hcvpce_expiry <= nowt)
+          pcit = segc.hcvsegc_dict.erase(pcit);
+        else
+          pcit++;
+      }
+    segc.hcvsegc_dict[key] = newentry;
+  }
+  HCV_DEBUGOUT("hcv_expand_segment_cached: " << segc.hcvsegc_name << " keeps " << srcfilepath
+               << " with " << holes.size() << " holes for " << ttl << " s");
+  return true;
+} // end hcv_expand_segment_cached
+
+
+std::string
+hcv_expand_cached_template_file(const std::string& srcfilepath, Hcv_template_data* templdata)
+{
+  if (hcv_page_cache.hcvsegc_ttl.load() <= 0.0)
+    return hcv_expand_template_file(srcfilepath, templdata);
+  auto outp = dynamic_cast<std::ostringstream*>(templdata->output_stream());
+  if (outp == nullptr)
+    HCV_FATALOUT("hcv_expand_cached_template_file: bad templdata->output_stream()");
+  templdata->reserve_output(hcv_template_high_water(srcfilepath));
+  std::string key = hcv_page_cache_key(srcfilepath, templdata);
+  long startpos = (long) outp->tellp();
+  if (!hcv_expand_segment_cached(hcv_page_cache, key, srcfilepath, templdata, outp))
+    return hcv_expand_template_file(srcfilepath, templdata);
+  hcv_note_template_high_water(srcfilepath, (long) outp->tellp() - startpos);
+  return outp->str();
+} // end hcv_expand_cached_template_file
+
+
+////////////////////////////////////////////////////////////////
+//// error pages: html/error.html under the web root, or else the
+//// builtin source given by the caller, is planned once. Its expansion
+//// is then kept per status code and language around the holes of
+//// per request processing instructions, so an error page, e.g. in a
+//// storm of 404 from bots, needs no file access and no parsing.
+static bool
+hcv_plan_is_html5(const hcv_template_plan_st&plan)
+{
+  if (plan.hcvplan_parts.empty() || plan.hcvplan_parts[0].hcvppart_is_pi)
+    return false;
+  const hcv_plan_part_st& firstpart = plan.hcvplan_parts[0];
+  return firstpart.hcvppart_len >= strlen(HCV_HTML5_START)
+         && !strncmp(firstpart.hcvppart_text, HCV_HTML5_START, strlen(HCV_HTML5_START));
+} // end hcv_plan_is_html5
+
+
+std::string
+hcv_expand_error_page(int status, const char*builtinsrc, Hcv_template_data*templdata)
+{
+  auto outp = dynamic_cast<std::ostringstream*>(templdata->output_stream());
+  if (outp == nullptr)
+    HCV_FATALOUT("hcv_expand_error_page: bad templdata->output_stream()");
+  std::shared_ptr<const hcv_template_plan_st> plan;
+  {
+    std::lock_guard<std::mutex> gu(hcv_error_page_mtx);
+    double nowt = hcv_monotonic_real_time();
+    if (!hcv_error_page_plan
+        || nowt - hcv_error_page_plan_time >= hcv_error_page_cache.hcvsegc_ttl.load())
+      {
+        std::string errfilpath = hcv_get_web_root() + "html/error.html";
+        auto errplan = hcv_get_template_plan(errfilpath);
+        if (errplan && hcv_plan_is_html5(*errplan))
+          HCV_SYSLOGOUT(LOG_INFO, "hcv_expand_error_page: using " << errfilpath);
+        else
+          {
+            HCV_SYSLOGOUT(LOG_WARNING, "hcv_expand_error_page: no proper " << errfilpath
+                          << ", using the builtin error page");
+            errplan = hcv_get_string_template_plan(builtinsrc?:"", "*builtin-error*");
+            if (!errplan)
+              HCV_FATALOUT("hcv_expand_error_page: bad builtin error page");
+          }
+        /// expansions of the previous plan are forgotten at once
+        if (hcv_error_page_plan && hcv_error_page_plan->hcvplan_source != errplan->hcvplan_source)
+          {
+            std::unique_lock<std::shared_mutex> cu(hcv_error_page_cache.hcvsegc_mtx);
+            hcv_error_page_cache.hcvsegc_dict.clear();
+          }
+        hcv_error_page_plan = errplan;
+        hcv_error_page_plan_time = nowt;
+      }
+    plan = hcv_error_page_plan;
+  }
+  templdata->reserve_output(hcv_template_high_water(plan->hcvplan_path));
+  std::string key = hcv_page_cache_key(plan->hcvplan_path, templdata);
+  key += '\n';
+  key += std::to_string(status);
+  long startpos = (long) outp->tellp();
+  hcv_expand_segment_cached(hcv_error_page_cache, key, plan->hcvplan_path, templdata, outp, plan);
+  hcv_note_template_high_water(plan->hcvplan_path, (long) outp->tellp() - startpos);
+  return outp->str();
+} // end hcv_expand_error_page
+
+
+////////////////////////////////////////////////////////////////
+//// <?hcv include fragment?> expands the fragment file of that path
+//// relative to the web root, e.g. html/fragments/navbar.html, and
+//// <?hcv include fragment per_user?> does the same but caches it per
+//// user segment, see Hcv_http_template_data::user_segment.
+
+#define HCV_INCLUDE_MAXDEPTH 8
+/// full paths of the fragments being included by the current thread
+static thread_local std::vector<std::string> hcv_include_stack;
+
+static void
+hcv_expand_include(Hcv_template_data*templdata, const std::string &procinstr,
+                   const char*filename, int lineno, long offset)
+{
+  if (!templdata || templdata->kind() == Hcv_template_data::TmplKind_en::hcvtk_none)
+    HCV_FATALOUT("no template data for '<?hcv include ...?>' processing instruction "
+                 << procinstr << " in " << filename << ":" << lineno);
+  auto outp = dynamic_cast<std::ostringstream*>(templdata->output_stream());
+  if (outp == nullptr)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "no output stream for '<?hcv include ...?>' processing instruction in "
+                    << filename << ":" << lineno << " @" << offset);
+      return;
+    }
+  char relpath[128];
+  char segmode[16];
+  memset (relpath, 0, sizeof(relpath));
+  memset (segmode, 0, sizeof(segmode));
+  int endpos = -1;
+  int nbscan = sscanf(procinstr.c_str(), "<?hcv include %100[A-Za-z0-9_./-] %12[a-z_] ?>%n",
+                      relpath, segmode, &endpos);
+  if (nbscan < 2)
+    {
+      segmode[0] = (char)0;
+      endpos = -1;
+      nbscan = sscanf(procinstr.c_str(), "<?hcv include %100[A-Za-z0-9_./-] ?>%n",
+                      relpath, &endpos);
+    }
+  if (nbscan < 1 || endpos < (int)procinstr.size()
+      || relpath[0] == '/' || strstr(relpath, "..")
+      || (segmode[0] && strcmp(segmode, "per_user")))
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "invalid include PI " << procinstr
+                    << " at " << filename << ":" << lineno);
+      return;
+    }
+  std::string fragpath = hcv_get_web_root() + relpath;
+  if (hcv_include_stack.size() >= HCV_INCLUDE_MAXDEPTH
+      || std::find(hcv_include_stack.begin(), hcv_include_stack.end(), fragpath)
+      != hcv_include_stack.end())
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "cyclic or too deep include of " << relpath
+                    << " at " << filename << ":" << lineno
+                    << " with " << hcv_include_stack.size() << " nested includes");
+      return;
+    }
+  struct hcv_include_guard_st
+  {
+    hcv_include_guard_st(const std::string&path)
+    {
+      hcv_include_stack.push_back(path);
+    };
+    ~hcv_include_guard_st()
+    {
+      hcv_include_stack.pop_back();
+    };
+  } incguard(fragpath);
+  bool done = false;
+  if (hcv_fragment_cache.hcvsegc_ttl.load() > 0.0)
+    {
+      std::string key = hcv_page_cache_key(fragpath, templdata);
+      if (segmode[0])
+        {
+          key += '\n';
+          if (auto httptempl = dynamic_cast<Hcv_http_template_data*>(templdata))
+            key += httptempl->user_segment();
+        }
+      done = hcv_expand_segment_cached(hcv_fragment_cache, key, fragpath, templdata, outp);
+    }
+  else if (auto plan = hcv_get_template_plan(fragpath))
+    {
+      hcv_expand_template_plan(*plan, templdata, *outp);
+      done = true;
+    }
+  if (!done)
+    HCV_SYSLOGOUT(LOG_WARNING, "cannot include fragment " << fragpath
+                  << " at " << filename << ":" << lineno);
+} // end hcv_expand_include
+
+
+
+////////////////////////////////////////////////////////////////
 std::string
 hcv_expand_template_file(const std::string& srcfilepath, Hcv_template_data* templdata)
 {
@@ -207,6 +1216,21 @@ hcv_expand_template_file(const std::string& srcfilepath, Hcv_template_data* temp
   memset (&srcfilestat, 0, sizeof(srcfilestat));
   if (srcfilepath.empty())
     HCV_FATALOUT("hcv_expand_template_file with empty srcfilepath");
+  {
+    /// prefer the compiled template, if its source is unchanged
+    auto ctit = hcv_compiled_template_dict.find(srcfilepath);
+    if (ctit != hcv_compiled_template_dict.end())
+      {
+        auto outp = dynamic_cast<std::ostringstream*>(templdata->output_stream());
+        if (outp == nullptr)
+          HCV_FATALOUT("hcv_expand_template_file: bad templdata->output_stream()");
+        templdata->reserve_output(hcv_template_high_water(srcfilepath));
+        long startpos = (long) outp->tellp();
+        hcv_expand_template_plan(*ctit->second, templdata, *outp);
+        hcv_note_template_high_water(srcfilepath, (long) outp->tellp() - startpos);
+        return outp->str();
+      }
+  }
   if (srcfilepath[0] != '/')
     HCV_SYSLOGOUT(LOG_WARNING,
                   "hcv_expand_template_file with relative path: " << srcfilepath);
@@ -223,6 +1247,8 @@ hcv_expand_template_file(const std::string& srcfilepath, Hcv_template_data* temp
   auto outp = dynamic_cast<std::ostringstream*>(templdata->output_stream());
   if (outp == nullptr)
     HCV_FATALOUT("hcv_expand_template_file: bad templdata->output_stream()");
+  templdata->reserve_output(hcv_template_high_water(srcfilepath));
+  long startpos = (long) outp->tellp();
 
   //std::ostringstream *outp = outstrptr;
   std::ifstream srcinp(srcfilepath);
@@ -278,6 +1304,7 @@ hcv_expand_template_file(const std::string& srcfilepath, Hcv_template_data* temp
       *outp << std::endl;
     };
   outp->flush();
+  hcv_note_template_high_water(srcfilepath, (long) outp->tellp() - startpos);
 
   return outp->str();
 } // end hcv_expand_template_file
@@ -350,6 +1377,8 @@ hcv_expand_template_string(const std::string&inpstr, const char*inpname, Hcv_tem
 void
 hcv_initialize_templates(void)
 {
+  /// before planning any template
+  hcv_initialize_messages();
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv date?>
   hcv_register_template_expander_closure
@@ -403,7 +1432,7 @@ hcv_initialize_templates(void)
   });
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv html_config configname?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("html_config",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -457,7 +1486,7 @@ hcv_initialize_templates(void)
   }); // end <?hcv request_number?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv gitid?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("gitid",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -475,7 +1504,7 @@ hcv_initialize_templates(void)
   }); // end of <?hcv gitid?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv half_gitid?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("half_gitid",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -506,7 +1535,7 @@ hcv_initialize_templates(void)
   }); // end <?hcv half_gitid?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv lastgitcommit?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("gitid",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -524,7 +1553,7 @@ hcv_initialize_templates(void)
   });
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv timestamp?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("timestamp",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -542,7 +1571,7 @@ hcv_initialize_templates(void)
   }); // end <?hcv timestamp?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv pid?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("pid",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -560,7 +1589,7 @@ hcv_initialize_templates(void)
   }); // end  <?hcv pid?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv hostname?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("hostname",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -622,10 +1651,36 @@ hcv_initialize_templates(void)
       HCV_SYSLOGOUT(LOG_WARNING, "no output stream for '<?hcv request_path?>' processing instruction in "
                     << filename << ":" << lineno<< " @" << offset);
   });				// end <?hcv request_path?>
+  ////////////////////////////////////////////////////////////////
+  //////////////// for <?hcv response_status?>, e.g. 404 Not Found,
+  //////////////// cacheable since error pages are cached per status
+  hcv_register_cacheable_template_expander_closure
+  ("response_status",
+   [](Hcv_template_data*templdata, const std::string &procinstr,
+      const char*filename, int lineno,
+      long offset)
+  {
+    if (!templdata || templdata->kind() == Hcv_template_data::TmplKind_en::hcvtk_none)
+      HCV_FATALOUT("no template data for '<?hcv response_status?>' processing instruction "
+                   << procinstr <<" in "
+                   << filename << ":" << lineno);
+    if (auto pouts = templdata->output_stream())
+      {
+        auto httptempl = dynamic_cast<Hcv_http_template_data*>(templdata);
+        if (httptempl && httptempl->response())
+          {
+            int status = httptempl->response()->status;
+            *pouts << status << ' ' << httplib::detail::status_message(status);
+          }
+      }
+    else
+      HCV_SYSLOGOUT(LOG_WARNING, "no output stream for '<?hcv response_status?>' processing instruction in "
+                    << filename << ":" << lineno<< " @" << offset);
+  });				// end <?hcv response_status?>
 
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv webroot?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("webroot",
    [](Hcv_template_data* templdata, const std::string& procinstr,
       const char* filename, int lineno, long offset)
@@ -644,7 +1699,7 @@ hcv_initialize_templates(void)
   }); /// end <?hcv webroot?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv filename?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("filename",
    [](Hcv_template_data* templdata, const std::string& procinstr,
       const char* filename, int lineno, long offset)
@@ -663,7 +1718,7 @@ hcv_initialize_templates(void)
   }); /// end <?hcv filename?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv lineno?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("lineno",
    [](Hcv_template_data* templdata, const std::string& procinstr,
       const char* filename, int lineno, long offset)
@@ -682,7 +1737,7 @@ hcv_initialize_templates(void)
   }); /// end <?hcv lineno?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv offset?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("offset",
    [](Hcv_template_data* templdata, const std::string& procinstr,
       const char* filename, int lineno, long offset)
@@ -701,7 +1756,7 @@ hcv_initialize_templates(void)
   }); /// end <?hcv offset?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv basefilepos [htmltag] [cssclass]?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("basefilepos",
    [](Hcv_template_data* templdata, const std::string& procinstr,
       const char* filename, int lineno, long offset)
@@ -772,7 +1827,7 @@ hcv_initialize_templates(void)
   }); // end  <?hcv register_form_token?>
   ////////////////////////////////////////////////////////////////
   //////////////// for <?hcv msg ...?>
-  hcv_register_template_expander_closure
+  hcv_register_cacheable_template_expander_closure
   ("msg",
    [](Hcv_template_data*templdata, const std::string &procinstr,
       const char*filename, int lineno,
@@ -809,6 +1864,58 @@ hcv_initialize_templates(void)
                     << filename << ":" << lineno<< " @" << offset
                     << std::endl << procinstr);
   }); // end  <?hcv msg ...?>
+  ////////////////////////////////////////////////////////////////
+  ////////////////////////////////////////////////////////////////
+  //////////////// for <?hcv include fragment?>, a hole in the page cache
+  hcv_register_template_expander_closure("include", hcv_expand_include);
+  ////////////////////////////////////////////////////////////////
+  //////////////// <?hcv foreach rows?>, <?hcv if name?>, <?hcv else?>,
+  //////////////// <?hcv end?> and <?hcv cell column?> are handled by
+  //////////////// hcv_expand_plan_range; these expanders are only used
+  //////////////// when the template could not be planned
+  for (const char*blockname: {"foreach", "if", "else", "end", "cell"})
+    hcv_register_template_expander_closure
+    (blockname,
+     [](Hcv_template_data*templdata HCV_UNUSED, const std::string &procinstr,
+        const char*filename, int lineno,
+        long offset)
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "block processing instruction " << procinstr
+                    << " ignored in unplanned template " << filename << ":" << lineno
+                    << " @" << offset);
+    });
+  ////////////////////////////////////////////////////////////////
+  double pagecachettl = HCV_PAGE_CACHE_DEFAULT_TTL;
+  double fragmentcachettl = HCV_FRAGMENT_CACHE_DEFAULT_TTL;
+  double errorpagecachettl = HCV_ERROR_PAGE_CACHE_DEFAULT_TTL;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (kf->has_group("web") && kf->has_key("web","page_cache_ttl"))
+      pagecachettl = kf->get_double("web","page_cache_ttl");
+    if (kf->has_group("web") && kf->has_key("web","fragment_cache_ttl"))
+      fragmentcachettl = kf->get_double("web","fragment_cache_ttl");
+    if (kf->has_group("web") && kf->has_key("web","error_page_cache_ttl"))
+      errorpagecachettl = kf->get_double("web","error_page_cache_ttl");
+  });
+  if (pagecachettl < 0.0 || std::isnan(pagecachettl))
+    pagecachettl = 0.0;
+  else if (pagecachettl > HCV_PAGE_CACHE_MAXIMAL_TTL)
+    pagecachettl = HCV_PAGE_CACHE_MAXIMAL_TTL;
+  if (fragmentcachettl < 0.0 || std::isnan(fragmentcachettl))
+    fragmentcachettl = 0.0;
+  else if (fragmentcachettl > HCV_FRAGMENT_CACHE_MAXIMAL_TTL)
+    fragmentcachettl = HCV_FRAGMENT_CACHE_MAXIMAL_TTL;
+  if (errorpagecachettl < 0.0 || std::isnan(errorpagecachettl))
+    errorpagecachettl = 0.0;
+  else if (errorpagecachettl > HCV_ERROR_PAGE_CACHE_MAXIMAL_TTL)
+    errorpagecachettl = HCV_ERROR_PAGE_CACHE_MAXIMAL_TTL;
+  hcv_page_cache.hcvsegc_ttl.store(pagecachettl);
+  hcv_fragment_cache.hcvsegc_ttl.store(fragmentcachettl);
+  hcv_error_page_cache.hcvsegc_ttl.store(errorpagecachettl);
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_templates: page cache TTL " << pagecachettl
+                << " s, fragment cache TTL " << fragmentcachettl
+                << " s, error page cache TTL " << errorpagecachettl << " s");
+  hcv_bind_compiled_templates();
 } // end hcv_initialize_templates =======================================
 
 /************* end of file hcv_template.cc in github.com/bstarynk/helpcovid *********/
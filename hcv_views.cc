@@ -41,10 +41,10 @@ hcv_login_view_get(const httplib::Request& req, httplib::Response& resp, long re
   if (req.method != "GET")
     HCV_FATALOUT("hcv_login_view_get() called with non GET request");
 
-  Hcv_http_template_data data(req, resp, reqnum);
+  Hcv_http_render_context data(req, resp, reqnum);
   std::string thtml = hcv_get_web_root() + "html/login.html";
 
-  return hcv_expand_template_file(thtml, &data);
+  return hcv_expand_cached_template_file(thtml, data.get());
 } // end hcv_login_view_get
 
 
@@ -53,21 +53,53 @@ hcv_login_view_post(const httplib::Request& req,  httplib::Response& resp, long
 {
   if (req.method != "POST")
     HCV_FATALOUT("hcv_login_view_post() called with not POST request");
-  Hcv_http_template_data data(req, resp, reqnum);
+  Hcv_http_render_context data(req, resp, reqnum);
 
   auto email = req.get_param_value("email");
   auto passwd = req.get_param_value("password");
-  bool status = hcv_user_model_authenticate(email, passwd);
+  bool status = false;
+  bool overloaded = false;
+  try
+    {
+      /// hashing runs on the password threads, not on this web worker
+      std::future<bool> fut = hcv_user_model_authenticate_async(email, passwd);
+      double remaining = hcv_request_remaining_time();
+      if (remaining < HUGE_VAL
+          && fut.wait_for(std::chrono::duration<double>(std::max(remaining, 0.0)))
+          != std::future_status::ready)
+        throw Hcv_deadline_exceeded("login password verification");
+      status = fut.get();
+    }
+  catch (Hcv_password_overloaded&)
+    {
+      /// refused at once, without waiting
+      overloaded = true;
+      resp.status = 503;
+      resp.set_header("Retry-After", "1");
+    }
   HCV_DEBUGOUT("hcv_login_view_post reqpath:" << req.path
                << " req#" << reqnum
                << " email=" << email
-               << " passwd=" << passwd
-               << " status=" << status);
+               << " status=" << status
+               << (overloaded?" overloaded":""));
 
   std::string msg_en = status ? "OK" : "Your e-mail address and password do not"
                        " match. Please try again.";
   std::string msg_fr = status ? "OK" : "Votre adresse e-mail et votre mot de"
                        "  passe ne correspondent pas. Veuillez réessayer.";
+  if (overloaded)
+    {
+      msg_en = "Too many logins right now. Please try again in a moment.";
+      msg_fr = "Trop de connexions en ce moment. Veuillez réessayer dans un instant.";
+    }
+
+  /// an authenticated user keeps a database cookie, even with [web]
+  /// cookie_mode=signed; it is then found by hcv_web_session_of_request
+  if (status)
+    {
+      std::string cookiestr = hcv_web_register_persistent_cookie(data.get());
+      HCV_DEBUGOUT("hcv_login_view_post req#" << reqnum << " cookiestr=" << cookiestr);
+    }
 
   Json::StreamWriterBuilder jstr;
   Json::Value jsob(Json::objectValue);
@@ -75,7 +107,6 @@ hcv_login_view_post(const httplib::Request& req,  httplib::Response& resp, long
   jsob["msg_en"] = msg_en;
   jsob["msg_fr"] = msg_fr;
 
-#warning cookie setting needs to be implemented.
   return Json::writeString(jstr, jsob);
 
 #if 0
@@ -87,7 +118,7 @@ hcv_login_view_post(const httplib::Request& req,  httplib::Response& resp, long
   else
     thtml = hcv_get_web_root() + "html/error.html";
 
-  return hcv_expand_template_file(thtml, &data);
+  return hcv_expand_template_file(thtml, data.get());
 #warning cookie setting needs to be implemented.
 #endif
 } // end hcv_login_view_post
@@ -102,11 +133,11 @@ hcv_home_view_get(const httplib::Request& req, httplib::Response& resp, long req
   HCV_DEBUGOUT("hcv_home_view_get start '" << req.path << "' req#" << reqcnt);
   //
   // return login .html for now
-  Hcv_http_template_data webdata(req, resp, reqcnt);
+  Hcv_http_render_context webdata(req, resp, reqcnt);
   std::string thtml = hcv_get_web_root() + "html/login.html";
-  auto res =  hcv_expand_template_file(thtml, &webdata);
+  auto res =  hcv_expand_cached_template_file(thtml, webdata.get());
   HCV_ASSERT(res.size() < HCV_HTML_RESPONSE_MAX_LEN);
-  hcv_web_forget_cookie(&webdata);
+  hcv_web_forget_cookie(webdata.get());
   HCV_DEBUGOUT("hcv_home_view_get '" << req.path << "' req#" << reqcnt
                << " response size=" << res.size());
   return res;
@@ -144,9 +175,16 @@ hcv_register_view_get(const httplib::Request& req, httplib::Response& resp, long
   if (req.method != "GET")
     HCV_FATALOUT("hcv_register_view_get() called with non GET request");
 
-  Hcv_http_template_data data(req, resp, reqnum);
+  Hcv_http_render_context data(req, resp, reqnum);
   std::string thtml = hcv_get_web_root() + "html/register.html";
-  std::string cookiestr= hcv_web_register_fresh_cookie(&data);
+  /// a returning visitor keeps a still valid cookie, so reloading the
+  /// form does not fill the session table
+  std::string cookiestr;
+  hcv_web_session_st sess;
+  if (hcv_web_session_of_request(req, &sess))
+    cookiestr = "kept";
+  else
+    cookiestr = hcv_web_register_fresh_cookie(data.get());
   HCV_DEBUGOUT("hcv_register_view_get reqpath:" << req.path
                << " req#" << reqnum
                << " cookiestr=" << cookiestr);
@@ -155,7 +193,7 @@ hcv_register_view_get(const httplib::Request& req, httplib::Response& resp, long
                 "hcv_register_view_get incomplete "
                 << req.path << " req#" << reqnum);
   /// notice that  <?hcv register_form_token?> is likely to be expanded below
-  return hcv_expand_template_file(thtml, &data);
+  return hcv_expand_cached_template_file(thtml, data.get());
 } // end hcv_register_view_get
 
 
@@ -169,7 +207,7 @@ hcv_register_view_post(const httplib::Request& req,  httplib::Response& resp, lo
   std::string jsonres;
   if (req.method != "POST")
     HCV_FATALOUT("hcv_register_view_post() not called with POST request");
-  Hcv_http_template_data data(req, resp, reqnum);
+  Hcv_http_render_context data(req, resp, reqnum);
   auto regtokenstr = req.get_param_value("registerToken");
   auto firstnamestr = req.get_param_value("inputFirstName");
   auto lastnamestr = req.get_param_value("inputLastName");
@@ -179,7 +217,21 @@ hcv_register_view_post(const httplib::Request& req,  httplib::Response& resp, lo
   auto phonestr = req.get_param_value("inputPhone");
   auto emailstr = req.get_param_value("inputEmail");
   auto agreestr = req.get_param_value("registerAgree");
-  auto cookiestr = req.get_header_value("Set-Cookie");
+  auto cookiestr = req.get_header_value("Cookie");
+  /// the form was given with a fresh cookie by hcv_register_view_get;
+  /// a POST without it, or with a forged or expired one, is refused
+  hcv_web_session_st sess;
+  if (!hcv_web_session_of_request(req, &sess))
+    {
+      HCV_SYSLOGOUT(LOG_NOTICE, "hcv_register_view_post req#" << reqnum
+                    << " without valid cookie");
+      resp.status = 403;
+      Json::Value jsob(Json::objectValue);
+      jsob["status"] = false;
+      jsob["msg_en"] = "Your session has expired. Please reload the page.";
+      jsob["msg_fr"] = "Votre session a expiré. Veuillez recharger la page.";
+      return Json::writeString(hcv_get_json_builder(), jsob);
+    }
   HCV_DEBUGOUT("hcv_register_view_post reqpath:" << req.path
                << " req#" << reqnum << std::endl
                << " .. regtoken=" << regtokenstr << std::endl
@@ -214,7 +266,7 @@ hcv_register_view_post(const httplib::Request& req,  httplib::Response& resp, lo
                << jsonres);
 #warning hcv_register_view_post unimplemented
   return jsonres;
-  ///  return hcv_expand_template_file(thtml, &data);
+  ///  return hcv_expand_template_file(thtml, data.get());
 } // end hcv_register_view_post
 
 
@@ -225,12 +277,12 @@ hcv_profile_view_get(const httplib::Request& req, httplib::Response& resp,
   if (req.method != "GET")
     HCV_FATALOUT("hcv_profile_view_get() called with non GET request");
 
-  Hcv_http_template_data data(req, resp, reqnum);
+  Hcv_http_render_context data(req, resp, reqnum);
   std::string thtml = hcv_get_web_root() + "html/profile.html";
   HCV_DEBUGOUT("hcv_profile_view_get reqpath:" << req.path
                << " req#" << reqnum);
 
-  std::string str = hcv_expand_template_file(thtml, &data);
+  std::string str = hcv_expand_template_file(thtml, data.get());
   HCV_DEBUGOUT("hcv_profile_view_get reqpath:" << req.path
                << " req#" << reqnum << " gives " << str.size() << " bytes");
   return str;
@@ -260,25 +312,19 @@ hcv_view_expand_msg(Hcv_http_template_data*tdata, const std::string &procinstr,
       const char*begmsg = procinstr.c_str() + endp;
       const char*endmsg = strstr(begmsg, "?>");
       HCV_ASSERT(endmsg != nullptr);
-      /// see http://man7.org/linux/man-pages/man7/locale.7.html
-      /// see http://man7.org/linux/man-pages/man5/locale.5.html
-      /// see http://man7.org/linux/man-pages/man3/dgettext.3.html
-      char* localizedmsg = dgettext(HCV_DGETTEXT_DOMAIN, msgidbuf);
-      if (localizedmsg && strcmp(localizedmsg, msgidbuf))
-        {
-          HCV_DEBUGOUT("hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << " => " << localizedmsg);
-          return std::string(localizedmsg);
-        }
-      else
-        {
-          HCV_SYSLOGOUT(LOG_NOTICE, "hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                        << " not found");
-          std::string rawmsg(begmsg, endmsg-begmsg);
-          HCV_DEBUGOUT("hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
-                       << ":::" << rawmsg);
-          return rawmsg;
-        }
+      /// the message catalog of the negotiated language, see hcv_i18n.cc
+      int langix = tdata->language_index();
+      if (const char*catalogmsg = hcv_message_text(langix, hcv_message_slot(msgidbuf)))
+        return std::string(catalogmsg);
+      /// otherwise the literal (English) text, never dgettext(3): the
+      /// process locale might not be the language of the request
+      if (langix >= 0)
+        HCV_SYSLOGOUT(LOG_NOTICE, "hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
+                      << " not translated in " << hcv_language_name(langix));
+      std::string rawmsg(begmsg, endmsg-begmsg);
+      HCV_DEBUGOUT("hcv_view_expand_msg msgidbuf=" << msgidbuf << " at "  << filename << ":" << lineno
+                   << ":::" << rawmsg);
+      return rawmsg;
     }
   else
     {
@@ -26,6 +26,12 @@
  ******************************************************************************/
 
 #include "hcv_header.hh"
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif /*__x86_64__*/
 
 extern "C" const char hcv_web_gitid[] = HELPCOVID_GITID;
 extern "C" const char hcv_web_date[] = __DATE__;
@@ -41,6 +47,43 @@ std::string hcv_webroot;
 std::atomic<long> hcv_web_request_counter;
 Json::StreamWriterBuilder hcv_json_builder;
 
+/// from [web] negative_cache_ttl, see hcv_web_serve_static_file
+#define HCV_WEB_NEGATIVE_CACHE_DEFAULT_TTL 60.0
+#define HCV_WEB_NEGATIVE_CACHE_MAXIMAL_TTL 3600.0
+static std::atomic<double> hcv_web_negative_ttl;
+
+/// from [web] cookie_mode, cookie_key_file and cookie_key_rotation,
+/// see hcv_web_rotate_cookie_key
+#define HCV_WEB_COOKIE_KEY_LEN 32
+#define HCV_WEB_COOKIE_SECRET_MINIMAL_LEN 32
+#define HCV_WEB_COOKIE_SECRET_MAXIMAL_LEN 4096
+#define HCV_WEB_COOKIE_MAC_HEXLEN 32 /* the HMAC is truncated to 128 bits */
+#define HCV_WEB_COOKIE_KEY_DEFAULT_ROTATION 21600.0 /*seconds*/
+#define HCV_WEB_COOKIE_KEY_MINIMAL_ROTATION 5400.0 /* hcv_web_cookie_duration */
+#define HCV_WEB_COOKIE_KEY_MAXIMAL_ROTATION 604800.0
+static std::atomic<bool> hcv_web_signed_cookies;
+static std::atomic<double> hcv_web_cookie_key_rotation
+{
+  HCV_WEB_COOKIE_KEY_DEFAULT_ROTATION
+};
+static void hcv_web_load_cookie_secret(const std::string&path);
+
+/// the budget in seconds of every route, from [web] request_deadline
+/// and request_deadline_<route>, e.g. request_deadline_login; filled by
+/// hcv_initialize_web then only read
+#define HCV_WEB_DEFAULT_REQUEST_DEADLINE 10.0 /*seconds*/
+#define HCV_WEB_MAXIMAL_REQUEST_DEADLINE 600.0 /*seconds*/
+static const char*const hcv_web_routes[] =
+{
+  "status", "ajax", "root", "login", "register", "profile", "static", nullptr
+};
+static std::map<std::string,double> hcv_web_route_budgets;
+static std::atomic<long> hcv_web_deadline_exceeded_count;
+
+thread_local double hcv_request_deadline_time;
+/// set when a handler throws past its deadline, for the error handler
+static thread_local bool hcv_web_deadline_thrown;
+
 
 extern "C" std::string
 hcv_get_web_root(void)
@@ -118,8 +161,85 @@ void hcv_initialize_web(const std::string&weburl, const std::string&webroot, con
   hcv_webroot = webroot;
   hcv_json_builder["commentStyle"] = "None";
   hcv_json_builder["indentation"] = " ";
+  /// cheap enough to always run; exhaustive only when debugging
+  hcv_check_encoded_html(hcv_debugging.load());
+  if (hcv_debugging.load())
+    {
+      HCV_DEBUGOUT("hcv_initialize_web: HTML encoding takes " << hcv_benchmark_encoded_html(false, 2000)
+                   << " ns/byte, was " << hcv_benchmark_encoded_html(true, 2000) << " ns/byte");
+    }
 
-  hcv_webserver->set_mount_point("/", webroot.c_str());
+  if (!httplib::detail::is_dir(webroot))
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_initialize_web: webroot " << webroot << " is not a directory");
+  double negttl = HCV_WEB_NEGATIVE_CACHE_DEFAULT_TTL;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (kf->has_group("web") && kf->has_key("web","negative_cache_ttl"))
+      negttl = kf->get_double("web","negative_cache_ttl");
+  });
+  if (negttl < 0.0 || std::isnan(negttl))
+    negttl = 0.0;
+  else if (negttl > HCV_WEB_NEGATIVE_CACHE_MAXIMAL_TTL)
+    negttl = HCV_WEB_NEGATIVE_CACHE_MAXIMAL_TTL;
+  hcv_web_negative_ttl.store(negttl);
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_web: negative lookup cache TTL " << negttl << " s");
+  std::string cookiemode = "database";
+  std::string cookiekeyfile;
+  double keyrotation = HCV_WEB_COOKIE_KEY_DEFAULT_ROTATION;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("web"))
+      return;
+    if (kf->has_key("web","cookie_mode"))
+      cookiemode = kf->get_string("web","cookie_mode");
+    if (kf->has_key("web","cookie_key_file"))
+      cookiekeyfile = kf->get_string("web","cookie_key_file");
+    if (kf->has_key("web","cookie_key_rotation"))
+      keyrotation = kf->get_double("web","cookie_key_rotation");
+  });
+  if (cookiemode != "database" && cookiemode != "signed")
+    HCV_FATALOUT("hcv_initialize_web: bad [web] cookie_mode " << cookiemode
+                 << ", should be database or signed");
+  if (keyrotation < HCV_WEB_COOKIE_KEY_MINIMAL_ROTATION || std::isnan(keyrotation))
+    keyrotation = HCV_WEB_COOKIE_KEY_MINIMAL_ROTATION;
+  else if (keyrotation > HCV_WEB_COOKIE_KEY_MAXIMAL_ROTATION)
+    keyrotation = HCV_WEB_COOKIE_KEY_MAXIMAL_ROTATION;
+  hcv_web_cookie_key_rotation.store(keyrotation);
+  hcv_web_signed_cookies.store(cookiemode == "signed");
+  if (!cookiekeyfile.empty())
+    hcv_web_load_cookie_secret(cookiekeyfile);
+  hcv_web_rotate_cookie_key();
+  HCV_SYSLOGOUT(LOG_INFO, "hcv_initialize_web: " << cookiemode << " web cookies, "
+                << (cookiekeyfile.empty()?std::string("random key"):("key from " + cookiekeyfile))
+                << " rotated every " << keyrotation << " s");
+  double defaultbudget = HCV_WEB_DEFAULT_REQUEST_DEADLINE;
+  hcv_config_do([&](const Glib::KeyFile*kf)
+  {
+    if (!kf->has_group("web"))
+      return;
+    if (kf->has_key("web","request_deadline"))
+      defaultbudget = kf->get_double("web","request_deadline");
+    for (const char*const*proute = hcv_web_routes; *proute; proute++)
+      {
+        std::string key = std::string("request_deadline_") + *proute;
+        if (kf->has_key("web", key))
+          hcv_web_route_budgets[*proute] = kf->get_double("web", key);
+      }
+  });
+  for (const char*const*proute = hcv_web_routes; *proute; proute++)
+    {
+      auto it = hcv_web_route_budgets.find(*proute);
+      double budget = (it == hcv_web_route_budgets.end())?defaultbudget:it->second;
+      /// a non positive budget means no deadline
+      if (std::isnan(budget) || budget < 0.0)
+        budget = 0.0;
+      else if (budget > HCV_WEB_MAXIMAL_REQUEST_DEADLINE)
+        budget = HCV_WEB_MAXIMAL_REQUEST_DEADLINE;
+      hcv_web_route_budgets[*proute] = budget;
+      HCV_DEBUGOUT("hcv_initialize_web: route " << *proute << " has a deadline of " << budget << " s");
+    }
+  /// static files are served by hcv_web_serve_static_file, the last
+  /// GET handler registered in hcv_webserver_run
 } // end hcv_initialize_web
 
 
@@ -140,33 +260,201 @@ hcv_initialize_webserver(void)
 #warning hcv_initialize_webserver unimplemented
 } // end of hcv_initialize_webserver
 
-void
-hcv_output_encoded_html(std::ostream&out, const std::string&str)
+////////////////////////////////////////////////////////////////
+//// HTML encoding of user supplied strings. We scan 16 (SSE2) or 32
+//// (AVX2) bytes at a time for the five special characters <>&'" and
+//// bulk-write the clean runs in between. The implementation is chosen
+//// once at runtime. Notice that (c|2)=='>' only for < and >, and
+//// (c|1)=='\'' only for & and ', so three comparisons are enough.
+
+typedef size_t hcv_html_special_finder_sig_t(const char*buf, size_t len);
+
+static inline bool
+hcv_is_html_special(char c)
+{
+  return ((c|2) == '>') || ((c|1) == '\'') || (c == '"');
+} // end hcv_is_html_special
+
+/// return the index of the first special character in buf, or len
+static size_t
+hcv_find_html_special_scalar(const char*buf, size_t len)
+{
+  for (size_t ix=0; ix<len; ix++)
+    if (HCV_UNLIKELY(hcv_is_html_special(buf[ix])))
+      return ix;
+  return len;
+} // end hcv_find_html_special_scalar
+
+#if defined(__x86_64__) && defined(__GNUC__)
+static size_t
+hcv_find_html_special_sse2(const char*buf, size_t len)
 {
-  for (char c: str)
+  const __m128i vgt = _mm_set1_epi8('>');
+  const __m128i vap = _mm_set1_epi8('\'');
+  const __m128i vqu = _mm_set1_epi8('"');
+  const __m128i vtwo = _mm_set1_epi8(2);
+  const __m128i vone = _mm_set1_epi8(1);
+  size_t ix = 0;
+  for (; ix+16 <= len; ix += 16)
     {
-      switch(c)
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf+ix));
+      __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_or_si128(v, vtwo), vgt),
+                               _mm_or_si128(_mm_cmpeq_epi8(_mm_or_si128(v, vone), vap),
+                                   _mm_cmpeq_epi8(v, vqu)));
+      unsigned mask = (unsigned)_mm_movemask_epi8(m);
+      if (mask)
+        return ix + __builtin_ctz(mask);
+    }
+  return ix + hcv_find_html_special_scalar(buf+ix, len-ix);
+} // end hcv_find_html_special_sse2
+
+__attribute__((target("avx2")))
+static size_t
+hcv_find_html_special_avx2(const char*buf, size_t len)
+{
+  const __m256i vgt = _mm256_set1_epi8('>');
+  const __m256i vap = _mm256_set1_epi8('\'');
+  const __m256i vqu = _mm256_set1_epi8('"');
+  const __m256i vtwo = _mm256_set1_epi8(2);
+  const __m256i vone = _mm256_set1_epi8(1);
+  size_t ix = 0;
+  for (; ix+32 <= len; ix += 32)
+    {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf+ix));
+      __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_or_si256(v, vtwo), vgt),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_or_si256(v, vone), vap),
+                                      _mm256_cmpeq_epi8(v, vqu)));
+      unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+      if (mask)
+        return ix + __builtin_ctz(mask);
+    }
+  return ix + hcv_find_html_special_sse2(buf+ix, len-ix);
+} // end hcv_find_html_special_avx2
+#endif /*__x86_64__*/
+
+static size_t hcv_find_html_special_resolve(const char*buf, size_t len);
+
+static std::atomic<hcv_html_special_finder_sig_t*> hcv_find_html_special_ptr
+{
+  hcv_find_html_special_resolve
+};
+
+static hcv_html_special_finder_sig_t*
+hcv_best_html_special_finder(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return hcv_find_html_special_avx2;
+  return hcv_find_html_special_sse2; // every x86-64 has SSE2
+#else
+  return hcv_find_html_special_scalar;
+#endif /*__x86_64__*/
+} // end hcv_best_html_special_finder
+
+/// the first call chooses the implementation
+static size_t
+hcv_find_html_special_resolve(const char*buf, size_t len)
+{
+  hcv_html_special_finder_sig_t* finder = hcv_best_html_special_finder();
+  hcv_find_html_special_ptr.store(finder);
+  return (*finder)(buf, len);
+} // end hcv_find_html_special_resolve
+
+static inline const char*
+hcv_html_entity(char c)
+{
+  switch(c)
+    {
+    case '<':
+      return "&lt;";
+    case '>':
+      return "&gt;";
+    case '\'':
+      return "&apos;";
+    case '&':
+      return "&amp;";
+    case '\"':
+      return "&quot;";
+    default:
+      return nullptr;
+    }
+} // end hcv_html_entity
+
+/// encode with a given finder, so every finder can be checked
+static void
+hcv_output_encoded_html_with(hcv_html_special_finder_sig_t* finder,
+                             std::ostream&out, const char*buf, size_t len)
+{
+  /// clean runs and entities are gathered in a local buffer, so the
+  /// ostream is written once per kilobyte or so
+  char obuf[1024];
+  size_t olen = 0;
+  while (len > 0)
+    {
+      size_t cleanlen = (*finder)(buf, len);
+      if (cleanlen > 0)
         {
-        case '<':
-          out << "&lt;";
-          break;
-        case '>':
-          out << "&gt;";
-          break;
-        case '\'':
-          out << "&apos;";
-          break;
-        case '&':
-          out << "&amp;";
-          break;
-        case '\"':
-          out << "&quot;";
-          break;
-        default:
-          out << c;
-          break;
+          /// long runs are written directly, after what is pending
+          if (olen > 0 && (olen + cleanlen > sizeof(obuf) || cleanlen >= sizeof(obuf)/2))
+            {
+              out.write(obuf, olen);
+              olen = 0;
+            }
+          if (cleanlen >= sizeof(obuf)/2)
+            out.write(buf, cleanlen);
+          else
+            {
+              memcpy(obuf+olen, buf, cleanlen);
+              olen += cleanlen;
+            }
         }
+      if (cleanlen == len)
+        break;
+      const char*ent = hcv_html_entity(buf[cleanlen]);
+      size_t entlen = strlen(ent);
+      if (olen + entlen > sizeof(obuf))
+        {
+          out.write(obuf, olen);
+          olen = 0;
+        }
+      memcpy(obuf+olen, ent, entlen);
+      olen += entlen;
+      buf += cleanlen+1;
+      len -= cleanlen+1;
     }
+  if (olen > 0)
+    out.write(obuf, olen);
+} // end hcv_output_encoded_html_with
+
+void
+hcv_output_encoded_html_buffer(std::ostream&out, const char*buf, size_t len)
+{
+  hcv_output_encoded_html_with(hcv_find_html_special_ptr.load(std::memory_order_relaxed),
+                               out, buf, len);
+} // end hcv_output_encoded_html_buffer
+
+void
+hcv_append_encoded_html(std::string&outstr, const char*buf, size_t len)
+{
+  hcv_html_special_finder_sig_t* finder = hcv_find_html_special_ptr.load(std::memory_order_relaxed);
+  while (len > 0)
+    {
+      size_t cleanlen = (*finder)(buf, len);
+      if (cleanlen > 0)
+        outstr.append(buf, cleanlen);
+      if (cleanlen == len)
+        break;
+      outstr.append(hcv_html_entity(buf[cleanlen]));
+      buf += cleanlen+1;
+      len -= cleanlen+1;
+    }
+} // end hcv_append_encoded_html
+
+void
+hcv_output_encoded_html(std::ostream&out, const std::string&str)
+{
+  hcv_output_encoded_html_buffer(out, str.c_str(), str.size());
 } // end hcv_output_encoded_html
 
 
@@ -175,9 +463,18 @@ hcv_output_cstr_encoded_html(std::ostream&out, const char*cstr)
 {
   if (!cstr)
     return;
-  for (const char*pc=cstr; *pc; pc++)
+  hcv_output_encoded_html_buffer(out, cstr, strlen(cstr));
+} // end hcv_output_cstr_encoded_html
+
+
+/// the former byte per byte encoder, kept as a reference
+static void
+hcv_output_encoded_html_reference(std::ostream&out, const char*buf, size_t len)
+{
+  for (size_t ix=0; ix<len; ix++)
     {
-      switch(*pc)
+      char c = buf[ix];
+      switch(c)
         {
         case '<':
           out << "&lt;";
@@ -195,49 +492,202 @@ hcv_output_cstr_encoded_html(std::ostream&out, const char*cstr)
           out << "&quot;";
           break;
         default:
-          out << *pc;
+          out << c;
           break;
         }
     }
-} // end hcv_output_cstr_encoded_html
+} // end hcv_output_encoded_html_reference
 
 
-///////////////////////////// HTTP error handler, uses html/error.html when available
+/// compare every available finder, and the whole encoders using
+/// them, with the reference encoder. The finders are exhaustively
+/// checked on every byte value at every position of buffers up to 64
+/// bytes, at various alignments, only when asked, since that takes a
+/// while. The whole encoders are always checked, on random strings
+/// mixing specials with clean runs longer than their local buffer.
+/// Fatal on mismatch.
 void
-hcv_web_error_handler(const httplib::Request& req,
-                      httplib::Response& resp, long reqnum)
+hcv_check_encoded_html(bool exhaustive)
 {
-  Hcv_http_template_data webdata(req,resp,reqnum);
-  HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_error_handler reqnum=" << reqnum << " req." << req.method << " path=" << req.path);
-  std::string outhtmlstr;
-  bool goodhtml = false;
-  std::string errfilpath;
-  if (!hcv_webroot.empty() && hcv_webroot[0] == '/')
+  std::vector<std::pair<const char*,hcv_html_special_finder_sig_t*>> finders;
+  finders.push_back({"scalar", hcv_find_html_special_scalar});
+#if defined(__x86_64__) && defined(__GNUC__)
+  finders.push_back({"sse2", hcv_find_html_special_sse2});
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    finders.push_back({"avx2", hcv_find_html_special_avx2});
+#endif /*__x86_64__*/
+  constexpr unsigned maxlen = 64, maxalign = 17;
+  char rawbuf[maxlen+maxalign+8];
+  double startim = hcv_monotonic_real_time();
+  long nbchecks = 0;
+  for (auto& fin: finders)
+    for (unsigned align=0; exhaustive && align<maxalign; align++)
+      for (unsigned len=0; len<=maxlen; len++)
+        {
+          char*buf = rawbuf+align;
+          memset(rawbuf, 'a', sizeof(rawbuf));
+          if ((*fin.second)(buf, len) != len)
+            HCV_FATALOUT("hcv_check_encoded_html: " << fin.first << " failed on clean buffer len=" << len
+                         << " align=" << align);
+          for (unsigned pos=0; pos<len; pos++)
+            for (int b=0; b<256; b++)
+              {
+                /// other alignments only with special bytes, their
+                /// neighbours and a few others
+                if (align>0 && !hcv_is_html_special((char)b)
+                    && !hcv_is_html_special((char)(b+1)) && !hcv_is_html_special((char)(b-1))
+                    && b!=0 && b!=0x7f && b!=0x80 && b!=0xff)
+                  continue;
+                buf[pos] = (char)b;
+                size_t expected = hcv_is_html_special((char)b)?pos:len;
+                size_t got = (*fin.second)(buf, len);
+                if (got != expected)
+                  HCV_FATALOUT("hcv_check_encoded_html: " << fin.first << " failed on byte " << b
+                               << " at pos " << pos << " len=" << len << " align=" << align
+                               << ", got " << got << " expected " << expected);
+                if (pos+1<len && expected==pos)
+                  {
+                    buf[len-1] = '&';
+                    if ((*fin.second)(buf, len) != pos)
+                      HCV_FATALOUT("hcv_check_encoded_html: " << fin.first << " failed on two specials at "
+                                   << pos << " and " << (len-1));
+                    buf[len-1] = 'a';
+                  }
+                buf[pos] = 'a';
+                nbchecks++;
+              }
+        }
+  /// then compare the whole encoding of random strings with the
+  /// reference; some are made of pieces, short ones with specials and
+  /// clean runs around or beyond half the local buffer of the encoder
+  for (int cnt=0; cnt<600; cnt++)
     {
-      errfilpath = hcv_webroot + "/html/error.html";
-      if (auto ferr= fopen(errfilpath.c_str(), "r"))
+      std::string str;
+      unsigned nbpieces = (cnt%3==0) ? 1 : (1 + Hcv_Random::random_32u() % 6);
+      for (unsigned pc=0; pc<nbpieces; pc++)
         {
-          char firstlinbuf[80];
-          memset (firstlinbuf, 0, sizeof(firstlinbuf));
-          fgets(firstlinbuf, sizeof(firstlinbuf), ferr);
-          if (!strncmp(firstlinbuf, HCV_HTML5_START, strlen(HCV_HTML5_START)))
-            goodhtml = true;
-          fclose(ferr);
-        };
-    };
-  if (goodhtml)
-    outhtmlstr = hcv_expand_template_file(errfilpath, &webdata);
+          bool longrun = (cnt%3!=0) && (pc%2==1);
+          unsigned len = longrun ? (400 + Hcv_Random::random_32u() % 1700)
+                         : (Hcv_Random::random_32u() % 300);
+          for (unsigned ix=0; ix<len; ix++)
+            {
+              uint8_t r = Hcv_Random::random_quickly_8bits();
+              if (longrun || (r&0xc0))
+                str.push_back((char)('a'+(r%26)));
+              else
+                str.push_back("<>&'\"xyz\0\n"[r%10]);
+            }
+        }
+      std::ostringstream refouts;
+      hcv_output_encoded_html_reference(refouts, str.c_str(), str.size());
+      for (auto& fin: finders)
+        {
+          std::ostringstream outs;
+          hcv_output_encoded_html_with(fin.second, outs, str.c_str(), str.size());
+          if (refouts.str() != outs.str())
+            HCV_FATALOUT("hcv_check_encoded_html: " << fin.first << " encoder mismatch on random string #"
+                         << cnt << " of " << str.size() << " bytes");
+          nbchecks++;
+        }
+      std::ostringstream outs;
+      std::string appstr;
+      hcv_output_encoded_html(outs, str);
+      hcv_append_encoded_html(appstr, str.c_str(), str.size());
+      if (refouts.str() != outs.str() || refouts.str() != appstr)
+        HCV_FATALOUT("hcv_check_encoded_html: mismatch on random string #" << cnt << " of "
+                     << str.size() << " bytes");
+      nbchecks++;
+    }
+  HCV_DEBUGOUT("hcv_check_encoded_html: " << nbchecks << " checks on " << finders.size()
+               << " finders passed in " << (hcv_monotonic_real_time() - startim) << " s"
+               << (exhaustive?" exhaustively":""));
+} // end hcv_check_encoded_html
+
+
+/// microbenchmark of HTML encoding: returns nanoseconds per input byte
+/// for the reference encoder (when withref) or the current one, on
+/// some realistic string with few special characters, repeated
+/// nbrepeat times. Used by hcv_check_encoded_html callers and
+/// benchmarks.
+double
+hcv_benchmark_encoded_html(bool withref, long nbrepeat)
+{
+  std::string sample;
+  while (sample.size() < 4000)
+    sample += "Jean-Pierre O'Connor <jp.oconnor@example.org> lives at 12 rue des Lilas & needs \"groceries\"; ";
+  std::ostringstream outs;
+  double startim = hcv_monotonic_real_time();
+  for (long cnt=0; cnt<nbrepeat; cnt++)
+    {
+      outs.str("");
+      if (withref)
+        hcv_output_encoded_html_reference(outs, sample.c_str(), sample.size());
+      else
+        hcv_output_encoded_html(outs, sample);
+    }
+  double elapsed = hcv_monotonic_real_time() - startim;
+  return (elapsed * 1.0e9) / ((double)nbrepeat * sample.size());
+} // end hcv_benchmark_encoded_html
+
+
+///////////////////////////// render contexts, pooled per worker thread
+#define HCV_RENDER_POOL_MAXSIZE 4
+/// free template data of the current thread, reset when leased
+static thread_local std::vector<std::unique_ptr<Hcv_http_template_data>> hcv_render_pool;
+static std::atomic<long> hcv_render_created_count;
+static std::atomic<long> hcv_render_reused_count;
+
+Hcv_http_render_context::Hcv_http_render_context(const httplib::Request& req, httplib::Response&resp, long reqnum)
+  : _hcvrctx_data(nullptr)
+{
+  if (!hcv_render_pool.empty())
+    {
+      _hcvrctx_data = hcv_render_pool.back().release();
+      hcv_render_pool.pop_back();
+      _hcvrctx_data->reset(&req, &resp, reqnum);
+      hcv_render_reused_count++;
+    }
   else
     {
-      constexpr const char builtin_error_html[] =
-        R"builtinerror(<!DOCTYPE html>
+      _hcvrctx_data = new Hcv_http_template_data(req, resp, reqnum);
+      hcv_render_created_count++;
+    }
+} // end Hcv_http_render_context::Hcv_http_render_context
+
+
+Hcv_http_render_context::~Hcv_http_render_context()
+{
+  /// forget the request, but keep the output buffer
+  _hcvrctx_data->reset(nullptr, nullptr, 0);
+  if (hcv_render_pool.size() < HCV_RENDER_POOL_MAXSIZE)
+    hcv_render_pool.emplace_back(_hcvrctx_data);
+  else
+    delete _hcvrctx_data;
+  _hcvrctx_data = nullptr;
+} // end Hcv_http_render_context::~Hcv_http_render_context
+
+
+void
+hcv_render_context_statistics(long*pnbcreated, long*pnbreused)
+{
+  if (pnbcreated)
+    *pnbcreated = hcv_render_created_count.load();
+  if (pnbreused)
+    *pnbreused = hcv_render_reused_count.load();
+} // end hcv_render_context_statistics
+
+
+///////////////////////////// HTTP error handler, uses html/error.html when available
+static constexpr const char hcv_builtin_error_html[] =
+  R"builtinerror(<!DOCTYPE html>
 <html>
 <head>
  <meta charset="utf-8">
- <title>HelpCovid builtin error</title>
+ <title>HelpCovid builtin error <?hcv response_status?></title>
 </head>
 <body>
-<h1>HelpCovid builtin error</h1>
+<h1>HelpCovid builtin error <?hcv response_status?></h1>
   <p>Please ask the webmaster to add a proper <tt>html/error.html</tt> file.<br/></p>
   <p>Error on <?hcv now?> for request #<?hcv request_number?> to <?hcv request_method?> of <?hcv request_path?>.<br/>
     HelpCovid git <tt><?hcv gitid?></tt> pid <?hcv pid?> on <tt><i><?hcv hostname?></i></tt>.<br/> 
@@ -246,13 +696,116 @@ hcv_web_error_handler(const httplib::Request& req,
 </body>
 </html>
 )builtinerror";
-      outhtmlstr = hcv_expand_template_string(std::string(builtin_error_html),
-					      "*builtin-error*", &webdata);
+
+static std::atomic<long> hcv_web_not_found_count;
+
+void
+hcv_web_error_handler(const httplib::Request& req,
+                      httplib::Response& resp, long reqnum)
+{
+  /// a handler which went past its deadline threw some exception,
+  /// maybe from a cancelled statement; the error page has no deadline
+  if (resp.status == 500 && hcv_web_deadline_thrown)
+    {
+      resp.status = 503;
+      hcv_web_deadline_exceeded_count++;
+    }
+  hcv_web_deadline_thrown = false;
+  hcv_set_request_deadline(0.0);
+  /// e.g. a 503 of /ajax/login when password hashing is overloaded
+  /// already has its JSON answer
+  if (resp.get_header_value("Content-Type") == "application/json")
+    {
+      HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_error_handler reqnum=" << reqnum << " status=" << resp.status
+                    << " req." << req.method << " path=" << req.path << " with JSON");
+      return;
     }
-  resp.set_content(outhtmlstr.c_str(), "text/html");
+  Hcv_http_render_context webdata(req,resp,reqnum);
+  /// a 404 is usual, e.g. from bots probing /wp-admin, so not logged
+  if (resp.status == 404)
+    {
+      hcv_web_not_found_count++;
+      HCV_DEBUGOUT("hcv_web_error_handler not found reqnum=" << reqnum << " req." << req.method << " path=" << req.path);
+    }
+  else
+    HCV_SYSLOGOUT(LOG_WARNING, "hcv_web_error_handler reqnum=" << reqnum << " status=" << resp.status
+                  << " req." << req.method << " path=" << req.path);
+  std::string outhtmlstr = hcv_expand_error_page(resp.status, hcv_builtin_error_html, webdata.get());
+  resp.set_content(outhtmlstr, "text/html");
 } // end hcv_web_error_handler
 
-#define HCV_WEBCOOKIE_RANDOMSTR_WIDTH 24 /* also width of wcookie_random in hcv_database.cc */
+
+
+////////////////////////////////////////////////////////////////
+//// static files under the web root, served by our last GET handler
+//// instead of an httplib mount point, which would stat(2) some file
+//// for every GET request, even /login. Paths which are not files are
+//// remembered for a while (see [web] negative_cache_ttl) in a bounded
+//// negative lookup cache, so a bot probing /.env costs no file access.
+#define HCV_WEB_NEGATIVE_CACHE_MAXSIZE 8192
+#define HCV_WEB_NEGATIVE_PATH_MAXLEN 256
+static std::shared_mutex hcv_web_negative_mtx;
+/// request path to monotonic expiry time
+static std::unordered_map<std::string,double> hcv_web_negative_dict;
+static std::atomic<long> hcv_web_negative_hits;
+
+static void
+hcv_web_serve_static_file(const httplib::Request& req, httplib::Response& resp)
+{
+  Hcv_web_request_scope reqscope(req, "static");
+  double nowt = hcv_monotonic_real_time();
+  double negttl = hcv_web_negative_ttl.load();
+  if (negttl > 0.0)
+    {
+      std::shared_lock<std::shared_mutex> gu(hcv_web_negative_mtx);
+      auto negit = hcv_web_negative_dict.find(req.path);
+      if (negit != hcv_web_negative_dict.end() && negit->second > nowt)
+        {
+          hcv_web_negative_hits++;
+          resp.status = 404;
+          return;
+        }
+    }
+  if (req.path.empty() || req.path[0] != '/' || !httplib::detail::is_valid_path(req.path))
+    {
+      resp.status = 404;
+      return;
+    }
+  std::string filpath = hcv_webroot + req.path;
+  if (filpath.back() == '/')
+    filpath += "index.html";
+  struct stat filstat;
+  memset (&filstat, 0, sizeof(filstat));
+  if (!stat(filpath.c_str(), &filstat) && S_ISREG(filstat.st_mode))
+    {
+      static const std::map<std::string, std::string> nomimetypemap;
+      httplib::detail::read_file(filpath, resp.body);
+      if (auto type = httplib::detail::find_content_type(filpath, nomimetypemap))
+        resp.set_header("Content-Type", type);
+      resp.status = 200;
+      return;
+    }
+  resp.status = 404;
+  if (negttl > 0.0 && req.path.size() < HCV_WEB_NEGATIVE_PATH_MAXLEN)
+    {
+      std::unique_lock<std::shared_mutex> gu(hcv_web_negative_mtx);
+      if (hcv_web_negative_dict.size() >= HCV_WEB_NEGATIVE_CACHE_MAXSIZE)
+        {
+          for (auto negit = hcv_web_negative_dict.begin(); negit != hcv_web_negative_dict.end(); )
+            {
+              if (negit->second <= nowt)
+                negit = hcv_web_negative_dict.erase(negit);
+              else
+                negit++;
+            }
+          /// a bot probing many random paths should not exhaust memory
+          if (hcv_web_negative_dict.size() >= HCV_WEB_NEGATIVE_CACHE_MAXSIZE)
+            hcv_web_negative_dict.clear();
+        }
+      hcv_web_negative_dict[req.path] = nowt + negttl;
+    }
+} // end hcv_web_serve_static_file
+
 static std::string
 hcv_web_make_cookie_string(long id, const char*randomstr, int webhash)
 {
@@ -286,11 +839,420 @@ hcv_web_extract_cookie_string(const std::string&str, long *id, char randomstr[HC
 
 
 static constexpr unsigned hcv_web_cookie_duration = 5400; // in seconds, so one hour and a half
-/// register a fresh cookie in the database and return it.
+
+/// a quick hashcode of the browser's User-Agent:
+static int
+hcv_web_agent_hash(const httplib::Request&req)
+{
+  auto webagendit = req.headers.find("User-Agent");
+  if (webagendit == req.headers.end() || webagendit->second.empty())
+    return 0;
+  int webagenthash = std::hash<std::string>{}(webagendit->second);
+  if (webagenthash == 0)
+    webagenthash = webagendit->second.size();
+  return webagenthash;
+} // end hcv_web_agent_hash
+
+
+////////////////////////////////////////////////////////////////
+//// stateless signed cookies, see [web] cookie_mode. They look like
+//// HCS5e9a1b2c-0123456789abcdef-Aee0a9546-K3-<32 hex digits> with
+//// the expiration time, a random nonce, the user agent hash and the
+//// generation of the HMAC-SHA256 key signing all that. The key is
+//// rotated by the background thread; cookies signed by the previous
+//// key are still accepted. Without [web] cookie_key_file it is
+//// random and kept only in memory, so that is for a single process,
+//// whose restart forgets every signed cookie. With a secret shared by
+//// all the helpcovid instances (e.g. behind a load balancer) the key
+//// of generation G is HMAC-SHA256(secret, G) and G is the wall clock
+//// time divided by cookie_key_rotation, so they all agree and also
+//// accept the next key, for some clock skew.
+static std::shared_mutex hcv_web_cookie_key_mtx;
+static long hcv_web_cookie_key_generation; // 0 before the first key
+static unsigned char hcv_web_cookie_key[3][HCV_WEB_COOKIE_KEY_LEN]; // indexed by generation%3
+static std::string hcv_web_cookie_secret; // empty for a random key
+
+
+/// read the shared secret of signed cookies, a file only readable by
+/// its owner, like the configuration file
+static void
+hcv_web_load_cookie_secret(const std::string&path)
+{
+  struct stat secretstat;
+  memset (&secretstat, 0, sizeof(secretstat));
+  if (stat(path.c_str(), &secretstat))
+    HCV_FATALOUT("hcv_web_load_cookie_secret: stat of [web] cookie_key_file " << path << " failed");
+  if (!S_ISREG(secretstat.st_mode))
+    HCV_FATALOUT("hcv_web_load_cookie_secret: [web] cookie_key_file " << path
+                 << " is not a regular file.");
+  if (secretstat.st_mode & S_IRWXO)
+    HCV_FATALOUT("hcv_web_load_cookie_secret: [web] cookie_key_file " << path
+                 << " is world readable or writable but should not be. Run chmod o-rwx " << path);
+  if (secretstat.st_size > HCV_WEB_COOKIE_SECRET_MAXIMAL_LEN)
+    HCV_FATALOUT("hcv_web_load_cookie_secret: [web] cookie_key_file " << path << " is too big");
+  std::ifstream secretinp(path, std::ios::in | std::ios::binary);
+  std::ostringstream secretouts;
+  secretouts << secretinp.rdbuf();
+  std::string secret = secretouts.str();
+  while (!secret.empty() && isspace(secret.back()))
+    secret.pop_back();
+  if (secret.size() < HCV_WEB_COOKIE_SECRET_MINIMAL_LEN)
+    HCV_FATALOUT("hcv_web_load_cookie_secret: [web] cookie_key_file " << path
+                 << " should have at least " << HCV_WEB_COOKIE_SECRET_MINIMAL_LEN << " bytes");
+  std::unique_lock<std::shared_mutex> gu(hcv_web_cookie_key_mtx);
+  hcv_web_cookie_secret = secret;
+  OPENSSL_cleanse(&secret[0], secret.size());
+} // end hcv_web_load_cookie_secret
+
+
+/// the key of some generation derived from the shared secret, called
+/// with hcv_web_cookie_key_mtx locked
+static void
+hcv_web_derive_cookie_key(long gen)
+{
+  char genbuf[48];
+  memset (genbuf, 0, sizeof(genbuf));
+  snprintf(genbuf, sizeof(genbuf), "helpcovid cookie key %ld", gen);
+  unsigned int keylen = 0;
+  if (!HMAC(EVP_sha256(), hcv_web_cookie_secret.data(), hcv_web_cookie_secret.size(),
+            (const unsigned char*)genbuf, strlen(genbuf), hcv_web_cookie_key[gen%3], &keylen)
+      || keylen != HCV_WEB_COOKIE_KEY_LEN)
+    HCV_FATALOUT("hcv_web_derive_cookie_key: HMAC failed for generation#" << gen);
+} // end hcv_web_derive_cookie_key
+
+
+double
+hcv_web_rotate_cookie_key(void)
+{
+  double rotation = hcv_web_cookie_key_rotation.load();
+  long gen = 0;
+  {
+    std::unique_lock<std::shared_mutex> gu(hcv_web_cookie_key_mtx);
+    if (!hcv_web_cookie_secret.empty())
+      {
+        double nowt = (double) time(nullptr);
+        gen = (long) (nowt / rotation);
+        for (long g = gen-1; g <= gen+1; g++)
+          hcv_web_derive_cookie_key(g);
+        hcv_web_cookie_key_generation = gen;
+        gu.unlock();
+        HCV_DEBUGOUT("hcv_web_rotate_cookie_key shared generation#" << gen);
+        /// come back at the start of the next period
+        return std::max((gen+1)*rotation - nowt, 1.0);
+      }
+    unsigned char freshkey[HCV_WEB_COOKIE_KEY_LEN];
+    if (RAND_bytes(freshkey, sizeof(freshkey)) != 1)
+      HCV_FATALOUT("hcv_web_rotate_cookie_key: RAND_bytes failed");
+    gen = ++hcv_web_cookie_key_generation;
+    memcpy(hcv_web_cookie_key[gen%3], freshkey, sizeof(freshkey));
+    OPENSSL_cleanse(freshkey, sizeof(freshkey));
+  }
+  HCV_DEBUGOUT("hcv_web_rotate_cookie_key generation#" << gen);
+  return rotation;
+} // end hcv_web_rotate_cookie_key
+
+
+/// the hexadecimal HMAC of some cookie payload, or an empty string if
+/// that key generation is gone
+static std::string
+hcv_web_cookie_mac(const std::string&payload, long gen)
+{
+  unsigned char mac[EVP_MAX_MD_SIZE];
+  unsigned int maclen = 0;
+  {
+    std::shared_lock<std::shared_mutex> gu(hcv_web_cookie_key_mtx);
+    /// with a shared secret, the next key of another instance is known
+    long lastgen = hcv_web_cookie_key_generation + (hcv_web_cookie_secret.empty()?0:1);
+    if (gen <= 0 || gen > lastgen || gen < hcv_web_cookie_key_generation-1)
+      return "";
+    if (!HMAC(EVP_sha256(), hcv_web_cookie_key[gen%3], HCV_WEB_COOKIE_KEY_LEN,
+              (const unsigned char*)payload.data(), payload.size(), mac, &maclen))
+      return "";
+  }
+  char hexbuf[2*EVP_MAX_MD_SIZE+1];
+  memset (hexbuf, 0, sizeof(hexbuf));
+  for (unsigned ix=0; ix<maclen && 2*ix<HCV_WEB_COOKIE_MAC_HEXLEN; ix++)
+    snprintf(hexbuf+2*ix, 3, "%02x", mac[ix]);
+  return std::string(hexbuf);
+} // end hcv_web_cookie_mac
+
+
+static std::string
+hcv_web_make_signed_cookie_string(time_t exptime, int webhash)
+{
+  uint64_t nonce = 0;
+  if (RAND_bytes((unsigned char*)&nonce, sizeof(nonce)) != 1)
+    HCV_FATALOUT("hcv_web_make_signed_cookie_string: RAND_bytes failed");
+  long gen = 0;
+  {
+    std::shared_lock<std::shared_mutex> gu(hcv_web_cookie_key_mtx);
+    gen = hcv_web_cookie_key_generation;
+  }
+  char buf[80];
+  memset (buf, 0, sizeof(buf));
+  snprintf(buf, sizeof(buf), "HCS%08lx-%016llx-A%08x-K%lx",
+           (long)exptime, (unsigned long long)nonce, webhash, gen);
+  std::string payload(buf);
+  return payload + "-" + hcv_web_cookie_mac(payload, gen);
+} // end hcv_web_make_signed_cookie_string
+
+
+/// verify a signed cookie, in constant time for its MAC
+static bool
+hcv_web_check_signed_cookie_string(const std::string&str, hcv_web_session_st*psess)
+{
+  size_t dashpos = str.rfind('-');
+  if (str.compare(0, 3, "HCS") != 0 || dashpos == std::string::npos
+      || str.size() - dashpos - 1 != HCV_WEB_COOKIE_MAC_HEXLEN)
+    return false;
+  std::string payload = str.substr(0, dashpos);
+  long exptime = 0, gen = 0;
+  unsigned long long nonce = 0;
+  int webhash = 0, endpos = -1;
+  if (sscanf(payload.c_str(), "HCS%lx-%llx-A%x-K%lx%n",
+             &exptime, &nonce, &webhash, &gen, &endpos) < 4
+      || endpos != (int)payload.size())
+    return false;
+  std::string mac = hcv_web_cookie_mac(payload, gen);
+  if (mac.size() != HCV_WEB_COOKIE_MAC_HEXLEN
+      || CRYPTO_memcmp(mac.data(), str.data() + dashpos + 1, HCV_WEB_COOKIE_MAC_HEXLEN) != 0)
+    return false;
+  memset (psess, 0, sizeof(*psess));
+  snprintf(psess->hcvsess_random, sizeof(psess->hcvsess_random), "%016llx", nonce);
+  psess->hcvsess_exptime = (time_t) exptime;
+  psess->hcvsess_webagenthash = webhash;
+  return true;
+} // end hcv_web_check_signed_cookie_string
+
+
+////////////////////////////////////////////////////////////////
+//// the in-memory web sessions, sharded by cookie id to keep lock
+//// contention low; each shard is bounded
+#define HCV_WEB_SESSION_SHARDS 16
+#define HCV_WEB_SESSION_MAX_PER_SHARD 4096
+struct hcv_web_session_shard_st
+{
+  std::shared_mutex hcvsshard_mtx;
+  std::unordered_map<long,hcv_web_session_st> hcvsshard_dict;
+};
+static hcv_web_session_shard_st hcv_web_session_shards[HCV_WEB_SESSION_SHARDS];
+static std::atomic<long> hcv_web_session_hits;
+static std::atomic<long> hcv_web_session_misses;
+
+static inline hcv_web_session_shard_st&
+hcv_web_session_shard(long id)
+{
+  return hcv_web_session_shards[((unsigned long)id) % HCV_WEB_SESSION_SHARDS];
+} // end hcv_web_session_shard
+
+
+static void
+hcv_web_remember_session(const hcv_web_session_st&sess)
+{
+  hcv_web_session_shard_st& shard = hcv_web_session_shard(sess.hcvsess_id);
+  std::unique_lock<std::shared_mutex> gu(shard.hcvsshard_mtx);
+  if (shard.hcvsshard_dict.size() >= HCV_WEB_SESSION_MAX_PER_SHARD
+      && shard.hcvsshard_dict.find(sess.hcvsess_id) == shard.hcvsshard_dict.end())
+    {
+      time_t nowt = time(nullptr);
+      for (auto it = shard.hcvsshard_dict.begin(); it != shard.hcvsshard_dict.end(); )
+        {
+          if (it->second.hcvsess_exptime <= nowt)
+            it = shard.hcvsshard_dict.erase(it);
+          else
+            it++;
+        }
+      /// still full, that session will be read from the database
+      if (shard.hcvsshard_dict.size() >= HCV_WEB_SESSION_MAX_PER_SHARD)
+        return;
+    }
+  shard.hcvsshard_dict[sess.hcvsess_id] = sess;
+} // end hcv_web_remember_session
+
+
+/// the value of our cookie in the Cookie: header of a request
+static bool
+hcv_web_request_cookie(const httplib::Request&req, std::string&cookiestr)
+{
+  static constexpr const char cookieprefix[] = HCV_COOKIE_NAME "=";
+  static constexpr size_t cookieprefixlen = sizeof(cookieprefix)-1;
+  auto cookit = req.headers.find("Cookie");
+  if (cookit == req.headers.end())
+    return false;
+  const std::string& hdr = cookit->second;
+  size_t pos = 0;
+  while (pos < hdr.size())
+    {
+      while (pos < hdr.size() && (hdr[pos] == ' ' || hdr[pos] == ';'))
+        pos++;
+      size_t endpos = hdr.find(';', pos);
+      if (endpos == std::string::npos)
+        endpos = hdr.size();
+      if (hdr.compare(pos, cookieprefixlen, cookieprefix) == 0)
+        {
+          cookiestr = hdr.substr(pos+cookieprefixlen, endpos-pos-cookieprefixlen);
+          return true;
+        }
+      pos = endpos;
+    }
+  return false;
+} // end hcv_web_request_cookie
+
+
+void
+hcv_set_request_deadline(double budget)
+{
+  if (budget > 0.0)
+    hcv_request_deadline_time = hcv_monotonic_real_time() + budget;
+  else
+    hcv_request_deadline_time = 0.0;
+} // end hcv_set_request_deadline
+
+
+/// start the handling of a request by the current worker thread:
+/// give it the deadline of its route, and tell the database layer
+/// which web session it serves, for read-your-writes on replicas;
+/// that is our cookie, or else the client address, e.g. between
+/// signup and login. Called by Hcv_web_request_scope.
+void
+hcv_web_begin_request(const httplib::Request&req, const char*route)
+{
+  hcv_web_deadline_thrown = false;
+  auto it = hcv_web_route_budgets.find(route);
+  hcv_set_request_deadline((it == hcv_web_route_budgets.end())?0.0:it->second);
+  std::string cookiestr;
+  if (hcv_web_request_cookie(req, cookiestr))
+    hcv_database_set_session_key(std::hash<std::string>()(cookiestr)|1);
+  else
+    hcv_database_set_session_key(std::hash<std::string>()(req.get_header_value("REMOTE_ADDR"))|1);
+} // end hcv_web_begin_request
+
+
+/// end the handling of a request, normally or by some exception:
+/// httplib reuses its worker threads, so the deadline and session
+/// key are cleared, lest the next request on this thread inherit them
+void
+hcv_web_end_request(bool throwing)
+{
+  hcv_web_deadline_thrown = throwing && hcv_request_deadline_time > 0.0
+                            && hcv_monotonic_real_time() >= hcv_request_deadline_time;
+  hcv_set_request_deadline(0.0);
+  hcv_database_set_session_key(0);
+} // end hcv_web_end_request
+
+
+bool
+hcv_web_session_of_request(const httplib::Request&req, hcv_web_session_st*psess)
+{
+  std::string cookiestr;
+  if (!hcv_web_request_cookie(req, cookiestr))
+    return false;
+  if (cookiestr.compare(0, 3, "HCS") == 0)
+    {
+      /// an anonymous signed cookie, checked without any lookup
+      hcv_web_session_st signedsess;
+      if (!hcv_web_check_signed_cookie_string(cookiestr, &signedsess)
+          || signedsess.hcvsess_webagenthash != hcv_web_agent_hash(req)
+          || signedsess.hcvsess_exptime <= time(nullptr))
+        return false;
+      if (psess)
+        *psess = signedsess;
+      return true;
+    }
+  long id = 0;
+  int webagenthash = 0;
+  char randombuf[HCV_WEBCOOKIE_RANDOMSTR_WIDTH+4];
+  memset (randombuf, 0, sizeof(randombuf));
+  if (!hcv_web_extract_cookie_string(cookiestr, &id, randombuf, &webagenthash) || id <= 0)
+    return false;
+  if (webagenthash != hcv_web_agent_hash(req))
+    return false;
+  hcv_web_session_st sess;
+  memset (&sess, 0, sizeof(sess));
+  bool found = false;
+  {
+    hcv_web_session_shard_st& shard = hcv_web_session_shard(id);
+    std::shared_lock<std::shared_mutex> gu(shard.hcvsshard_mtx);
+    auto it = shard.hcvsshard_dict.find(id);
+    if (it != shard.hcvsshard_dict.end())
+      {
+        sess = it->second;
+        found = true;
+      }
+  }
+  time_t nowt = time(nullptr);
+  if (found)
+    hcv_web_session_hits++;
+  else
+    {
+      hcv_web_session_misses++;
+      if (!hcv_database_find_web_cookie(id, &sess))
+        return false;
+      if (sess.hcvsess_exptime > nowt)
+        hcv_web_remember_session(sess);
+    }
+  /// compare the random strings in constant time
+  unsigned char diff = 0;
+  for (unsigned ix=0; ix<HCV_WEBCOOKIE_RANDOMSTR_WIDTH; ix++)
+    diff |= (unsigned char)(sess.hcvsess_random[ix] ^ randombuf[ix]);
+  if (diff != 0 || sess.hcvsess_webagenthash != webagenthash
+      || sess.hcvsess_exptime <= nowt)
+    return false;
+  if (psess)
+    *psess = sess;
+  return true;
+} // end hcv_web_session_of_request
+
+
+void
+hcv_web_expire_sessions(void)
+{
+  time_t nowt = time(nullptr);
+  long nbexpired = 0;
+  for (hcv_web_session_shard_st& shard: hcv_web_session_shards)
+    {
+      std::unique_lock<std::shared_mutex> gu(shard.hcvsshard_mtx);
+      for (auto it = shard.hcvsshard_dict.begin(); it != shard.hcvsshard_dict.end(); )
+        {
+          if (it->second.hcvsess_exptime <= nowt)
+            {
+              it = shard.hcvsshard_dict.erase(it);
+              nbexpired++;
+            }
+          else
+            it++;
+        }
+    }
+  HCV_DEBUGOUT("hcv_web_expire_sessions removed " << nbexpired << " sessions");
+} // end hcv_web_expire_sessions
+
+
+void
+hcv_web_session_statistics(long*pnbsessions, long*pnbhits, long*pnbmisses)
+{
+  if (pnbsessions)
+    {
+      long nbsessions = 0;
+      for (hcv_web_session_shard_st& shard: hcv_web_session_shards)
+        {
+          std::shared_lock<std::shared_mutex> gu(shard.hcvsshard_mtx);
+          nbsessions += shard.hcvsshard_dict.size();
+        }
+      *pnbsessions = nbsessions;
+    }
+  if (pnbhits)
+    *pnbhits = hcv_web_session_hits.load();
+  if (pnbmisses)
+    *pnbmisses = hcv_web_session_misses.load();
+} // end hcv_web_session_statistics
+
+
+/// register a fresh cookie in the database, or make a signed one
+/// unless persistent, and return it.
 /// see also https://tools.ietf.org/html/rfc6265
 #warning we may want to implement secure or httponly web cookies, see RFC6265
-std::string
-hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
+static std::string
+hcv_web_register_cookie(Hcv_http_template_data*htpl, bool persistent)
 {
   static constexpr const char alphanumchars[]=
     "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -314,12 +1276,6 @@ hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
 		  << htpl->serial());
     return "";
   };
-  std::string webagentstr;
-  {
-    auto webagendit = hreq->headers.find("User-Agent");
-    if (webagendit != hreq->headers.end())
-      webagentstr = webagendit->second;
-  }
   auto reqnum = htpl->request_number();
   char randombuf[HCV_WEBCOOKIE_RANDOMSTR_WIDTH+4];
   memset (randombuf, 0, sizeof(randombuf));
@@ -337,19 +1293,31 @@ hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
   if (time(&expiret)<0)
     HCV_FATALOUT("hcv_web_register_fresh_cookie time(2) failed");
   expiret += hcv_web_cookie_duration;
-  int webagenthash = 0;
-  if (!webagentstr.empty()) {
-    webagenthash = std::hash<std::string>{}(webagentstr);
-    if (webagenthash == 0)
-      webagenthash = webagentstr.size();
+  int webagenthash = hcv_web_agent_hash(*hreq);
+  if (!persistent && hcv_web_signed_cookies.load()) {
+    std::string res = hcv_web_make_signed_cookie_string(expiret, webagenthash);
+    char agebuf[32];
+    memset(agebuf, 0, sizeof(agebuf));
+    snprintf(agebuf, sizeof(agebuf), "; Max-Age=%u",  hcv_web_cookie_duration);
+    hresp->set_header("Set-Cookie", std::string(HCV_COOKIE_NAME "=") + res + agebuf);
+    HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum << " signed " << res);
+    return res;
   }
   HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum << " randombuf=" << randombuf
-	       << " expiret=" << expiret << " webagentstr='" << webagentstr
-	       << "', webagenthash=" << webagenthash);
+	       << " expiret=" << expiret << " webagenthash=" << webagenthash);
   long id = hcv_database_get_id_of_added_web_cookie(std::string(randombuf), expiret, webagenthash);
   HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum << " randombuf=" << randombuf
 	       << " webagenthash=" << webagenthash
 	       << " id=" << id);
+  if (id > 0) {
+    hcv_web_session_st sess;
+    memset (&sess, 0, sizeof(sess));
+    sess.hcvsess_id = id;
+    strncpy(sess.hcvsess_random, randombuf, HCV_WEBCOOKIE_RANDOMSTR_WIDTH);
+    sess.hcvsess_exptime = expiret;
+    sess.hcvsess_webagenthash = webagenthash;
+    hcv_web_remember_session(sess);
+  }
   std::string res = hcv_web_make_cookie_string(id, randombuf, webagenthash);
   HCV_DEBUGOUT("hcv_web_register_fresh_cookie reqnum#" << reqnum << " gives " << res);
   char agebuf[32];
@@ -360,9 +1328,23 @@ hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
   HCV_DEBUGOUT ("hcv_web_register_fresh_cookie reqnum#" << reqnum
 		<< " SETCOOKIE cookiestr=" << cookiestr);
   return res;
+} // end hcv_web_register_cookie
+
+
+std::string
+hcv_web_register_fresh_cookie(Hcv_http_template_data*htpl)
+{
+  return hcv_web_register_cookie(htpl, false);
 } // end hcv_web_register_fresh_cookie
 
 
+std::string
+hcv_web_register_persistent_cookie(Hcv_http_template_data*htpl)
+{
+  return hcv_web_register_cookie(htpl, true);
+} // end hcv_web_register_persistent_cookie
+
+
 void
 hcv_web_forget_cookie(Hcv_http_template_data*htpl)
 {
@@ -448,6 +1430,87 @@ hcv_web_get_json_status(const httplib::Request&req, httplib::Response& resp, lon
   jsob["cxx"] = hcv_cxx_compiler;
   jsob["build_time"] = hcv_timestamp;
   jsob["build_timestamp"] =  (Json::Value::Int64)hcv_timelong;
+  {
+    long pchits=0, pcmisses=0, pcpages=0;
+    hcv_page_cache_statistics(&pchits, &pcmisses, &pcpages);
+    jsob["page_cache_hits"] = (Json::Value::Int64)pchits;
+    jsob["page_cache_misses"] = (Json::Value::Int64)pcmisses;
+    jsob["page_cache_pages"] = (Json::Value::Int64)pcpages;
+    long fchits=0, fcmisses=0, fcfragments=0;
+    hcv_fragment_cache_statistics(&fchits, &fcmisses, &fcfragments);
+    jsob["fragment_cache_hits"] = (Json::Value::Int64)fchits;
+    jsob["fragment_cache_misses"] = (Json::Value::Int64)fcmisses;
+    jsob["fragment_cache_fragments"] = (Json::Value::Int64)fcfragments;
+    long rcreated=0, rreused=0;
+    hcv_render_context_statistics(&rcreated, &rreused);
+    jsob["render_contexts_created"] = (Json::Value::Int64)rcreated;
+    jsob["render_contexts_reused"] = (Json::Value::Int64)rreused;
+    long ephits=0, epmisses=0, eppages=0;
+    hcv_error_page_cache_statistics(&ephits, &epmisses, &eppages);
+    jsob["error_page_cache_hits"] = (Json::Value::Int64)ephits;
+    jsob["error_page_cache_misses"] = (Json::Value::Int64)epmisses;
+    jsob["not_found_count"] = (Json::Value::Int64)hcv_web_not_found_count.load();
+    jsob["negative_cache_hits"] = (Json::Value::Int64)hcv_web_negative_hits.load();
+    long dbconns=0, dbidle=0, dbwaits=0, dbtimeouts=0, dbreconnects=0;
+    hcv_database_pool_statistics(&dbconns, &dbidle, &dbwaits, &dbtimeouts, &dbreconnects);
+    jsob["database_connections"] = (Json::Value::Int64)dbconns;
+    jsob["database_idle_connections"] = (Json::Value::Int64)dbidle;
+    jsob["database_pool_waits"] = (Json::Value::Int64)dbwaits;
+    jsob["database_pool_timeouts"] = (Json::Value::Int64)dbtimeouts;
+    jsob["database_reconnects"] = (Json::Value::Int64)dbreconnects;
+    long nbreplicas=0, replicareads=0, primaryreads=0;
+    double replicalag=0.0;
+    hcv_database_replica_statistics(&nbreplicas, &replicareads, &primaryreads, &replicalag);
+    jsob["database_replicas"] = (Json::Value::Int64)nbreplicas;
+    jsob["database_replica_reads"] = (Json::Value::Int64)replicareads;
+    jsob["database_primary_reads"] = (Json::Value::Int64)primaryreads;
+    jsob["database_replica_lag"] = replicalag;
+    long nbcancelled=0;
+    hcv_database_deadline_statistics(&nbcancelled);
+    jsob["database_statements_cancelled"] = (Json::Value::Int64)nbcancelled;
+    jsob["requests_past_deadline"] = (Json::Value::Int64)hcv_web_deadline_exceeded_count.load();
+    Json::Value jsstmts(Json::objectValue);
+    hcv_database_statement_statistics(jsstmts);
+    jsob["database_statements"] = jsstmts;
+    long cookieflushes=0, cookieinserted=0;
+    hcv_database_cookie_batch_statistics(&cookieflushes, &cookieinserted);
+    jsob["web_cookie_batches"] = (Json::Value::Int64)cookieflushes;
+    jsob["web_cookies_batched"] = (Json::Value::Int64)cookieinserted;
+    long nbpurged=0, nbpurgedminute=0, purgebatch=0, nbdroppedparts=0;
+    double replag=0.0;
+    hcv_database_purge_statistics(&nbpurged, &nbpurgedminute, &purgebatch, &replag, &nbdroppedparts);
+    jsob["web_cookie_partitions_dropped"] = (Json::Value::Int64)nbdroppedparts;
+    jsob["web_cookies_purged"] = (Json::Value::Int64)nbpurged;
+    jsob["web_cookies_purged_per_minute"] = (Json::Value::Int64)nbpurgedminute;
+    jsob["web_cookie_purge_batch"] = (Json::Value::Int64)purgebatch;
+    long nbfilteremails=0, emailnegatives=0, emailconfirmed=0, emailfalsepositives=0;
+    hcv_database_email_filter_statistics(&nbfilteremails, &emailnegatives,
+                                         &emailconfirmed, &emailfalsepositives);
+    jsob["known_email_filter_size"] = (Json::Value::Int64)nbfilteremails;
+    jsob["known_email_negatives"] = (Json::Value::Int64)emailnegatives;
+    jsob["known_email_confirmed"] = (Json::Value::Int64)emailconfirmed;
+    jsob["known_email_false_positives"] = (Json::Value::Int64)emailfalsepositives;
+    long nbpasswdhashes=0, nbpasswdrejected=0, nbpasswdqueued=0;
+    hcv_password_statistics(&nbpasswdhashes, &nbpasswdrejected, &nbpasswdqueued);
+    jsob["password_hashes"] = (Json::Value::Int64)nbpasswdhashes;
+    jsob["password_hashes_rejected"] = (Json::Value::Int64)nbpasswdrejected;
+    jsob["password_hashes_queued"] = (Json::Value::Int64)nbpasswdqueued;
+    jsob["database_replication_lag"] = replag;
+    long nbsessions=0, sessionhits=0, sessionmisses=0;
+    hcv_web_session_statistics(&nbsessions, &sessionhits, &sessionmisses);
+    jsob["web_sessions"] = (Json::Value::Int64)nbsessions;
+    jsob["web_session_hits"] = (Json::Value::Int64)sessionhits;
+    jsob["web_session_misses"] = (Json::Value::Int64)sessionmisses;
+    long asyncsubmitted=0, asynccompleted=0, asyncconns=0;
+    hcv_dbasync_statistics(&asyncsubmitted, &asynccompleted, &asyncconns);
+    jsob["dbasync_submitted"] = (Json::Value::Int64)asyncsubmitted;
+    jsob["dbasync_completed"] = (Json::Value::Int64)asynccompleted;
+    jsob["dbasync_connections"] = (Json::Value::Int64)asyncconns;
+    {
+      std::shared_lock<std::shared_mutex> gu(hcv_web_negative_mtx);
+      jsob["negative_cache_paths"] = (Json::Value::Int64)hcv_web_negative_dict.size();
+    }
+  }
   {
     auto pluginvect = hcv_get_loaded_plugins_vector();
     if (!pluginvect.empty()) {
@@ -466,7 +1529,7 @@ void
 hcv_web_get_html_status(const httplib::Request&req, httplib::Response& resp, long reqcnt, double startcputime, double startmonotonictime)
 {
   HCV_DEBUGOUT("hcv_web_get_html_status start path=" << req.path << " req#" << reqcnt);
-  Hcv_http_template_data statusdata(req, resp, reqcnt);
+  Hcv_http_render_context statusdata(req, resp, reqcnt);
   /// sleep a tiny bit against abusive usage...
   usleep (500+Hcv_Random::random_quickly_8bits());
   std::ostringstream outstatus;
@@ -649,6 +1712,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "status");
     if (reqcnt<=0)
       reqcnt=1;
        HCV_DEBUGOUT("status.json URL handling GET path '" << req.path
@@ -662,6 +1726,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "status");
     if (reqcnt<=0)
       reqcnt=1;
        HCV_DEBUGOUT("status.html URL handling GET path '" << req.path
@@ -677,6 +1742,7 @@ hcv_webserver_run(void)
      {
        errno = 0;
        long reqcnt = hcv_incremented_request_counter();
+       Hcv_web_request_scope reqscope(req, "ajax");
        HCV_DEBUGOUT("ajax URL handling POST path '" << req.path
 		    << "' req#" << reqcnt);
        HCV_SYSLOGOUT(LOG_WARNING,
@@ -691,6 +1757,7 @@ hcv_webserver_run(void)
      {
        errno = 0;
        long reqcnt = hcv_incremented_request_counter();
+       Hcv_web_request_scope reqscope(req, "ajax");
        HCV_DEBUGOUT("ajax URL handling POST path '" << req.path
 		    << "' req#" << reqcnt);
        HCV_SYSLOGOUT(LOG_WARNING,
@@ -706,6 +1773,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "root");
     HCV_DEBUGOUT("root URL handling GET path '" << req.path
 		 << "' req#" << reqcnt);
     std::string htmlcont;
@@ -719,6 +1787,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "root");
     HCV_DEBUGOUT("root URL handling GET path '" << req.path
 		 << "' req#" << reqcnt);
     resp.set_content(hcv_home_view_get(req, resp, reqcnt), "text/html");
@@ -728,6 +1797,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "root");
     HCV_DEBUGOUT("root URL handling GET path '" << req.path
 		 << "' req#" << reqcnt);
     std::string htmlcont;
@@ -743,6 +1813,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "login");
     HCV_DEBUGOUT("login URL handling GET path '" << req.path
 		 << "' req#" << reqcnt);
     std::string htmlcont;
@@ -758,6 +1829,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "login");
     HCV_DEBUGOUT("login URL handling POST path '" << req.path
 		 << "' req#" << reqcnt);
     std::string jsoncont;
@@ -771,6 +1843,7 @@ hcv_webserver_run(void)
                                   httplib::Response& resp)
   {
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "register");
     HCV_DEBUGOUT("register URL handling GET path '" << req.path
 		 << "' req#" << reqcnt);
     std::string htmlcont;
@@ -786,6 +1859,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "register");
     HCV_DEBUGOUT("register URL handling POST path '" << req.path
 		 << "' req#" << reqcnt);
     std::string jsoncont;
@@ -802,6 +1876,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "profile");
     HCV_DEBUGOUT("profile GET URL: '" << req.path << "' req # " << reqcnt);
 
     std::string html = hcv_profile_view_get(req, resp, reqcnt);
@@ -818,6 +1893,7 @@ hcv_webserver_run(void)
   {
     errno = 0;
     long reqcnt = hcv_incremented_request_counter();
+    Hcv_web_request_scope reqscope(req, "static");
     HCV_DEBUGOUT("images URL handling GET path '" << req.path
 		 << "' req#" << reqcnt);
 #warning hcv_webserver->Get("/images/"...) dont work
@@ -829,6 +1905,8 @@ hcv_webserver_run(void)
   ////////
   //////// initialize plugins, if any
   hcv_initialize_plugins_for_web(hcv_webserver);
+  //////// static files under the web root, after every other GET handler
+  hcv_webserver->Get(".*", hcv_web_serve_static_file);
   ////////////////////////////////////////////////////////////////
   hcv_webserver->listen(webhost, webport);
   HCV_SYSLOGOUT(LOG_INFO, "end hcv_webserver_run webhost=" << webhost << " webport=" << webport);
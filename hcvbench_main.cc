@@ -0,0 +1,362 @@
+/****************************************************************
+ * file hcvbench_main.cc
+ *
+ * Description:
+ *      The helpcovid-bench program, rendering the templates of
+ *      webroot/html/ many times, without any database or web server,
+ *      and reporting timings and allocations as JSON on stdout.
+ *
+ * Author(s):
+ *      © Copyright 2020
+ *      Basile Starynkevitch <basile@starynkevitch.net>
+ *      Abhishek Chakravarti <abhishek@taranjali.org>
+ *
+ *
+ * License:
+ *    This HELPCOVID program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include "hcv_header.hh"
+#include <json/writer.h>
+#include <dirent.h>
+
+extern "C" const char hcvbench_main_gitid[] = HELPCOVID_GITID;
+extern "C" const char hcvbench_main_date[] = __DATE__;
+
+/// defined in hcv_web.cc
+extern "C" std::string hcv_webroot;
+/// defined in hcv_main.cc
+extern void hcv_early_initialize(const char*progname);
+
+
+////////////////////////////////////////////////////////////////
+//// counting allocations. Every operator new of the benchmark
+//// process goes thru here; the counters are per thread so cost
+//// nearly nothing.
+static thread_local long hcvbench_nballoc;
+static thread_local long hcvbench_allocbytes;
+
+void*
+operator new(size_t sz)
+{
+  hcvbench_nballoc++;
+  hcvbench_allocbytes += sz;
+  void*p = malloc(sz?sz:1);
+  if (HCV_UNLIKELY(!p))
+    throw std::bad_alloc();
+  return p;
+} // end operator new
+
+void*
+operator new[](size_t sz)
+{
+  return operator new(sz);
+} // end operator new[]
+
+void
+operator delete(void*p) noexcept
+{
+  free(p);
+} // end operator delete
+
+void
+operator delete[](void*p) noexcept
+{
+  free(p);
+} // end operator delete[]
+
+void
+operator delete(void*p, size_t) noexcept
+{
+  free(p);
+} // end sized operator delete
+
+void
+operator delete[](void*p, size_t) noexcept
+{
+  free(p);
+} // end sized operator delete[]
+
+
+
+////////////////////////////////////////////////////////////////
+enum hcvbench_option_en
+{
+  HCVBENCHOPT__NONE=0,
+  HCVBENCHOPT_REPEAT='n',
+  HCVBENCHOPT_THREADS='T',
+  HCVBENCHOPT_WEBROOT='R',
+  HCVBENCHOPT_CONFIG='C',
+  HCVBENCHOPT_LANGUAGE='L',
+};
+
+struct argp_option hcvbench_options[] =
+{
+  /* ======= number of renderings per thread ======= */
+  {/*name:*/ "repeat", ///
+    /*key:*/ HCVBENCHOPT_REPEAT, ///
+    /*arg:*/ "COUNT", ///
+    /*flags:*/ 0, ///
+    /*doc:*/ "renders each template COUNT times in every thread (default 1000)", ///
+    /*group:*/0 ///
+  },
+  /* ======= number of rendering threads ======= */
+  {/*name:*/ "threads", ///
+    /*key:*/ HCVBENCHOPT_THREADS, ///
+    /*arg:*/ "NBTHREADS", ///
+    /*flags:*/ 0, ///
+    /*doc:*/ "renders in NBTHREADS concurrent threads (default 1)", ///
+    /*group:*/0 ///
+  },
+  /* ======= web root ======= */
+  {/*name:*/ "web-root", ///
+    /*key:*/ HCVBENCHOPT_WEBROOT, ///
+    /*arg:*/ "WEBROOT", ///
+    /*flags:*/ 0, ///
+    /*doc:*/ "uses the templates under WEBROOT/html/ (default webroot/)", ///
+    /*group:*/0 ///
+  },
+  /* ======= optional configuration file ======= */
+  {/*name:*/ "config", ///
+    /*key:*/ HCVBENCHOPT_CONFIG, ///
+    /*arg:*/ "CONFIGFILE", ///
+    /*flags:*/ 0, ///
+    /*doc:*/ "loads CONFIGFILE, e.g. for its [web] cache TTLs (default: none)", ///
+    /*group:*/0 ///
+  },
+  /* ======= Accept-Language of the fake requests ======= */
+  {/*name:*/ "accept-language", ///
+    /*key:*/ HCVBENCHOPT_LANGUAGE, ///
+    /*arg:*/ "LANGUAGES", ///
+    /*flags:*/ 0, ///
+    /*doc:*/ "sends LANGUAGES as the Accept-Language of every fake request, e.g. --accept-language=fr", ///
+    /*group:*/0 ///
+  },
+  /* ======= terminating empty option ======= */
+  {/*name:*/(const char*)0, ///
+    /*key:*/0, ///
+    /*arg:*/(const char*)0, ///
+    /*flags:*/0, ///
+    /*doc:*/(const char*)0, ///
+    /*group:*/0 ///
+  }
+};
+
+static long hcvbench_repeat = 1000;
+static int hcvbench_nbthreads = 1;
+static std::string hcvbench_webroot = "webroot/";
+static std::string hcvbench_config;
+static std::string hcvbench_accept_language;
+
+static error_t
+hcvbench_parse1opt (int key, char *arg, struct argp_state *state HCV_UNUSED)
+{
+  switch (key)
+    {
+    case HCVBENCHOPT_REPEAT:
+      hcvbench_repeat = atol(arg);
+      if (hcvbench_repeat < 1)
+        hcvbench_repeat = 1;
+      return 0;
+    case HCVBENCHOPT_THREADS:
+      hcvbench_nbthreads = atoi(arg);
+      if (hcvbench_nbthreads < 1)
+        hcvbench_nbthreads = 1;
+      else if (hcvbench_nbthreads > 64)
+        hcvbench_nbthreads = 64;
+      return 0;
+    case HCVBENCHOPT_WEBROOT:
+      hcvbench_webroot = arg;
+      return 0;
+    case HCVBENCHOPT_CONFIG:
+      hcvbench_config = arg;
+      return 0;
+    case HCVBENCHOPT_LANGUAGE:
+      hcvbench_accept_language = arg;
+      return 0;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+} // end hcvbench_parse1opt
+
+
+
+////////////////////////////////////////////////////////////////
+typedef std::string hcvbench_render_sig_t(const std::string&, Hcv_template_data*);
+
+struct hcvbench_result_st
+{
+  double hcvbres_elapsed;	// thread elapsed time in seconds
+  long hcvbres_nballoc;		// number of operator new
+  long hcvbres_allocbytes;	// bytes given to operator new
+  long hcvbres_outbytes;	// bytes of rendered HTML
+};
+
+static std::atomic<long> hcvbench_reqcounter;
+
+/// render the template at FILEPATH repeatedly into a fake GET request,
+/// as the views of hcv_views.cc do, but without any web server
+static void
+hcvbench_render_loop(const std::string&filepath, const std::string&webpath,
+                     hcvbench_render_sig_t*renderfun, hcvbench_result_st*res)
+{
+  httplib::Request req;
+  httplib::Response resp;
+  req.method = "GET";
+  req.path = webpath;
+  req.version = "HTTP/1.1";
+  req.set_header("Host", "localhost");
+  if (!hcvbench_accept_language.empty())
+    req.set_header("Accept-Language", hcvbench_accept_language.c_str());
+  long nballoc = hcvbench_nballoc;
+  long allocbytes = hcvbench_allocbytes;
+  long outbytes = 0;
+  double startim = hcv_monotonic_real_time();
+  for (long ix = 0; ix < hcvbench_repeat; ix++)
+    {
+      resp.headers.clear();
+      Hcv_http_render_context ctx(req, resp, hcvbench_reqcounter.fetch_add(1));
+      std::string html = (*renderfun)(filepath, ctx.get());
+      outbytes += html.size();
+    }
+  res->hcvbres_elapsed = hcv_monotonic_real_time() - startim;
+  res->hcvbres_nballoc = hcvbench_nballoc - nballoc;
+  res->hcvbres_allocbytes = hcvbench_allocbytes - allocbytes;
+  res->hcvbres_outbytes = outbytes;
+} // end hcvbench_render_loop
+
+
+static Json::Value
+hcvbench_measure(const std::string&filename, const char*mode, hcvbench_render_sig_t*renderfun)
+{
+  std::string filepath = hcv_webroot + "html/" + filename;
+  std::string webpath = "/html/" + filename;
+  /// a first rendering, not measured, builds the template plan and
+  /// fills the caches
+  {
+    hcvbench_result_st warmup = {0.0, 0, 0, 0};
+    long repeat = hcvbench_repeat;
+    hcvbench_repeat = 1;
+    hcvbench_render_loop(filepath, webpath, renderfun, &warmup);
+    hcvbench_repeat = repeat;
+  }
+  std::vector<hcvbench_result_st> results(hcvbench_nbthreads, hcvbench_result_st{0.0, 0, 0, 0});
+  std::vector<std::thread> threads;
+  double startim = hcv_monotonic_real_time();
+  for (int tix = 0; tix < hcvbench_nbthreads; tix++)
+    threads.emplace_back(hcvbench_render_loop, std::cref(filepath), std::cref(webpath),
+                         renderfun, &results[tix]);
+  for (std::thread& thr: threads)
+    thr.join();
+  double wallelapsed = hcv_monotonic_real_time() - startim;
+  double elapsed = 0.0;
+  long nballoc = 0, allocbytes = 0, outbytes = 0;
+  for (auto& r: results)
+    {
+      elapsed += r.hcvbres_elapsed;
+      nballoc += r.hcvbres_nballoc;
+      allocbytes += r.hcvbres_allocbytes;
+      outbytes += r.hcvbres_outbytes;
+    };
+  double nbrenders = (double)hcvbench_repeat * hcvbench_nbthreads;
+  Json::Value jres(Json::objectValue);
+  jres["template"] = filename;
+  jres["mode"] = mode;
+  jres["renders"] = (Json::Value::Int64)(hcvbench_repeat * hcvbench_nbthreads);
+  jres["ns_per_render"] = 1.0e9 * elapsed / nbrenders;
+  jres["renders_per_second"] = nbrenders / wallelapsed;
+  jres["allocs_per_render"] = nballoc / nbrenders;
+  jres["alloc_bytes_per_render"] = allocbytes / nbrenders;
+  jres["bytes_per_render"] = outbytes / nbrenders;
+  return jres;
+} // end hcvbench_measure
+
+
+int
+main(int argc, char**argv)
+{
+  hcv_early_initialize(argv[0]);
+  /// the views may log on every rendering; that should go to
+  /// syslog(3) only, not to the benchmark output
+  closelog();
+  openlog(basename(argv[0]), LOG_PID, LOG_LOCAL0);
+  static struct argp argparser;
+  argparser.options = hcvbench_options;
+  argparser.parser = hcvbench_parse1opt;
+  argparser.args_doc = "*no-positional-arguments*";
+  argparser.doc = "helpcovid-bench - renders the webroot/html/ templates of\n"
+                  "github.com/bstarynk/helpcovid and outputs JSON timings";
+  if (argp_parse(&argparser, argc, argv, 0, nullptr, nullptr))
+    HCV_FATALOUT("failed to parse program arguments to " << argv[0]);
+  if (!hcvbench_config.empty())
+    hcv_load_config_file(hcvbench_config.c_str());
+  if (hcvbench_webroot.empty() || hcvbench_webroot.back() != '/')
+    hcvbench_webroot.push_back('/');
+  hcv_webroot = hcvbench_webroot;
+  hcv_initialize_templates();
+  std::vector<std::string> filenames;
+  {
+    std::string htmldir = hcv_webroot + "html";
+    DIR*dir = opendir(htmldir.c_str());
+    if (!dir)
+      HCV_FATALOUT("helpcovid-bench cannot open directory " << htmldir);
+    while (struct dirent*ent = readdir(dir))
+      {
+        std::string name = ent->d_name;
+        if (name.size() > 5 && name[0] != '.'
+            && name.compare(name.size()-5, 5, ".html") == 0)
+          filenames.push_back(name);
+      };
+    closedir(dir);
+    std::sort(filenames.begin(), filenames.end());
+  }
+  Json::Value jbench(Json::objectValue);
+  jbench["gitid"] = hcv_gitid;
+  jbench["timestamp"] = hcv_timestamp;
+  jbench["hostname"] = hcv_get_hostname();
+  jbench["webroot"] = hcv_webroot;
+  jbench["repeat"] = (Json::Value::Int64)hcvbench_repeat;
+  jbench["threads"] = hcvbench_nbthreads;
+  jbench["accept_language"] = hcvbench_accept_language;
+  jbench["encoded_html_ns_per_byte"] = hcv_benchmark_encoded_html(false, 2000);
+  Json::Value jtemplates(Json::arrayValue);
+  for (const std::string& filename: filenames)
+    {
+      jtemplates.append(hcvbench_measure(filename, "plain", hcv_expand_template_file));
+      jtemplates.append(hcvbench_measure(filename, "cached", hcv_expand_cached_template_file));
+    };
+  jbench["templates"] = jtemplates;
+  {
+    long hits=0, misses=0, nbpages=0;
+    hcv_page_cache_statistics(&hits, &misses, &nbpages);
+    jbench["page_cache_hits"] = (Json::Value::Int64)hits;
+    jbench["page_cache_misses"] = (Json::Value::Int64)misses;
+    hcv_fragment_cache_statistics(&hits, &misses, &nbpages);
+    jbench["fragment_cache_hits"] = (Json::Value::Int64)hits;
+    jbench["fragment_cache_misses"] = (Json::Value::Int64)misses;
+  }
+  {
+    long nbcreated=0, nbreused=0;
+    hcv_render_context_statistics(&nbcreated, &nbreused);
+    jbench["render_contexts_created"] = (Json::Value::Int64)nbcreated;
+    jbench["render_contexts_reused"] = (Json::Value::Int64)nbreused;
+  }
+  std::cout << Json::writeString(hcv_get_json_builder(), jbench) << std::endl;
+  return 0;
+} // end of main
+
+
+
+////////////////////////// end of file hcvbench_main.cc